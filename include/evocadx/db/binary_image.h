@@ -0,0 +1,202 @@
+/* binary_image.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _BINARY_IMAGE_H_
+#define _BINARY_IMAGE_H_
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <cstddef>
+#include <limits>
+#include <stdint.h>
+#include <evocadx/db/png.h>
+
+/*! Black & white image stored at 1 bit per pixel.
+
+ Thresholded (unweighted) pngs only contain 0 and max pixel values, so they
+ can be stored in 1/16th of the memory.  A binary_image has the same
+ accessors as png (operator[] and operator()(i,j) return 0 or max by value),
+ and it additionally supports reading runs of up to 64 pixels in a row with
+ a couple of word operations (see row_bits()).
+
+ A binary_image is a matrix itself, so cameras should read it directly, e.g.
+ retina2_iterator<binary_image>: operator()(i,j) finds a pixel with a shift
+ and a mask, whereas operator[] (and so sequence_matrix, which reads element
+ i*width+j) has to divide the index by the width to find the pixel's row.
+
+ Each row is padded to a whole number of 64-bit words; bit j%64 of word
+ j/64 holds pixel j, and padding bits are always 0.
+ */
+class binary_image {
+public:
+    typedef png::value_type value_type; //!< Value type for pixel data.
+    typedef value_type reference; //!< Pixels are returned by value.
+    typedef value_type const_reference; //!< Pixels are returned by value.
+    typedef uint64_t word_type; //!< Type for storing packed pixels.
+    typedef std::vector<word_type> word_vector_type; //!< Type for storing packed pixels.
+    typedef png::centroid_type centroid_type; //!< Type for storing centroid.
+    typedef png::origin_type origin_type; //!< Type for storing the origin of a cropped image.
+
+    //! Constructor; an empty (all 0) image of the given size.
+    binary_image(unsigned long width=0, unsigned long height=0);
+
+    /*! Constructor; pixels of img that are > 0 are set, and the centroid is
+     copied from img.  If img has a mip pyramid, so does this image, with a
+     pixel set at each coarser level if any pixel under it is set.  If img
+     was cropped, so is this image.
+     */
+    binary_image(const png& img);
+
+    //! Returns the width of this image, in pixels.
+    unsigned long width() const { return _width; }
+
+    //! Returns the height of this image, in pixels.
+    unsigned long height() const { return _height; }
+
+    //! Returns the size of this image, in pixels.
+    unsigned long size() const { return _width * _height; }
+
+    //! Returns the number of rows (when treating this image as a matrix).
+    unsigned long size1() const { return _height; }
+
+    //! Returns the number of columns (when treating this image as a matrix).
+    unsigned long size2() const { return _width; }
+
+    //! Returns the width of the image this one was cropped from (see png::crop()).
+    unsigned long full_width() const { return _full_width; }
+
+    //! Returns the height of the image this one was cropped from (see png::crop()).
+    unsigned long full_height() const { return _full_height; }
+
+    //! Returns the position of this image in the image it was cropped from (see png::crop()).
+    const origin_type& origin() const { return _origin; }
+
+    //! Returns the number of bytes used for pixel data.
+    std::size_t bytes() const { return _bits.size() * sizeof(word_type); }
+
+    //! Returns true if pixel (i,j) (row, column) is set.
+    bool test(std::size_t i, std::size_t j) const {
+        return (_bits[i*_stride + j/64] >> (j%64)) & 1;
+    }
+
+    //! Set pixel (i,j) (row, column) to v.
+    void set(std::size_t i, std::size_t j, bool v=true) {
+        word_type m = static_cast<word_type>(1) << (j%64);
+        if(v) {
+            _bits[i*_stride + j/64] |= m;
+        } else {
+            _bits[i*_stride + j/64] &= ~m;
+        }
+    }
+
+    //! Returns the value (0 or max) of pixel (i,j) (row, column).
+    value_type operator()(std::size_t i, std::size_t j) const {
+        return test(i, j) ? max_value() : 0;
+    }
+
+    //! Returns the value (0 or max) of the n'th pixel, in row-major order (slower than operator()).
+    value_type operator[](std::size_t n) const {
+        return test(n / _width, n % _width) ? max_value() : 0;
+    }
+
+    /*! Returns the n <= 64 pixels of row i starting at column j as the low n
+     bits of a word (bit k is pixel (i,j+k)); pixels outside the image are 0.
+     */
+    word_type row_bits(long i, long j, unsigned int n) const;
+
+    //! Returns the number of set pixels.
+    std::size_t count() const;
+
+    //! Returns the image centroid.
+    const centroid_type& get_centroid() const { return _centroid; }
+
+    //! Returns the distance of specified (x,y) coordinate to the centroid of this image.
+    double distance_to_centroid(std::size_t x, std::size_t y) const;
+
+    //! Returns the number of levels in this image's mip pyramid (1 if it doesn't have one).
+    std::size_t levels() const { return 1 + _pyramid.size(); }
+
+    //! Returns level k of this image's mip pyramid (level 0 is this image).
+    const binary_image& level(std::size_t k) const { return k ? *_pyramid[k-1] : *this; }
+
+    /*! Returns this image reduced by 2 in each dimension (rounding up), with
+     each pixel set if any pixel of its 2x2 block is set.
+     */
+    binary_image reduce() const;
+
+    /*! Build the occupancy index of this image (and of each level of its
+     mip pyramid): a quadtree stored as a stack of reduce()d bitmaps, where
+     level k has one pixel per 2^k x 2^k block of this image.
+     */
+    void build_index();
+
+    //! Returns true if the occupancy index has been built.
+    bool indexed() const { return !_index.empty(); }
+
+    /*! Returns true if no pixel in rows [i0,i1) and columns [j0,j1) is set;
+     the rectangle is clipped to the image.
+
+     With the occupancy index, this descends the quadtree from the (at most
+     2x2) blocks of the smallest level that cover the rectangle, skipping
+     empty blocks and stopping at the first set block that lies inside the
+     rectangle, so the cost grows with the log of the rectangle's size
+     rather than its area.  Without the index, the rectangle is scanned a
+     word at a time.
+     */
+    bool empty(long i0, long j0, long i1, long j1) const;
+
+    //! Returns the value of set pixels.
+    static value_type max_value() { return std::numeric_limits<value_type>::max(); }
+
+protected:
+    //! Pack the pixels and centroid of img (but not its pyramid).
+    void pack(const png& img);
+
+    /*! Returns true if any pixel of the rectangle is set in the block at
+     (i,j) of level k of the occupancy index (level 0 is this image).
+     */
+    bool any(std::size_t k, std::size_t i, std::size_t j, std::size_t i0, std::size_t j0, std::size_t i1, std::size_t j1) const;
+
+    //! Returns the 64 pixels of row i starting at column j >= 0.
+    word_type word_at(std::size_t i, std::size_t j) const {
+        std::size_t w=j/64, b=j%64;
+        if(w >= _stride) {
+            return 0;
+        }
+        const word_type* row = &_bits[i*_stride];
+        word_type r = row[w] >> b;
+        if(b && ((w+1) < _stride)) {
+            r |= row[w+1] << (64-b);
+        }
+        return r;
+    }
+
+    unsigned long _width; //!< Width of image in pixels.
+    unsigned long _height; //!< Height of image in pixels.
+    std::size_t _stride; //!< Words per row.
+    word_vector_type _bits; //!< Packed pixels.
+    centroid_type _centroid; //!< Centroid of the image.
+    unsigned long _full_width; //!< Width of the image before cropping.
+    unsigned long _full_height; //!< Height of the image before cropping.
+    origin_type _origin; //!< Position of this image in the image before cropping.
+    std::vector<boost::shared_ptr<binary_image> > _pyramid; //!< Coarser levels of the mip pyramid (optional).
+    std::vector<boost::shared_ptr<binary_image> > _index; //!< Levels 1 and up of the occupancy index (optional).
+};
+
+#endif
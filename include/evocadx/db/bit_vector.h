@@ -0,0 +1,168 @@
+/* bit_vector.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _BIT_VECTOR_H_
+#define _BIT_VECTOR_H_
+
+#include <boost/serialization/nvp.hpp>
+#include <boost/serialization/vector.hpp>
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+/*! Vector of 0/1 values, stored at 1 bit per element.
+
+ Element i is bit (i % 8) of byte i/8, so the bytes of a bit_vector are
+ exactly its packed lidx representation.  Elements read as uint8_t 0 or 1
+ (so a bit_vector can back a sequence_matrix), and writing any non-zero value
+ sets the bit.  Unused bits of the last byte are always 0.
+ */
+class bit_vector {
+public:
+    typedef uint8_t value_type; //!< Type of the elements, as read.
+    typedef std::size_t size_type; //!< Type for sizes and indices.
+    typedef value_type const_reference; //!< Elements are read by value.
+
+    //! Proxy for a single (writable) element.
+    class reference {
+    public:
+        //! Constructor.
+        reference(uint8_t& byte, uint8_t mask) : _byte(byte), _mask(mask) {
+        }
+
+        //! Returns the value of this element.
+        operator value_type() const { return (_byte & _mask) != 0; }
+
+        //! Set this element to (v != 0).
+        template <typename T>
+        reference& operator=(T v) {
+            _byte = (v != 0) ? (_byte | _mask) : (_byte & ~_mask);
+            return *this;
+        }
+
+        //! Set this element to the value of another.
+        reference& operator=(const reference& r) {
+            return *this = static_cast<value_type>(r);
+        }
+
+    protected:
+        uint8_t& _byte; //!< Byte holding this element.
+        uint8_t _mask; //!< Mask of this element within _byte.
+    };
+
+    //! Constructor.
+    bit_vector(size_type n=0, value_type v=0) : _size(0) {
+        resize(n, v);
+    }
+
+    //! Returns the number of elements.
+    size_type size() const { return _size; }
+
+    //! Returns true if this vector has no elements.
+    bool empty() const { return _size == 0; }
+
+    //! Returns the number of bytes used by the elements.
+    size_type nbytes() const { return _bytes.size(); }
+
+    //! Returns a pointer to the packed elements.
+    const uint8_t* bytes() const { return _bytes.empty() ? 0 : &_bytes[0]; }
+
+    //! Returns element n.
+    const_reference operator[](size_type n) const { return (_bytes[n >> 3] >> (n & 7)) & 0x01; }
+
+    //! Returns a writable proxy for element n.
+    reference operator[](size_type n) { return reference(_bytes[n >> 3], 0x01 << (n & 7)); }
+
+    //! Resize to n elements, setting new elements to (v != 0).
+    void resize(size_type n, value_type v=0) {
+        size_type old=_size;
+        _bytes.resize((n + 7) / 8, 0);
+        _size = n;
+        if(v) {
+            for(size_type i=old; i<n; ++i) {
+                (*this)[i] = 1;
+            }
+        }
+        clear_tail();
+    }
+
+    //! Remove all elements.
+    void clear() {
+        _bytes.clear();
+        _size = 0;
+    }
+
+    //! Append (v != 0).
+    void push_back(value_type v) {
+        resize(_size + 1);
+        (*this)[_size - 1] = v;
+    }
+
+    //! Replace the elements with (x != 0) for each x in [first, last).
+    template <typename InputIterator>
+    void assign(InputIterator first, InputIterator last) {
+        clear();
+        for( ; first!=last; ++first) {
+            push_back(*first != 0);
+        }
+    }
+
+    //! Replace the elements with n elements packed in the bytes at p.
+    void assign_bytes(const uint8_t* p, size_type n) {
+        _bytes.assign(p, p + (n + 7) / 8);
+        _size = n;
+        clear_tail();
+    }
+
+    //! Swap the elements of this vector with those of v.
+    void swap(bit_vector& v) {
+        std::swap(_size, v._size);
+        _bytes.swap(v._bytes);
+    }
+
+    //! Returns true if v has the same elements as this vector.
+    bool operator==(const bit_vector& v) const {
+        return (_size == v._size) && (_bytes == v._bytes);
+    }
+
+    //! Returns true if v has different elements than this vector.
+    bool operator!=(const bit_vector& v) const {
+        return !(*this == v);
+    }
+
+protected:
+    //! Zero the unused bits of the last byte.
+    void clear_tail() {
+        if(_size & 7) {
+            _bytes.back() &= (0x01 << (_size & 7)) - 1;
+        }
+    }
+
+    size_type _size; //!< Number of elements.
+    std::vector<uint8_t> _bytes; //!< Packed elements.
+
+    friend class boost::serialization::access;
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version) {
+        ar & BOOST_SERIALIZATION_NVP(_size)
+        & BOOST_SERIALIZATION_NVP(_bytes);
+    }
+};
+
+#endif
@@ -0,0 +1,568 @@
+/* block_gzip.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _BLOCK_GZIP_H_
+#define _BLOCK_GZIP_H_
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/operations.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Block-compressed (BGZF-style) gzip.
+
+ A block gzip file is a series of independently compressed gzip members, one
+ per block of (at most block_size bytes of) input, followed by an empty
+ member.  Each member's header carries an extra field (subfield "LX") with the
+ size of the whole member, so a reader can find the next member without
+ decompressing this one, and blocks can be compressed and decompressed in
+ parallel.  Since concatenated gzip members are themselves a valid gzip
+ file, block gzip files can also be read by gzip, zcat, and
+ boost::iostreams::gzip_decompressor.
+
+ The empty member at the end also carries an index (subfield "LI") of the
+ compressed and uncompressed size of every other member, and ends with its
+ own size, so it can be found from the end of the file.  With the index, any
+ range of the uncompressed data can be read by decompressing only the
+ members that overlap it (see block_gzip::index).
+ */
+namespace block_gzip {
+
+    const std::size_t header_size=20; //!< Size of a member header.
+    const std::size_t trailer_size=8; //!< Size of a member trailer (crc32 and input size).
+    const std::size_t index_overhead=38; //!< Size of an index member, less 8 bytes per entry.
+    const std::size_t max_index_entries=8189; //!< Most members that fit in an index (the extra field is at most 64k).
+
+    namespace detail {
+        namespace bio = boost::iostreams;
+
+        //! Store x at p, little-endian.
+        inline void put32(unsigned char* p, uint32_t x) {
+            p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+        }
+
+        //! Returns the little-endian value at p.
+        inline uint32_t get32(const unsigned char* p) {
+            return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+        }
+
+        //! Returns the little-endian value at p.
+        inline uint16_t get16(const unsigned char* p) {
+            return p[0] | (p[1] << 8);
+        }
+
+        //! Returns the size of the header of the member at p (including its extra field).
+        inline std::size_t member_header_size(const unsigned char* p) {
+            return 12 + get16(p + 10);
+        }
+
+        /*! Returns the size of the member whose header is the n bytes at p, or
+         0 if they aren't the header of a block gzip member.
+         */
+        inline std::size_t member_size(const unsigned char* p, std::size_t n) {
+            if((n < header_size) || (p[0] != 0x1f) || (p[1] != 0x8b) || (p[2] != 8) || (p[3] != 0x04)
+               || (get16(p + 10) < 8) || (p[12] != 'L') || (p[13] != 'X') || (p[14] != 4) || (p[15] != 0)) {
+                return 0;
+            }
+            return get32(p + 16);
+        }
+
+        //! Compress the n bytes at in to a single member, in out.
+        inline void deflate_member(const char* in, std::size_t n, int level, std::vector<char>& out) {
+            static const unsigned char h[header_size] = {
+                0x1f, 0x8b, 8, 0x04, 0, 0, 0, 0, 0, 0xff, // gzip header, with FEXTRA
+                8, 0, 'L', 'X', 4, 0, 0, 0, 0, 0 // extra field: LX, and the member size
+            };
+            out.assign(h, h + header_size);
+            uint32_t crc;
+            {
+                bio::zlib_params params(level);
+                params.noheader = true; // raw deflate
+                params.calculate_crc = true;
+                bio::filtering_ostream os;
+                os.push(bio::zlib_compressor(params), 1 << 16);
+                os.push(bio::back_inserter(out));
+                os.write(in, n);
+                os.strict_sync();
+                crc = os.component<bio::zlib_compressor>(0)->crc();
+                os.reset();
+            }
+            out.resize(out.size() + trailer_size);
+            unsigned char* p = reinterpret_cast<unsigned char*>(&out[0]);
+            put32(p + out.size() - 8, crc);
+            put32(p + out.size() - 4, n);
+            put32(p + 16, out.size());
+        }
+
+        //! Decompress the member of n bytes at in, appending its contents to out.
+        inline void inflate_member(const unsigned char* in, std::size_t n, std::vector<char>& out) {
+            if((n < header_size + trailer_size) || (member_size(in, n) != n) || (member_header_size(in) + trailer_size > n)) {
+                throw std::runtime_error("block_gzip.h: corrupt member");
+            }
+            const std::size_t hsize = member_header_size(in), isize = get32(in + n - 4), offset = out.size();
+            out.resize(offset + isize);
+            bio::zlib_params params;
+            params.noheader = true;
+            params.calculate_crc = true;
+            bio::filtering_istream is;
+            is.push(bio::zlib_decompressor(params), 1 << 16);
+            is.push(bio::array_source(reinterpret_cast<const char*>(in) + hsize, n - hsize - trailer_size));
+            if(isize > 0) {
+                is.read(&out[offset], isize);
+            }
+            if((static_cast<std::size_t>(is.gcount()) != isize) || (is.component<bio::zlib_decompressor>(0)->crc() != get32(in + n - 8))) {
+                throw std::runtime_error("block_gzip.h: corrupt member");
+            }
+        }
+
+        /*! Write the empty member that ends a file, indexing members of the
+         given compressed and uncompressed sizes, to out.  If there are too
+         many members to index, the member is written without an index.
+         */
+        inline void index_member(const std::vector<uint32_t>& csizes, const std::vector<uint32_t>& usizes, int level, std::vector<char>& out) {
+            const std::size_t k=csizes.size();
+            if(k > max_index_entries) {
+                deflate_member(0, 0, level, out);
+                return;
+            }
+            const std::size_t m=index_overhead + 8*k;
+            out.assign(m, 0);
+            unsigned char* p = reinterpret_cast<unsigned char*>(&out[0]);
+            static const unsigned char h[16] = {
+                0x1f, 0x8b, 8, 0x04, 0, 0, 0, 0, 0, 0xff, // gzip header, with FEXTRA
+                0, 0, 'L', 'X', 4, 0 // extra field length (below), and LX
+            };
+            std::copy(h, h + 16, p);
+            p[10] = (m - 22) & 0xff; p[11] = (m - 22) >> 8;
+            put32(p + 16, m);
+            p[20] = 'L'; p[21] = 'I'; p[22] = (8*k + 4) & 0xff; p[23] = (8*k + 4) >> 8;
+            for(std::size_t i=0; i<k; ++i) {
+                put32(p + 24 + 8*i, csizes[i]);
+                put32(p + 28 + 8*i, usizes[i]);
+            }
+            put32(p + m - 14, m);
+            p[m - 10] = 0x03; // empty, final, fixed-Huffman deflate block
+            // crc32 and size of the (empty) input are both 0
+        }
+
+        //! Work shared by copies of a filter.
+        struct batch {
+            std::vector<std::vector<char> > in; //!< Input of each block in the batch.
+            std::vector<std::vector<char> > out; //!< Output of each block in the batch.
+            std::vector<std::string> errors; //!< Error (if any) for each block in the batch.
+            std::vector<uint32_t> csizes; //!< Compressed size of each member written so far.
+            std::vector<uint32_t> usizes; //!< Uncompressed size of each member written so far.
+            int level; //!< Compression level.
+
+            //! Compress block i.
+            void deflate(std::size_t i) {
+                try {
+                    deflate_member(in[i].empty() ? 0 : &in[i][0], in[i].size(), level, out[i]);
+                } catch(std::exception& e) {
+                    errors[i] = e.what();
+                }
+            }
+
+            //! Decompress block i.
+            void inflate(std::size_t i) {
+                try {
+                    out[i].clear();
+                    inflate_member(reinterpret_cast<const unsigned char*>(&in[i][0]), in[i].size(), out[i]);
+                } catch(std::exception& e) {
+                    errors[i] = e.what();
+                }
+            }
+
+            //! Throws the first error, if any.
+            void check() {
+                for(std::size_t i=0; i<errors.size(); ++i) {
+                    if(!errors[i].empty()) {
+                        throw std::runtime_error(errors[i]);
+                    }
+                }
+            }
+        };
+
+        //! Run (b->*f)(i) for each block i of b, each on its own thread if nthreads > 1.
+        inline void run(batch* b, void (batch::*f)(std::size_t), std::size_t nthreads) {
+            const std::size_t n=b->in.size();
+            b->out.resize(n);
+            b->errors.assign(n, std::string());
+            if((nthreads <= 1) || (n <= 1)) {
+                for(std::size_t i=0; i<n; ++i) {
+                    (b->*f)(i);
+                }
+            } else {
+                boost::thread_group threads;
+                for(std::size_t i=0; i<n; ++i) {
+                    threads.add_thread(new boost::thread(f, b, i));
+                }
+                threads.join_all();
+            }
+            b->check();
+        }
+
+        //! Returns the default number of threads.
+        inline std::size_t default_threads() {
+            return std::max(1u, boost::thread::hardware_concurrency());
+        }
+
+    } // detail
+
+    //! Returns true if the n bytes at p start with a block gzip member.
+    inline bool match(const unsigned char* p, std::size_t n) {
+        return detail::member_size(p, n) != 0;
+    }
+
+    /*! Boost.Iostreams output filter that block gzips its input.
+
+     Up to nthreads blocks are compressed at a time, each on its own thread,
+     so at most nthreads blocks of input (and their output) are held in
+     memory.
+     */
+    class compressor {
+    public:
+        typedef char char_type;
+        struct category : boost::iostreams::multichar_output_filter_tag, boost::iostreams::closable_tag { };
+
+        //! Constructor.
+        compressor(std::size_t block_size=1<<20, std::size_t nthreads=detail::default_threads(), int level=boost::iostreams::zlib::default_compression)
+        : _block_size(block_size), _nthreads(std::max<std::size_t>(1, nthreads)), _b(new detail::batch()) {
+            _b->level = level;
+            _b->in.push_back(std::vector<char>());
+        }
+
+        //! Write the n bytes at s.
+        template <typename Sink>
+        std::streamsize write(Sink& snk, const char* s, std::streamsize n) {
+            std::streamsize written=0;
+            while(written < n) {
+                std::vector<char>& block = _b->in.back();
+                std::size_t k = std::min<std::size_t>(n - written, _block_size - block.size());
+                block.insert(block.end(), s + written, s + written + k);
+                written += k;
+                if(block.size() == _block_size) {
+                    if(_b->in.size() == _nthreads) {
+                        flush(snk);
+                    }
+                    _b->in.push_back(std::vector<char>());
+                    _b->in.back().reserve(_block_size);
+                }
+            }
+            return written;
+        }
+
+        //! Compress and write any buffered input, followed by the (indexing) empty member.
+        template <typename Sink>
+        void close(Sink& snk) {
+            if(_b->in.back().empty()) {
+                _b->in.pop_back();
+            }
+            flush(snk);
+            std::vector<char> m;
+            detail::index_member(_b->csizes, _b->usizes, _b->level, m);
+            boost::iostreams::write(snk, &m[0], m.size());
+            _b->csizes.clear();
+            _b->usizes.clear();
+            _b->in.push_back(std::vector<char>());
+        }
+
+    protected:
+        //! Compress the buffered blocks, and write them to snk.
+        template <typename Sink>
+        void flush(Sink& snk) {
+            detail::run(_b.get(), &detail::batch::deflate, _nthreads);
+            for(std::size_t i=0; i<_b->out.size(); ++i) {
+                boost::iostreams::write(snk, &_b->out[i][0], _b->out[i].size());
+                _b->csizes.push_back(_b->out[i].size());
+                _b->usizes.push_back(_b->in[i].size());
+            }
+            _b->in.clear();
+        }
+
+        std::size_t _block_size; //!< Size of each block of input.
+        std::size_t _nthreads; //!< Number of blocks compressed at a time.
+        boost::shared_ptr<detail::batch> _b; //!< Blocks being compressed.
+    };
+
+    /*! Boost.Iostreams input filter that decompresses block gzip files.
+
+     Up to nthreads members are decompressed at a time, each on its own
+     thread.  Input that isn't a block gzip member is an error.
+     */
+    class decompressor {
+    public:
+        typedef char char_type;
+        struct category : boost::iostreams::multichar_input_filter_tag, boost::iostreams::closable_tag { };
+
+        //! Constructor.
+        decompressor(std::size_t nthreads=detail::default_threads())
+        : _nthreads(std::max<std::size_t>(1, nthreads)), _b(new detail::batch()), _next(0), _block(0), _eof(false) {
+        }
+
+        //! Read up to n bytes to s.
+        template <typename Source>
+        std::streamsize read(Source& src, char* s, std::streamsize n) {
+            std::streamsize r=0;
+            while(r < n) {
+                if((_block >= _b->out.size()) && !fill(src)) {
+                    break;
+                }
+                std::vector<char>& out = _b->out[_block];
+                std::size_t k = std::min<std::size_t>(n - r, out.size() - _next);
+                std::copy(out.begin() + _next, out.begin() + _next + k, s + r);
+                r += k;
+                _next += k;
+                if(_next == out.size()) {
+                    ++_block;
+                    _next = 0;
+                }
+            }
+            return (r == 0) ? -1 : r;
+        }
+
+        //! Reset, so that this filter can be reused.
+        template <typename Source>
+        void close(Source&) {
+            _b->in.clear();
+            _b->out.clear();
+            _next = _block = 0;
+            _eof = false;
+        }
+
+    protected:
+        //! Read exactly n bytes from src to s; returns false if src ends first.
+        template <typename Source>
+        bool read_exactly(Source& src, char* s, std::size_t n) {
+            std::size_t r=0;
+            while(r < n) {
+                std::streamsize k = boost::iostreams::read(src, s + r, n - r);
+                if(k < 0) {
+                    return false;
+                }
+                r += k;
+            }
+            return true;
+        }
+
+        //! Read and decompress the next batch of members; returns false at the end of the input.
+        template <typename Source>
+        bool fill(Source& src) {
+            _b->in.clear();
+            _b->out.clear();
+            _next = _block = 0;
+            while(!_eof && (_b->in.size() < _nthreads)) {
+                std::vector<char> m(header_size);
+                if(!read_exactly(src, &m[0], header_size)) {
+                    _eof = true;
+                    break;
+                }
+                std::size_t size = detail::member_size(reinterpret_cast<const unsigned char*>(&m[0]), header_size);
+                if(size < header_size + trailer_size) {
+                    throw std::runtime_error("block_gzip.h: not a block gzip member");
+                }
+                m.resize(size);
+                if(!read_exactly(src, &m[header_size], size - header_size)) {
+                    throw std::runtime_error("block_gzip.h: truncated member");
+                }
+                _b->in.push_back(std::vector<char>());
+                _b->in.back().swap(m);
+            }
+            detail::run(_b.get(), &detail::batch::inflate, _nthreads);
+            return !_b->in.empty();
+        }
+
+        std::size_t _nthreads; //!< Number of members decompressed at a time.
+        boost::shared_ptr<detail::batch> _b; //!< Members being decompressed.
+        std::size_t _next; //!< Next byte of the current block.
+        std::size_t _block; //!< Current block.
+        bool _eof; //!< True once the input is exhausted.
+    };
+
+    /*! Index of the members of a block gzip file, for reading arbitrary
+     ranges of its uncompressed data.
+
+     The index is read from the empty member at the end of the file, if it has
+     one; otherwise (e.g., for files with too many members to index), it's
+     built by walking the member headers, which touches one header and
+     trailer per member but decompresses nothing.
+     */
+    class index {
+    public:
+        //! A (non-empty) member of the file.
+        struct entry {
+            uint64_t coffset; //!< Offset of the member in the file.
+            uint64_t uoffset; //!< Offset of its contents in the uncompressed data.
+            uint32_t csize; //!< Size of the member.
+            uint32_t usize; //!< Size of its contents.
+        };
+
+        //! Constructor.
+        index() : _usize(0), _stored(false) {
+        }
+
+        /*! Load the index of the block gzip file in the n bytes at p; returns
+         false if they aren't a block gzip file.
+         */
+        bool load(const unsigned char* p, std::size_t n) {
+            _entries.clear();
+            _usize = 0;
+            _stored = load_stored(p, n);
+            return _stored || scan(p, n);
+        }
+
+        //! Returns the number of (non-empty) members.
+        std::size_t size() const { return _entries.size(); }
+
+        //! Returns member i.
+        const entry& operator[](std::size_t i) const { return _entries[i]; }
+
+        //! Returns the size of the uncompressed data.
+        uint64_t uncompressed_size() const { return _usize; }
+
+        //! Returns true if the index was stored in the file (rather than built by walking it).
+        bool stored() const { return _stored; }
+
+        /*! Read n bytes of uncompressed data starting at offset to s, from the
+         file at p; only the members overlapping the range are decompressed,
+         up to nthreads at a time.
+         */
+        void read(const unsigned char* p, uint64_t offset, std::size_t n, char* s, std::size_t nthreads=detail::default_threads()) const {
+            if(offset + n > _usize) {
+                throw std::runtime_error("block_gzip.h: read past the end of the data");
+            }
+            if(n == 0) {
+                return;
+            }
+            nthreads = std::max<std::size_t>(1, nthreads);
+            std::size_t i=find(offset);
+            detail::batch b;
+            while(n > 0) {
+                b.in.clear();
+                for(std::size_t j=i; (j < _entries.size()) && (b.in.size() < nthreads) && (_entries[j].uoffset < offset + n); ++j) {
+                    const char* m = reinterpret_cast<const char*>(p + _entries[j].coffset);
+                    b.in.push_back(std::vector<char>(m, m + _entries[j].csize));
+                }
+                detail::run(&b, &detail::batch::inflate, nthreads);
+                for(std::size_t j=0; j<b.out.size(); ++j, ++i) {
+                    if(b.out[j].size() != _entries[i].usize) {
+                        throw std::runtime_error("block_gzip.h: index doesn't match member");
+                    }
+                    const std::size_t first=offset - _entries[i].uoffset;
+                    const std::size_t k=std::min<std::size_t>(n, _entries[i].usize - first);
+                    std::copy(b.out[j].begin() + first, b.out[j].begin() + first + k, s);
+                    s += k;
+                    offset += k;
+                    n -= k;
+                }
+            }
+        }
+
+    protected:
+        //! Returns the member containing uncompressed offset.
+        std::size_t find(uint64_t offset) const {
+            std::size_t lo=0, hi=_entries.size();
+            while(hi - lo > 1) {
+                std::size_t mid=(lo + hi) / 2;
+                if(_entries[mid].uoffset <= offset) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        //! Append a member of size csize at coffset, holding usize bytes.
+        void append(uint64_t coffset, uint32_t csize, uint32_t usize) {
+            if(usize == 0) {
+                return;
+            }
+            entry e;
+            e.coffset = coffset;
+            e.uoffset = _usize;
+            e.csize = csize;
+            e.usize = usize;
+            _entries.push_back(e);
+            _usize += usize;
+        }
+
+        //! Load the index stored in the last member of the file; returns false if there isn't one.
+        bool load_stored(const unsigned char* p, std::size_t n) {
+            if(n < index_overhead) {
+                return false;
+            }
+            const std::size_t m=detail::get32(p + n - 14);
+            if((m < index_overhead) || (m > n) || ((m - index_overhead) % 8 != 0)) {
+                return false;
+            }
+            const unsigned char* q = p + n - m;
+            const std::size_t k=(m - index_overhead) / 8;
+            if((detail::member_size(q, m) != m) || (detail::get16(q + 10) != m - 22)
+               || (q[20] != 'L') || (q[21] != 'I') || (detail::get16(q + 22) != 8*k + 4)) {
+                return false;
+            }
+            uint64_t coffset=0;
+            for(std::size_t i=0; i<k; ++i) {
+                const uint32_t csize=detail::get32(q + 24 + 8*i);
+                append(coffset, csize, detail::get32(q + 28 + 8*i));
+                coffset += csize;
+            }
+            if(coffset != n - m) {
+                _entries.clear();
+                _usize = 0;
+                return false;
+            }
+            return true;
+        }
+
+        //! Build the index by walking the members of the file; returns false if it isn't a block gzip file.
+        bool scan(const unsigned char* p, std::size_t n) {
+            std::size_t offset=0;
+            while(offset < n) {
+                const std::size_t m=detail::member_size(p + offset, n - offset);
+                if((m < header_size + trailer_size) || (m > n - offset)) {
+                    _entries.clear();
+                    _usize = 0;
+                    return false;
+                }
+                append(offset, m, detail::get32(p + offset + m - 4));
+                offset += m;
+            }
+            return true;
+        }
+
+        std::vector<entry> _entries; //!< Non-empty members, in order.
+        uint64_t _usize; //!< Size of the uncompressed data.
+        bool _stored; //!< True if the index was stored in the file.
+    };
+
+} // block_gzip
+
+#endif
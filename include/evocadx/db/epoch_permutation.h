@@ -0,0 +1,242 @@
+/* epoch_permutation.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _EPOCH_PERMUTATION_H_
+#define _EPOCH_PERMUTATION_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/*! Order in which the records (or images) of a data set are visited.
+
+ Rather than shuffling the records themselves, which scrambles their order
+ in memory and can't be done while they're being read, fitness functions read
+ record view[i] of an immutable view of the current order.  At the end of
+ each update, advance() builds the next order and swaps it in atomically;
+ views taken before then are unaffected, and keep their order alive for as
+ long as they're held.
+
+ With an epoch length of 0 or 1 updates, advance() reshuffles the whole order
+ every update, as shuffling the records used to.  With an epoch of N > 1
+ updates, the order is shuffled once per epoch, and each update's view starts
+ where the records read from the previous one (as told to advance()) ended,
+ so that the views of an epoch walk the order without skipping or repeating
+ records, and walk the whole data set if at least n records are read over
+ the epoch's N updates (see check_walk()).
+
+ If the records are read in blocks (e.g., from a paged_db), advance() can
+ instead be given the block of each record and the number of blocks that fit
+ in memory.  Each epoch's order then shuffles the blocks, and the records of
+ each window of that many consecutive blocks among themselves, so that a run
+ of records in the order reads as few blocks as possible and repeated passes
+ over it hit blocks that are still cached.
+
+ current() may be called from any thread; the other members are meant to be
+ called from a single thread (typically, at the end of an update).  RNG is
+ called as rng(m), for a random integer in [0, m) (as by std::random_shuffle).
+ */
+class epoch_permutation {
+public:
+    typedef std::vector<std::size_t> index_list_type; //!< Type of a list of record indices.
+    typedef boost::shared_ptr<const index_list_type> order_ptr; //!< Pointer to an immutable order.
+
+    //! Immutable view of the order for one update.
+    class view {
+    public:
+        //! Constructor; an empty view.
+        view() : _offset(0) {
+        }
+
+        //! Constructor; views order, starting at offset.
+        view(order_ptr order, std::size_t offset) : _order(order), _offset(offset) {
+        }
+
+        //! Returns the number of records in the order.
+        std::size_t size() const { return _order ? _order->size() : 0; }
+
+        //! Returns the index of the i'th record to visit (wrapping around the end of the order).
+        std::size_t operator[](std::size_t i) const { return (*_order)[(_offset + i) % _order->size()]; }
+
+    protected:
+        friend class epoch_permutation;
+        order_ptr _order; //!< Order of the records.
+        std::size_t _offset; //!< Position of the first record of this view in the order.
+    };
+
+    //! Constructor; orders n records, in epochs of the given number of updates.
+    epoch_permutation(std::size_t n=0, std::size_t updates=0) : _mutex(new boost::mutex()) {
+        reset(n, updates);
+    }
+
+    //! Copy constructor; the copy shares the current order, but advances independently.
+    epoch_permutation(const epoch_permutation& that) : _mutex(new boost::mutex()) {
+        *this = that;
+    }
+
+    //! Assignment operator.
+    epoch_permutation& operator=(const epoch_permutation& that) {
+        if(this != &that) {
+            view v;
+            std::size_t updates, step, epoch;
+            {
+                boost::mutex::scoped_lock lock(*that._mutex);
+                v = that._current;
+                updates = that._updates;
+                step = that._step;
+                epoch = that._epoch;
+            }
+            boost::mutex::scoped_lock lock(*_mutex);
+            _current = v;
+            _updates = updates;
+            _step = step;
+            _epoch = epoch;
+        }
+        return *this;
+    }
+
+    //! Order records [0, n) in their natural order, in epochs of the given number of updates.
+    void reset(std::size_t n, std::size_t updates=0) {
+        index_list_type* order = new index_list_type(n);
+        for(std::size_t i=0; i<n; ++i) {
+            (*order)[i] = i;
+        }
+        boost::mutex::scoped_lock lock(*_mutex);
+        _current = view(order_ptr(order), 0);
+        _updates = updates;
+        _step = 0;
+        _epoch = 0;
+    }
+
+    //! Replace the order with an arbitrary list of record indices (e.g., a stratified sample).
+    void assign(const index_list_type& order) {
+        order_ptr p(new index_list_type(order));
+        boost::mutex::scoped_lock lock(*_mutex);
+        _current = view(p, 0);
+        _step = 0;
+    }
+
+    //! Returns a view of the current order.
+    view current() const {
+        boost::mutex::scoped_lock lock(*_mutex);
+        return _current;
+    }
+
+    //! Returns the number of epochs started since reset (each full reshuffle starts one).
+    std::size_t epoch() const {
+        boost::mutex::scoped_lock lock(*_mutex);
+        return _epoch;
+    }
+
+    /*! Throws std::invalid_argument if reading per_update records in each of
+     an epoch's updates wouldn't walk all n records.
+     */
+    static void check_walk(std::size_t n, std::size_t updates, std::size_t per_update) {
+        if((updates > 1) && (per_update * updates < n)) {
+            throw std::invalid_argument("epoch_permutation.h: too few records read per update to visit every record in an epoch");
+        }
+    }
+
+    /*! Advance to the next update's order, reshuffling at the start of each
+     epoch; read is the number of records read from the current view.
+     */
+    template <typename RNG>
+    void advance(RNG& rng, std::size_t read) {
+        advance(rng, read, index_list_type(), 0);
+    }
+
+    /*! Advance to the next update's order, reshuffling by blocks at the start
+     of each epoch: record k is in block[k], and window blocks fit in memory.
+     If block is empty, records are shuffled individually.
+     */
+    template <typename RNG>
+    void advance(RNG& rng, std::size_t read, const index_list_type& block, std::size_t window) {
+        view v=current();
+        const std::size_t n=v.size();
+        if((_updates > 1) && (_step + 1 < _updates)) {
+            ++_step;
+            boost::mutex::scoped_lock lock(*_mutex);
+            _current = view(_current._order, n ? ((_current._offset + read) % n) : 0);
+            return;
+        }
+
+        // new epoch; shuffle outside the lock, so readers aren't held up:
+        index_list_type* order = new index_list_type(n);
+        for(std::size_t i=0; i<n; ++i) {
+            (*order)[i] = v[i];
+        }
+        if(block.empty()) {
+            std::random_shuffle(order->begin(), order->end(), rng);
+        } else {
+            block_shuffle(*order, block, std::max<std::size_t>(1, window), rng);
+        }
+        order_ptr p(order);
+        boost::mutex::scoped_lock lock(*_mutex);
+        _current = view(p, 0);
+        _step = 0;
+        ++_epoch;
+    }
+
+protected:
+    //! Shuffle the blocks of order, then the records within each window of blocks.
+    template <typename RNG>
+    static void block_shuffle(index_list_type& order, const index_list_type& block, std::size_t window, RNG& rng) {
+        typedef std::pair<std::size_t, std::size_t> pair_type; // (block, record)
+        std::vector<pair_type> r(order.size());
+        for(std::size_t i=0; i<order.size(); ++i) {
+            r[i] = std::make_pair(block[order[i]], order[i]);
+        }
+        std::sort(r.begin(), r.end());
+
+        // runs of records in the same block:
+        std::vector<pair_type> runs;
+        for(std::size_t i=0; i<r.size(); ) {
+            std::size_t j=i+1;
+            while((j < r.size()) && (r[j].first == r[i].first)) {
+                ++j;
+            }
+            runs.push_back(std::make_pair(i, j));
+            i = j;
+        }
+        std::random_shuffle(runs.begin(), runs.end(), rng);
+
+        index_list_type::iterator o=order.begin();
+        for(std::size_t i=0; i<runs.size(); i+=window) {
+            index_list_type::iterator first=o;
+            for(std::size_t k=i; (k < i+window) && (k < runs.size()); ++k) {
+                for(std::size_t j=runs[k].first; j<runs[k].second; ++j, ++o) {
+                    *o = r[j].second;
+                }
+            }
+            std::random_shuffle(first, o, rng);
+        }
+    }
+
+    boost::scoped_ptr<boost::mutex> _mutex; //!< Guards the current view.
+    view _current; //!< Current view.
+    std::size_t _updates; //!< Number of updates per epoch.
+    std::size_t _step; //!< Update within the current epoch.
+    std::size_t _epoch; //!< Number of epochs started.
+};
+
+#endif
@@ -0,0 +1,92 @@
+/* histogram.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <stdint.h>
+
+/*! Integer histogram of 16b pixel values, fused with the sums needed for a
+ thresholded centroid.
+
+ Along with the count of pixels of each value v, the histogram keeps the sums
+ of the column (x) and row (y) positions of those pixels.  The centroid of
+ the pixels >= any threshold t is then a sum over bins instead of another
+ pass over the image, so an image only has to be read once to both pick a
+ threshold and find its centroid.
+
+ Rows are added a run of equal pixels at a time, which turns the long runs
+ of background in a mammogram into a single update instead of a chain of
+ dependent increments to the same bin.  Threads build private histograms
+ over bands of rows, which are then merged.
+ */
+class histogram {
+public:
+    typedef uint16_t value_type; //!< Type of pixel values.
+    typedef uint32_t count_type; //!< Type for pixel counts.
+    typedef uint64_t sum_type; //!< Type for sums of pixel positions.
+    typedef std::pair<double, double> centroid_type; //!< Type for storing centroid (x,y).
+
+    //! Number of bins.
+    static const std::size_t bins = 65536;
+
+    //! Constructor; an empty histogram.
+    histogram();
+
+    //! Add row y of an image, which is n pixels wide.
+    void add_row(const value_type* row, std::size_t n, std::size_t y);
+
+    //! Add a width x height row-major image, using nthreads threads.
+    void add(const value_type* pixels, std::size_t width, std::size_t height, unsigned int nthreads=1);
+
+    //! Merge another histogram into this one.
+    void merge(const histogram& h);
+
+    //! Returns the number of pixels with value v.
+    count_type operator[](std::size_t v) const { return _count[v]; }
+
+    //! Returns the total number of pixels.
+    std::size_t total() const { return _total; }
+
+    /*! Returns the centroid of the pixels with values >= t, rounded to whole
+     pixels (NaN if there are none).
+     */
+    centroid_type centroid(value_type t) const;
+
+protected:
+    std::vector<count_type> _count; //!< Pixel counts, by value.
+    std::vector<sum_type> _x; //!< Sums of pixel columns, by value.
+    std::vector<sum_type> _y; //!< Sums of pixel rows, by value.
+    std::size_t _total; //!< Total number of pixels.
+};
+
+/*! Threshold heuristic: the threshold is the value above which a fraction
+ tail of the pixels lie, but no lower than fraction floor of the value range.
+ */
+histogram::value_type tail_threshold(const histogram& h, double tail=0.4, double floor=0.15);
+
+/*! Otsu's method: the threshold that maximizes the between-class variance of
+ the pixels below and at-or-above it.
+ */
+histogram::value_type otsu_threshold(const histogram& h);
+
+#endif
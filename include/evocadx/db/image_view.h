@@ -0,0 +1,127 @@
+/* image_view.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _IMAGE_VIEW_H_
+#define _IMAGE_VIEW_H_
+
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+/*! Mirrored, flipped, and/or transposed view of an image (png or
+ binary_image), that doesn't copy any pixels.
+
+ The orientation is a combination of TRANSPOSE, FLIP_V, and FLIP_H; the view
+ is the image transposed (if TRANSPOSE), then flipped top to bottom (if
+ FLIP_V), then mirrored left to right (if FLIP_H), so orientations 0-7 give
+ all eight rotations and reflections of the image.  A view has the same
+ accessors as the image it views (operator[], size1(), size2(),
+ get_centroid(), ...), all in the view's coordinates, so it can be used as
+ the backing store for sequence_matrix and retina2_iterator.
+
+ The viewed image must have operator()(i,j), and must outlive the view.
+ */
+template <typename Image>
+class image_view {
+public:
+    typedef typename Image::value_type value_type; //!< Value type for pixel data.
+    typedef value_type reference; //!< Pixels are returned by value.
+    typedef value_type const_reference; //!< Pixels are returned by value.
+    typedef std::pair<double, double> centroid_type; //!< Type for storing centroid.
+
+    //! Orientation flags.
+    enum { FLIP_H=0x01, FLIP_V=0x02, TRANSPOSE=0x04 };
+
+    //! Number of distinct orientations.
+    static const unsigned int orientations = 8;
+
+    //! Constructor.
+    image_view(const Image& img, unsigned int orientation=0) : _img(img), _orientation(orientation % orientations) {
+        _rows = (_orientation & TRANSPOSE) ? img.size2() : img.size1();
+        _cols = (_orientation & TRANSPOSE) ? img.size1() : img.size2();
+        centroid_type c = img.get_centroid();
+        if(_orientation & TRANSPOSE) {
+            std::swap(c.first, c.second);
+        }
+        if(_orientation & FLIP_V) {
+            c.second = _rows - 1 - c.second;
+        }
+        if(_orientation & FLIP_H) {
+            c.first = _cols - 1 - c.first;
+        }
+        _centroid = c;
+    }
+
+    //! Returns the viewed image.
+    const Image& image() const { return _img; }
+
+    //! Returns the orientation of this view.
+    unsigned int orientation() const { return _orientation; }
+
+    //! Returns the width of this view, in pixels.
+    unsigned long width() const { return _cols; }
+
+    //! Returns the height of this view, in pixels.
+    unsigned long height() const { return _rows; }
+
+    //! Returns the size of this view, in pixels.
+    unsigned long size() const { return _rows * _cols; }
+
+    //! Returns the number of rows (when treating this view as a matrix).
+    unsigned long size1() const { return _rows; }
+
+    //! Returns the number of columns (when treating this view as a matrix).
+    unsigned long size2() const { return _cols; }
+
+    //! Returns pixel (i,j) (row, column) of this view.
+    value_type operator()(std::size_t i, std::size_t j) const {
+        if(_orientation & FLIP_H) {
+            j = _cols - 1 - j;
+        }
+        if(_orientation & FLIP_V) {
+            i = _rows - 1 - i;
+        }
+        return (_orientation & TRANSPOSE) ? _img(j, i) : _img(i, j);
+    }
+
+    //! Returns the n'th pixel of this view, in row-major order.
+    value_type operator[](std::size_t n) const {
+        return (*this)(n / _cols, n % _cols);
+    }
+
+    //! Returns the centroid of the image, in this view's coordinates.
+    const centroid_type& get_centroid() const { return _centroid; }
+
+    //! Returns the distance of (x,y), in this view's coordinates, to the centroid.
+    double distance_to_centroid(std::size_t x, std::size_t y) const {
+        return sqrt(pow((x - _centroid.first), 2) + pow((y - _centroid.second), 2));
+    }
+
+protected:
+    const Image& _img; //!< Image being viewed.
+    unsigned int _orientation; //!< Orientation flags.
+    unsigned long _rows; //!< Number of rows in this view.
+    unsigned long _cols; //!< Number of columns in this view.
+    centroid_type _centroid; //!< Centroid, in this view's coordinates.
+};
+
+template <typename Image>
+const unsigned int image_view<Image>::orientations;
+
+#endif
@@ -0,0 +1,149 @@
+/* integral.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _INTEGRAL_H_
+#define _INTEGRAL_H_
+
+#include <algorithm>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/*! Integral image (summed-area table) of a row-major image.
+
+ Pixels must be non-negative.  Two tables of (height+1) x (width+1) entries
+ are kept: one of pixel sums,
+ and one of counts of non-zero ("occupied") pixels.  The sum, mean, and
+ occupancy of any rectangle can then be queried in O(1), regardless of its
+ size.
+
+ Rectangles are given as half-open [i0,i1) rows by [j0,j1) columns, and are
+ clipped to the image, so that queries centered near the edges of the image
+ (e.g., by a camera) don't need to be special-cased; means and occupancies
+ are relative to the area of the clipped rectangle.
+ */
+class integral_image {
+public:
+    typedef uint64_t sum_type; //!< Type for pixel sums.
+    typedef uint32_t count_type; //!< Type for pixel counts.
+
+    //! Constructor; an empty integral image.
+    integral_image() : _width(0), _height(0) {
+    }
+
+    //! Constructor; build the integral image of s, where pixel (i,j) is s[i*width+j].
+    template <typename Sequence>
+    integral_image(const Sequence& s, unsigned long width, unsigned long height) {
+        build(s, width, height);
+    }
+
+    //! Build the integral image of s, where pixel (i,j) is s[i*width+j].
+    template <typename Sequence>
+    void build(const Sequence& s, unsigned long width, unsigned long height) {
+        _width = width;
+        _height = height;
+        const std::size_t stride = width + 1;
+        _sums.assign(stride * (height + 1), 0);
+        _counts.assign(stride * (height + 1), 0);
+        for(std::size_t i=0; i<height; ++i) {
+            sum_type rs=0;
+            count_type rc=0;
+            const sum_type* sp = &_sums[i*stride];
+            const count_type* cp = &_counts[i*stride];
+            sum_type* so = &_sums[(i+1)*stride];
+            count_type* co = &_counts[(i+1)*stride];
+            for(std::size_t j=0; j<width; ++j) {
+                sum_type v = s[i*width + j];
+                rs += v;
+                rc += (v != 0);
+                so[j+1] = sp[j+1] + rs;
+                co[j+1] = cp[j+1] + rc;
+            }
+        }
+    }
+
+    //! Returns true if this integral image hasn't been built.
+    bool empty() const { return _sums.empty(); }
+
+    //! Returns the width of the image.
+    unsigned long width() const { return _width; }
+
+    //! Returns the height of the image.
+    unsigned long height() const { return _height; }
+
+    //! Returns the number of pixels of rectangle [i0,i1) x [j0,j1) that are inside the image.
+    std::size_t area(long i0, long j0, long i1, long j1) const {
+        if(!clip(i0, j0, i1, j1)) {
+            return 0;
+        }
+        return static_cast<std::size_t>(i1 - i0) * static_cast<std::size_t>(j1 - j0);
+    }
+
+    //! Returns the sum of pixels in rectangle [i0,i1) x [j0,j1).
+    sum_type sum(long i0, long j0, long i1, long j1) const {
+        if(!clip(i0, j0, i1, j1)) {
+            return 0;
+        }
+        return rect(_sums, i0, j0, i1, j1);
+    }
+
+    //! Returns the number of non-zero pixels in rectangle [i0,i1) x [j0,j1).
+    count_type count(long i0, long j0, long i1, long j1) const {
+        if(!clip(i0, j0, i1, j1)) {
+            return 0;
+        }
+        return rect(_counts, i0, j0, i1, j1);
+    }
+
+    //! Returns the mean pixel value in rectangle [i0,i1) x [j0,j1), or 0 if it is outside the image.
+    double mean(long i0, long j0, long i1, long j1) const {
+        std::size_t a = area(i0, j0, i1, j1);
+        return a ? (static_cast<double>(sum(i0, j0, i1, j1)) / a) : 0.0;
+    }
+
+    //! Returns the fraction of non-zero pixels in rectangle [i0,i1) x [j0,j1), or 0 if it is outside the image.
+    double occupancy(long i0, long j0, long i1, long j1) const {
+        std::size_t a = area(i0, j0, i1, j1);
+        return a ? (static_cast<double>(count(i0, j0, i1, j1)) / a) : 0.0;
+    }
+
+protected:
+    //! Clip [i0,i1) x [j0,j1) to the image; returns false if nothing is left.
+    bool clip(long& i0, long& j0, long& i1, long& j1) const {
+        i0 = std::max(i0, 0L);
+        j0 = std::max(j0, 0L);
+        i1 = std::min(i1, static_cast<long>(_height));
+        j1 = std::min(j1, static_cast<long>(_width));
+        return (i0 < i1) && (j0 < j1);
+    }
+
+    //! Inclusion-exclusion over table t for a clipped rectangle.
+    template <typename T>
+    T rect(const std::vector<T>& t, long i0, long j0, long i1, long j1) const {
+        const std::size_t stride = _width + 1;
+        return t[i1*stride + j1] - t[i0*stride + j1] - t[i1*stride + j0] + t[i0*stride + j0];
+    }
+
+    unsigned long _width; //!< Width of the image.
+    unsigned long _height; //!< Height of the image.
+    std::vector<sum_type> _sums; //!< Summed-area table of pixel values.
+    std::vector<count_type> _counts; //!< Summed-area table of non-zero pixels.
+};
+
+#endif
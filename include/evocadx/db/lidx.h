@@ -28,22 +28,35 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/regex.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <string>
 #include <stdint.h>
+#include <evocadx/db/block_gzip.h>
+#include <evocadx/db/mapped_file.h>
+#include <evocadx/db/integral.h>
+#include <evocadx/db/lidx_packed.h>
+#include <evocadx/db/lidx_sampling.h>
 
 
 namespace lidx {
 
-    //! Single record in a lidx database.
+    template <typename Record> class record_view;
+
+    /*! Single record in a lidx database.
+
+     Data is the element type of the record: any of the types in dtype_of
+     (e.g., uint8_t for 8b images), or bit for 0/1 data, which is stored at 1
+     bit per element.
+     */
     template <typename Label, typename Data>
     struct lidx_record {
         typedef Label label_type;
         typedef Data data_type;
-        typedef std::vector<data_type> vector_type;
+        typedef typename storage<Data>::vector_type vector_type;
         
         label_type label; //!< Label for this record.
         vector_type data; //!< Data.
@@ -62,6 +75,14 @@ namespace lidx {
     struct xmlS { };
     
     /*! Labeled IDX database.
+
+     The Format selects how the database is written: as an xml (xmlS) or
+     binary (binaryS) boost.serialization archive, or in the packed lidx
+     format (packedS; see lidx_packed.h).  Any of these can be read regardless
+     of the Format.  Packed files are converted to the database's label and
+     data types as they are read, and so are archives read by a packedS
+     database, which are taken to be <int,int> archives (as written by
+     earlier versions of mnist2lidx and lidxgen).
      */
     template <typename Label, typename Data, typename Format=xmlS>
     class lidx_db {
@@ -70,6 +91,9 @@ namespace lidx {
         typedef std::vector<record_type> record_list_type; //!< Type of the underlying database of records.
         typedef std::vector<uint16_t> dim_list_type; //!< Type for a list of dimension sizes.
         typedef Format format_type; //!< Tag for the format of this database.
+        typedef label_index<Label> label_index_type; //!< Type of the index of records by label.
+        typedef record_view<record_type> view_type; //!< Two-dimensional view of a record.
+        typedef std::vector<integral_image> integral_list_type; //!< Type of the table of integral images.
 
         //! Constructor.
         lidx_db() {
@@ -84,12 +108,54 @@ namespace lidx {
         //! Get the record list.
         record_list_type& records() { return _records; }
         
+        //! Returns the number of records.
+        std::size_t size() const { return _records.size(); }
+        
         //! Get a record.
         record_type& operator[](const std::size_t i) { return _records[i]; }
         
+        /*! Build the table of integral images of the records, treating each
+         as a dim(0) x dim(1) matrix.  Records don't carry their own integral
+         images, so databases that never call this don't pay for them.  The
+         table isn't serialized or kept up to date, so this must be called
+         again after each read, and after records are changed.
+         */
+        void build_integral() {
+            _integral.resize(_records.size());
+            for(std::size_t i=0; i<_records.size(); ++i) {
+                _integral[i].build(_records[i].data, dim(1), dim(0));
+            }
+        }
+        
+        //! Get the table of integral images (empty unless build_integral() has been called).
+        const integral_list_type& integrals() const { return _integral; }
+        
+        //! Returns a dim(0) x dim(1) view of record i, with its integral image if the table has been built.
+        view_type view(std::size_t i) {
+            return view_type(_records[i], dim(0), dim(1), (i < _integral.size()) ? &_integral[i] : 0);
+        }
+        
+        /*! Build the index of records by label.  Like integral images, the
+         index isn't serialized or kept up to date, so this must be called
+         again after each read, and after records are changed.
+         */
+        void build_label_index() {
+            std::vector<Label> labels;
+            labels.reserve(_records.size());
+            for(typename record_list_type::iterator i=_records.begin(); i!=_records.end(); ++i) {
+                labels.push_back(i->label);
+            }
+            _by_label.build(labels.begin(), labels.end());
+        }
+        
+        //! Get the index of records by label (see build_label_index).
+        const label_index_type& by_label() const { return _by_label; }
+        
     protected:
         dim_list_type _dims; //!< Number and size of dimensions present in records.
         record_list_type _records; //!< Number and size of records in this database.
+        label_index_type _by_label; //!< Index of records by label (not serialized).
+        integral_list_type _integral; //!< Integral images of records (not serialized).
 
         friend class boost::serialization::access;
         template<class Archive>
@@ -100,8 +166,307 @@ namespace lidx {
     };
     
     
+    /*! Two-dimensional view of a lidx record, with the same accessors as png
+     (so that it can be used with sequence_matrix and the region queries of
+     its integral image).
+     */
+    template <typename Record>
+    class record_view {
+    public:
+        typedef Record record_type; //!< Type of the viewed record.
+        typedef typename Record::vector_type vector_type; //!< Type of the record's data.
+        typedef typename vector_type::value_type value_type; //!< Value type for pixel data.
+        typedef typename vector_type::reference reference; //!< Reference to a pixel.
+        typedef typename vector_type::const_reference const_reference; //!< Const reference to a pixel.
+        
+        /*! Constructor; r is viewed as a rows x cols matrix, whose integral
+         image (if the database has one, see lidx_db::build_integral) is
+         integral.
+         */
+        record_view(record_type& r, std::size_t rows, std::size_t cols, const integral_image* integral=0)
+        : _r(r), _rows(rows), _cols(cols), _integral(integral) {
+        }
+        
+        //! Returns the number of rows.
+        std::size_t size1() const { return _rows; }
+        
+        //! Returns the number of columns.
+        std::size_t size2() const { return _cols; }
+        
+        //! Returns the number of pixels.
+        std::size_t size() const { return _rows * _cols; }
+        
+        //! Returns the n'th pixel.
+        reference operator[](std::size_t n) { return _r.data[n]; }
+        
+        //! Returns the n'th pixel (const-qualified).
+        const_reference operator[](std::size_t n) const { return _r.data[n]; }
+        
+        //! Returns the label of the viewed record.
+        const typename Record::label_type& label() const { return _r.label; }
+        
+        //! Returns the integral image of the viewed record, building one for this view if the database has none.
+        const integral_image& integral() {
+            if(_integral) {
+                return *_integral;
+            }
+            if(_own.empty()) {
+                _own.build(_r.data, _cols, _rows);
+            }
+            return _own;
+        }
+        
+    protected:
+        record_type& _r; //!< Viewed record.
+        std::size_t _rows; //!< Number of rows.
+        std::size_t _cols; //!< Number of columns.
+        const integral_image* _integral; //!< Integral image of the viewed record from its database, if any.
+        integral_image _own; //!< Integral image built by this view, otherwise.
+    };
+    
+    template <typename DB> class record_span;
+    
+    /*! Structure-of-arrays lidx database.
+     
+     Where lidx_db keeps a vector of records that each own their data, an
+     arena_db keeps the data of all records in a single contiguous block (the
+     arena, of size() x stride() elements), and their labels in a parallel
+     array.  Records are accessed through lightweight record_span views of the
+     arena, so that consecutive records are adjacent in memory, and loading a
+     database takes two allocations regardless of the number of records.
+     
+     The arena's layout is that of the data block of a packed lidx file, so
+     packed files of the same data type are read (and written) with a single
+     copy.  arena_dbs are always written in the packed format.
+     */
+    template <typename Label, typename Data>
+    class arena_db {
+    public:
+        typedef Label label_type; //!< Type of labels.
+        typedef Data data_type; //!< Element type of records.
+        typedef typename storage<Data>::vector_type vector_type; //!< Type of the arena.
+        typedef std::vector<label_type> label_list_type; //!< Type of the label array.
+        typedef std::vector<uint16_t> dim_list_type; //!< Type for a list of dimension sizes.
+        typedef record_span<arena_db> span_type; //!< View of a single record.
+        typedef packedS format_type; //!< Tag for the format of this database.
+        typedef std::vector<integral_image> integral_list_type; //!< Type of the table of integral images.
+        
+        //! Constructor.
+        arena_db() {
+        }
+        
+        //! Get the dimension vector; dims must be set before any records are added.
+        dim_list_type& dims() { return _dims; }
+        
+        //! Get the size of dimension n.
+        std::size_t dim(std::size_t n) const { return _dims[n]; }
+        
+        //! Returns the number of records.
+        std::size_t size() const { return _labels.size(); }
+        
+        //! Returns the number of elements in each record.
+        std::size_t record_size() const { return detail::record_size(_dims); }
+        
+        //! Returns the offset between consecutive records in the arena.
+        std::size_t stride() const { return storage<Data>::stride(record_size()); }
+        
+        //! Get the label array.
+        label_list_type& labels() { return _labels; }
+        
+        //! Get the arena.
+        vector_type& data() { return _data; }
+        
+        //! Returns a view of record i.
+        span_type operator[](const std::size_t i) { return span_type(*this, i); }
+        
+        /*! Build the table of integral images of the records, treating each
+         as a dim(0) x dim(1) matrix (see lidx_db::build_integral).  The table
+         is dropped whenever records are added, removed, or reordered.
+         */
+        void build_integral() {
+            _integral.resize(size());
+            for(std::size_t i=0; i<size(); ++i) {
+                _integral[i].build((*this)[i], dim(1), dim(0));
+            }
+        }
+        
+        //! Get the table of integral images (empty unless build_integral() has been called).
+        const integral_list_type& integrals() const { return _integral; }
+        
+        //! Resize to n records; new records are labeled 0, with all elements 0.
+        void resize(std::size_t n) {
+            _integral.clear();
+            _labels.resize(n, label_type());
+            _data.resize(n * stride());
+        }
+        
+        //! Set the data of record i to the first record_size() elements of s.
+        template <typename Sequence>
+        void assign(std::size_t i, const Sequence& s) {
+            const std::size_t n=record_size(), offset=i*stride();
+            for(std::size_t j=0; j<n; ++j) {
+                _data[offset + j] = s[j];
+            }
+        }
+        
+        //! Append a record labeled l, with data s.
+        template <typename Sequence>
+        void push_back(const label_type& l, const Sequence& s) {
+            resize(size() + 1);
+            _labels.back() = l;
+            assign(size() - 1, s);
+        }
+        
+        /*! Reorder the records so that record i is the record that was at
+         order[i]; order must be a permutation of [0, size()), or part of one
+         (in which case the records not in order are dropped).
+         */
+        void permute(const std::vector<std::size_t>& order) {
+            const std::size_t n=record_size(), s=stride();
+            label_list_type labels(order.size());
+            vector_type data(order.size() * s);
+            for(std::size_t i=0; i<order.size(); ++i) {
+                labels[i] = _labels[order[i]];
+                for(std::size_t j=0; j<n; ++j) {
+                    data[i*s + j] = static_cast<typename vector_type::value_type>(_data[order[i]*s + j]);
+                }
+            }
+            _labels.swap(labels);
+            _data.swap(data);
+            _integral.clear();
+        }
+        
+    protected:
+        dim_list_type _dims; //!< Number and size of dimensions present in records.
+        label_list_type _labels; //!< Labels of all records.
+        vector_type _data; //!< Data of all records.
+        integral_list_type _integral; //!< Integral images of records (optional).
+    };
+    
+    
+    /*! View of a single record of an arena_db (or any database with the
+     same accessors), with the same accessors as a record's data vector, so
+     that it can be used as the sequence of a sequence_matrix.
+     
+     Spans are cheap to copy, but are invalidated when their database is
+     resized or permuted.
+     */
+    template <typename DB>
+    class record_span {
+    public:
+        typedef typename DB::label_type label_type; //!< Type of labels.
+        typedef typename DB::vector_type vector_type; //!< Type of the viewed arena.
+        typedef typename vector_type::value_type value_type; //!< Value type for pixel data.
+        typedef typename vector_type::reference reference; //!< Reference to a pixel.
+        typedef typename vector_type::const_reference const_reference; //!< Const reference to a pixel.
+        
+        //! Constructor; views record i of db.
+        record_span(DB& db, std::size_t i)
+        : _data(&db.data()), _offset(i * db.stride()), _size(db.record_size()), _label(&db.labels()[i])
+        , _integral((i < db.integrals().size()) ? &db.integrals()[i] : 0) {
+        }
+        
+        //! Returns the number of elements in this record.
+        std::size_t size() const { return _size; }
+        
+        //! Returns the label of this record.
+        const label_type& label() const { return *_label; }
+        
+        //! Returns the n'th element of this record.
+        reference operator[](std::size_t n) { return (*_data)[_offset + n]; }
+        
+        //! Returns the n'th element of this record (const-qualified).
+        const_reference operator[](std::size_t n) const { return (*_data)[_offset + n]; }
+        
+        //! Returns true if this record has an integral image (see arena_db::build_integral).
+        bool has_integral() const { return _integral != 0; }
+        
+        //! Returns the integral image of this record; throws if its database hasn't built one.
+        const integral_image& integral() const {
+            if(!_integral) {
+                throw std::runtime_error("lidx.h: no integral image; see arena_db::build_integral");
+            }
+            return *_integral;
+        }
+        
+    protected:
+        vector_type* _data; //!< Arena holding this record.
+        std::size_t _offset; //!< Offset of this record in the arena.
+        std::size_t _size; //!< Number of elements in this record.
+        const label_type* _label; //!< Label of this record.
+        const integral_image* _integral; //!< Integral image of this record, if its database has one.
+    };
+    
     namespace detail {
         namespace bio = boost::iostreams;
+        
+        //! Write an arena_db to out in packed format; its arena is written in one piece.
+        template <typename Label, typename Data>
+        void write_packed(std::ostream& out, arena_db<Label,Data>& db) {
+            write_prefix<Label,Data>(out, db.dims(), db.size(), db.size() ? &db.labels()[0] : 0);
+            store_elements(out, db.data());
+            if(!out) {
+                throw std::runtime_error("lidx.h: write failed");
+            }
+        }
+        
+        //! Returns true if packed data of type t has the same layout as the arena of an arena_db of Data.
+        template <typename Data>
+        bool same_layout(unsigned int t) {
+            return (t == DT_BIT) == (dtype_of<Data>::value == DT_BIT);
+        }
+        
+        /*! Load the data of count packed records described by header h, at
+         p, into the arena of db (whose dims must already be set).
+         */
+        template <typename Label, typename Data>
+        void load_arena(const unsigned char* p, const packed_header& h, std::size_t count, arena_db<Label,Data>& db) {
+            const std::size_t rsize = db.record_size();
+            if(same_layout<Data>(h.data_type)) {
+                load_elements(p, h.data_type, count * db.stride(), db.data());
+            } else {
+                db.data().clear();
+                db.data().resize(count * db.stride());
+                typename arena_db<Label,Data>::vector_type r;
+                for(std::size_t i=0; i<count; ++i) {
+                    load_elements(p + i*h.record_bytes(rsize), h.data_type, rsize, r);
+                    db.assign(i, r);
+                }
+            }
+        }
+        
+        //! Read a packed arena_db from the n bytes at p (typically, a mapped file).
+        template <typename Label, typename Data>
+        void read_packed(const unsigned char* p, std::size_t n, arena_db<Label,Data>& db) {
+            const packed_header& h = mapped_header(p, n);
+            prepare_dims(h, reinterpret_cast<const uint32_t*>(p + sizeof(h)), db);
+            db.labels().resize(h.count);
+            if(h.count > 0) {
+                convert(p + h.labels_offset(), h.label_type, h.count, &db.labels()[0]);
+            }
+            load_arena(p + h.data_offset(), h, h.count, db);
+        }
+        
+        //! Read a packed arena_db from a stream, one record at a time.
+        template <typename Label, typename Data>
+        void read_packed(std::istream& in, arena_db<Label,Data>& db) {
+            std::vector<unsigned char> buf;
+            const packed_header h = read_prefix(in, buf, db);
+            const std::size_t rsize = db.record_size(), rbytes = h.record_bytes(rsize);
+            db.data().clear();
+            db.resize(h.count);
+            if(h.count > 0) {
+                convert(&buf[0], h.label_type, h.count, &db.labels()[0]);
+            }
+            
+            buf.resize(std::max<std::size_t>(rbytes, 8));
+            typename arena_db<Label,Data>::vector_type r;
+            for(std::size_t i=0; i<h.count; ++i) {
+                read_bytes(in, &buf[0], rbytes);
+                load_elements(&buf[0], h.data_type, rsize, r);
+                db.assign(i, r);
+            }
+        }
 
         //! Write a potentially gzipped binary archive.
         template <typename DB>
@@ -117,15 +482,9 @@ namespace lidx {
             oa << BOOST_SERIALIZATION_NVP(db);
         }
         
+        //! Read a binary archive.
         template <typename DB>
-        void read(const std::string& fname,
-                  bio::filtering_stream<bio::input>& in,
-                  std::ifstream& ifs,
-                  DB& db,
-                  const lidx::binaryS) {
-            ifs.open(fname.c_str(), std::ios::binary);
-            in.push(ifs);
-            
+        void read(std::istream& in, DB& db, const lidx::binaryS) {
             boost::archive::binary_iarchive ia(in);
             ia >> BOOST_SERIALIZATION_NVP(db);
         }
@@ -144,35 +503,279 @@ namespace lidx {
             oa << BOOST_SERIALIZATION_NVP(db);
         }
         
+        //! Read an xml archive.
         template <typename DB>
-        void read(const std::string& fname,
-                  bio::filtering_stream<bio::input>& in,
-                  std::ifstream& ifs,
-                  DB& db,
-                  const lidx::xmlS) {
-            ifs.open(fname.c_str());
-            in.push(ifs);
-            
+        void read(std::istream& in, DB& db, const lidx::xmlS) {
             boost::archive::xml_iarchive ia(in);
             ia >> BOOST_SERIALIZATION_NVP(db);
         }
         
+        //! Write a potentially gzipped packed file.
+        template <typename DB>
+        void write(const std::string& fname,
+                   bio::filtering_stream<bio::output>& out,
+                   std::ofstream& ofs,
+                   DB& db,
+                   const lidx::packedS) {
+            ofs.open(fname.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+            out.push(ofs);
+            write_packed(out, db);
+        }
+        
+        //! Read a packed file.
+        template <typename DB>
+        void read(std::istream& in, DB& db, const lidx::packedS) {
+            read_packed(in, db);
+        }
+        
+        //! Read an archive of the database's own type.
+        template <typename DB, typename Format, typename DBFormat>
+        void read_archive(std::istream& in, DB& db, const Format f, const DBFormat) {
+            read(in, db, f);
+        }
+        
+        /*! Read a legacy <int,int> archive into a packed database, converting
+         its records; throws std::runtime_error if a value doesn't fit.
+         */
+        template <typename DB, typename Format>
+        void read_archive(std::istream& in, DB& db, const Format f, const lidx::packedS) {
+            lidx_db<int, int, Format> legacy;
+            read(in, legacy, f);
+            db.dims() = legacy.dims();
+            db.records().clear();
+            db.records().resize(legacy.records().size());
+            typedef typename DB::record_type::label_type label_type;
+            typedef typename DB::record_type::data_type data_type;
+            for(std::size_t i=0; i<legacy.records().size(); ++i) {
+                check_range(&legacy[i].label, 1, static_cast<const label_type*>(0));
+                check_range(legacy[i].data.empty() ? 0 : &legacy[i].data[0], legacy[i].data.size(), static_cast<const data_type*>(0));
+                db[i].label = static_cast<label_type>(legacy[i].label);
+                db[i].data.assign(legacy[i].data.begin(), legacy[i].data.end());
+                // release each legacy record as soon as it's converted:
+                std::vector<int>().swap(legacy[i].data);
+            }
+        }
+        
+        /*! Read a legacy <int,int> archive into an arena_db, converting its
+         records; throws std::runtime_error if a value doesn't fit.
+         */
+        template <typename Label, typename Data, typename Format>
+        void read_archive(std::istream& in, arena_db<Label,Data>& db, const Format f, const lidx::packedS) {
+            lidx_db<int, int, Format> legacy;
+            read(in, legacy, f);
+            db.dims() = legacy.dims();
+            db.labels().clear();
+            db.data().clear();
+            db.resize(legacy.records().size());
+            for(std::size_t i=0; i<legacy.records().size(); ++i) {
+                check_range(&legacy[i].label, 1, static_cast<const Label*>(0));
+                check_range(legacy[i].data.empty() ? 0 : &legacy[i].data[0], legacy[i].data.size(), static_cast<const Data*>(0));
+                db.labels()[i] = static_cast<Label>(legacy[i].label);
+                db.assign(i, legacy[i].data);
+                std::vector<int>().swap(legacy[i].data);
+            }
+        }
+        
+        /*! Read a database in any format from a stream, detecting the format
+         from its first byte: packed files start with "LIDX", xml archives
+         with "<?xml", and binary archives with the length of their signature.
+         */
+        template <typename DB>
+        void read_any(std::istream& in, DB& db) {
+            switch(in.peek()) {
+                case 'L': read(in, db, lidx::packedS()); break;
+                case '<': read_archive(in, db, lidx::xmlS(), typename DB::format_type()); break;
+                default: read_archive(in, db, lidx::binaryS(), typename DB::format_type()); break;
+            }
+        }
+        
+        /*! Push a decompressor for gzipped file onto in: a (parallel) block
+         gzip decompressor if the file was written by lidx, and an ordinary
+         gzip decompressor otherwise.
+         */
+        inline void push_decompressor(bio::filtering_stream<bio::input>& in, const mapped_file& file) {
+            if(block_gzip::match(file.data(), file.size())) {
+                in.push(block_gzip::decompressor());
+            } else {
+                in.push(bio::gzip_decompressor());
+            }
+        }
+        
     } // detail
     
+    /*! Read a (potentially gzipped) database from fname.
+
+     The file is memory-mapped.  Uncompressed packed files are converted
+     straight from the mapping, and uncompressed archives are deserialized
+     from it without an intermediate stream buffer; gzipped files are
+     decompressed from it (in parallel, if they were written by write()).
+     The format of the file is detected from its contents, so a database can
+     read files in any format.
+     */
     template <typename DB>
     void read(const std::string& fname, DB& db) {
         static const boost::regex e(".*\\.gz$");
         namespace bio = boost::iostreams;
-        std::ifstream ifs;
-        bio::filtering_stream<bio::input> in;
+        mapped_file file(fname);
         
         if(boost::regex_match(fname, e)) {
-            in.push(boost::iostreams::gzip_decompressor());
+            bio::stream<mapped_file::source_type> raw(file.source());
+            bio::filtering_stream<bio::input> in;
+            detail::push_decompressor(in, file);
+            in.push(raw);
+            detail::read_any(in, db);
+        } else if(packed_header::match(file.data(), file.size())) {
+            detail::read_packed(file.data(), file.size(), db);
+        } else {
+            bio::stream<mapped_file::source_type> raw(file.source());
+            detail::read_any(raw, db);
         }
-        
-        detail::read(fname, in, ifs, db, typename DB::format_type());
     }
             
+    namespace detail {
+        
+        //! Reads ranges of the bytes of an uncompressed file.
+        struct mapped_bytes {
+            //! Constructor.
+            mapped_bytes(const unsigned char* p, std::size_t n) : _p(p), _n(n) {
+            }
+            
+            //! Returns the size of the file.
+            uint64_t size() const { return _n; }
+            
+            //! Read n bytes starting at offset to s.
+            void read(uint64_t offset, std::size_t n, unsigned char* s) const {
+                std::memcpy(s, _p + offset, n);
+            }
+            
+            const unsigned char* _p; //!< Mapped file.
+            std::size_t _n; //!< Size of the file.
+        };
+        
+        //! Reads ranges of the uncompressed bytes of a block gzip file.
+        struct block_bytes {
+            //! Constructor.
+            block_bytes(const unsigned char* p, const block_gzip::index& idx) : _p(p), _idx(idx) {
+            }
+            
+            //! Returns the size of the uncompressed file.
+            uint64_t size() const { return _idx.uncompressed_size(); }
+            
+            //! Read n bytes starting at offset to s, decompressing only the members that hold them.
+            void read(uint64_t offset, std::size_t n, unsigned char* s) const {
+                _idx.read(_p, offset, n, reinterpret_cast<char*>(s));
+            }
+            
+            const unsigned char* _p; //!< Mapped file.
+            const block_gzip::index& _idx; //!< Index of its members.
+        };
+        
+        /*! Read records [first, last) of the packed file in src to db; returns
+         false if src isn't a packed file.
+         
+         Records are at fixed offsets in a packed file, so only the header,
+         dims, and the labels and data of the range are read.  They're
+         gathered into a (smaller) packed file in memory, which is then
+         converted as usual.
+         */
+        template <typename Bytes, typename DB>
+        bool read_packed_range(const Bytes& src, std::size_t first, std::size_t last, DB& db) {
+            packed_header h;
+            if(src.size() < sizeof(h)) {
+                return false;
+            }
+            src.read(0, sizeof(h), reinterpret_cast<unsigned char*>(&h));
+            if(!packed_header::match(h.magic, 4)) {
+                return false;
+            }
+            h.check();
+            if((first > last) || (last > h.count)) {
+                throw std::runtime_error("lidx.h: record range out of bounds");
+            }
+            if(src.size() < h.labels_offset()) {
+                throw std::runtime_error("lidx.h: truncated file");
+            }
+            std::vector<uint32_t> d(h.ndims + 1);
+            src.read(sizeof(h), h.ndims*sizeof(uint32_t), reinterpret_cast<unsigned char*>(&d[0]));
+            d.pop_back();
+            const std::size_t ls=dtype_size(h.label_type);
+            const std::size_t rbytes=h.record_bytes(record_size(std::vector<uint64_t>(d.begin(), d.end())));
+            if(src.size() < h.data_offset() + h.count*rbytes) {
+                throw std::runtime_error("lidx.h: truncated file");
+            }
+            
+            packed_header r=h;
+            r.count = last - first;
+            const std::size_t n=r.data_offset() + r.count*rbytes;
+            std::vector<uint64_t> buf((n + 7) / 8 + 1, 0); // 8-byte aligned, like a mapping
+            unsigned char* p = reinterpret_cast<unsigned char*>(&buf[0]);
+            std::memcpy(p, &r, sizeof(r));
+            if(!d.empty()) {
+                std::memcpy(p + sizeof(r), &d[0], d.size()*sizeof(uint32_t));
+            }
+            src.read(h.labels_offset() + first*ls, r.count*ls, p + r.labels_offset());
+            src.read(h.data_offset() + first*rbytes, r.count*rbytes, p + r.data_offset());
+            read_packed(p, n, db);
+            return true;
+        }
+        
+        //! Drop all records of db outside [first, last).
+        template <typename DB>
+        void keep_range(DB& db, std::size_t first, std::size_t last) {
+            if((first > last) || (last > db.records().size())) {
+                throw std::runtime_error("lidx.h: record range out of bounds");
+            }
+            db.records().erase(db.records().begin() + last, db.records().end());
+            db.records().erase(db.records().begin(), db.records().begin() + first);
+        }
+        
+        //! Drop all records of an arena_db outside [first, last).
+        template <typename Label, typename Data>
+        void keep_range(arena_db<Label,Data>& db, std::size_t first, std::size_t last) {
+            if((first > last) || (last > db.size())) {
+                throw std::runtime_error("lidx.h: record range out of bounds");
+            }
+            std::vector<std::size_t> order;
+            for(std::size_t i=first; i<last; ++i) {
+                order.push_back(i);
+            }
+            db.permute(order);
+        }
+        
+    } // detail
+    
+    /*! Read records [first, last) of a (potentially gzipped) database from
+     fname, e.g., the shard of a file owned by one worker or subpopulation.
+     
+     Packed files are read in time proportional to the range: uncompressed
+     files are read at their offsets straight from the mapping, and files
+     gzipped by write() (or lidx::writer) are decompressed only in the blocks
+     that overlap the range, found through the index at the end of the file
+     (see block_gzip.h).  Other files (archives, and files gzipped by other
+     tools) aren't seekable; they're read whole, and then trimmed to the
+     range.
+     */
+    template <typename DB>
+    void read_range(const std::string& fname, std::size_t first, std::size_t last, DB& db) {
+        mapped_file file(fname);
+        block_gzip::index idx;
+        
+        if(detail::read_packed_range(detail::mapped_bytes(file.data(), file.size()), first, last, db)) {
+            return;
+        }
+        if(idx.load(file.data(), file.size())
+           && detail::read_packed_range(detail::block_bytes(file.data(), idx), first, last, db)) {
+            return;
+        }
+        read(fname, db);
+        detail::keep_range(db, first, last);
+    }
+    
+    /*! Write a database to fname, in the database's format.
+
+     If fname ends in .gz, the file is block gzipped (see block_gzip.h), in
+     parallel; it can still be read by gzip.
+     */
     template <typename DB>
     void write(const std::string& fname, DB& db) {
         static const boost::regex e(".*\\.gz$");
@@ -181,7 +784,7 @@ namespace lidx {
         bio::filtering_stream<bio::output> out;
 
         if(boost::regex_match(fname, e)) {
-            out.push(boost::iostreams::gzip_compressor());
+            out.push(block_gzip::compressor());
         }
         
         detail::write(fname, out, ofs, db, typename DB::format_type());
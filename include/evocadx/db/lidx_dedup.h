@@ -0,0 +1,218 @@
+/* lidx_dedup.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _LIDX_DEDUP_H_
+#define _LIDX_DEDUP_H_
+
+#include <cstring>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <evocadx/db/lidx.h>
+
+namespace lidx {
+
+    namespace detail {
+
+        //! Returns the label of record i of a lidx_db.
+        template <typename Label, typename Data, typename Format>
+        Label label_of(lidx_db<Label,Data,Format>& db, std::size_t i) {
+            return db[i].label;
+        }
+
+        //! Returns the data of record i of a lidx_db.
+        template <typename Label, typename Data, typename Format>
+        const typename lidx_db<Label,Data,Format>::record_type::vector_type& data_of(lidx_db<Label,Data,Format>& db, std::size_t i) {
+            return db[i].data;
+        }
+
+        //! Returns the label of record i of a database of spans (arena_db or paged_db).
+        template <typename DB>
+        typename DB::label_type label_of(DB& db, std::size_t i) {
+            return db.labels()[i];
+        }
+
+        //! Returns the data of record i of a database of spans (arena_db or paged_db).
+        template <typename DB>
+        typename DB::span_type data_of(DB& db, std::size_t i) {
+            return db[i];
+        }
+
+        //! Copy the elements of s to v.
+        template <typename Sequence>
+        void copy_sequence(const Sequence& s, std::vector<double>& v) {
+            v.resize(s.size());
+            for(std::size_t j=0; j<v.size(); ++j) {
+                v[j] = s[j];
+            }
+        }
+
+        //! Returns true if s has the same elements as v.
+        template <typename Sequence>
+        bool same_sequence(const Sequence& s, const std::vector<double>& v) {
+            if(static_cast<std::size_t>(s.size()) != v.size()) {
+                return false;
+            }
+            for(std::size_t j=0; j<v.size(); ++j) {
+                if(s[j] != v[j]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //! Mix the bytes of x into the FNV-1a hash h.
+        inline uint64_t fnv1a(uint64_t h, double x) {
+            unsigned char b[sizeof(x)];
+            std::memcpy(b, &x, sizeof(x));
+            for(std::size_t i=0; i<sizeof(x); ++i) {
+                h = (h ^ b[i]) * 0x100000001b3ull;
+            }
+            return h;
+        }
+
+        //! Drop all records of a lidx_db that aren't in keep (an ascending list of indices).
+        template <typename Label, typename Data, typename Format>
+        void keep_records(lidx_db<Label,Data,Format>& db, const std::vector<std::size_t>& keep) {
+            typename lidx_db<Label,Data,Format>::record_list_type records(keep.size());
+            for(std::size_t i=0; i<keep.size(); ++i) {
+                std::swap(records[i], db[keep[i]]);
+            }
+            db.records().swap(records);
+        }
+
+        //! Drop all records of an arena_db that aren't in keep (an ascending list of indices).
+        template <typename Label, typename Data>
+        void keep_records(arena_db<Label,Data>& db, const std::vector<std::size_t>& keep) {
+            db.permute(keep);
+        }
+
+    } // detail
+
+    /*! Find the distinct records of db: those that differ in label or in any
+     element of their data.
+
+     The indices of the first copy of each distinct record are stored, in
+     order, in unique, and the number of copies of each in counts; returns
+     the number of distinct records.  Records are hashed, and only those with
+     the same hash are compared, so this takes a single pass over db, in
+     order, plus a read of the first copy of each duplicate (for a paged_db,
+     usually from a block that's still cached).  Records aren't moved, so
+     this works with any database, including a paged_db.
+     */
+    template <typename DB>
+    std::size_t find_duplicates(DB& db, std::vector<std::size_t>& unique, std::vector<std::size_t>& counts) {
+        typedef std::multimap<uint64_t, std::size_t> hash_map_type; // hash -> position in unique
+        hash_map_type seen;
+        std::vector<double> cur;
+        unique.clear();
+        counts.clear();
+
+        for(std::size_t i=0; i<db.size(); ++i) {
+            // copy the record, since (for paged dbs) fetching another may evict it:
+            const double l=detail::label_of(db, i);
+            detail::copy_sequence(detail::data_of(db, i), cur);
+            uint64_t h=detail::fnv1a(0xcbf29ce484222325ull, l);
+            for(std::size_t j=0; j<cur.size(); ++j) {
+                h = detail::fnv1a(h, cur[j]);
+            }
+
+            bool found=false;
+            std::pair<typename hash_map_type::iterator, typename hash_map_type::iterator> r=seen.equal_range(h);
+            for(typename hash_map_type::iterator k=r.first; (k!=r.second) && !found; ++k) {
+                const std::size_t u=unique[k->second];
+                found = (detail::label_of(db, u) == l) && detail::same_sequence(detail::data_of(db, u), cur);
+                if(found) {
+                    ++counts[k->second];
+                }
+            }
+            if(!found) {
+                seen.insert(std::make_pair(h, unique.size()));
+                unique.push_back(i);
+                counts.push_back(1);
+            }
+        }
+        return unique.size();
+    }
+
+    /*! Remove duplicate records from db (a lidx_db or arena_db), keeping the
+     first copy of each, in order; counts is set to the number of copies of
+     each remaining record, to weight it by.
+     */
+    template <typename DB>
+    std::size_t dedup(DB& db, std::vector<std::size_t>& counts) {
+        std::vector<std::size_t> unique;
+        find_duplicates(db, unique, counts);
+        detail::keep_records(db, unique);
+        return unique.size();
+    }
+
+    /*! Score of a classifier over weighted records (e.g., deduplicated
+     records, weighted by their number of copies).
+
+     Records are added in the order they're examined until their total
+     weight reaches n, so each distinct record stands in for all of its
+     copies, and fewer records are examined the more duplicates there are.
+     The score is the weight of the correctly classified records, scaled to
+     n, and so is the same as that of examining every copy of the same
+     records.
+
+        lidx::weighted_score s(examine_n);
+        for(std::size_t i=0; (i < order.size()) && s.more(); ++i) {
+            s.add(weight(order[i]), classify(order[i]) == label(order[i]));
+        }
+        return s.score();
+     */
+    class weighted_score {
+    public:
+        //! Constructor; scores (up to) n records.
+        weighted_score(std::size_t n) : _n(n), _examined(0), _w(0.0), _total(0.0) {
+        }
+
+        //! Returns true while the records added so far weigh less than n.
+        bool more() const { return _total < _n; }
+
+        //! Add a record of the given weight, which was classified correctly if correct.
+        void add(double weight, bool correct) {
+            ++_examined;
+            _total += weight;
+            if(correct) {
+                _w += weight;
+            }
+        }
+
+        //! Returns the number of records added.
+        std::size_t examined() const { return _examined; }
+
+        //! Returns the total weight of the records added.
+        double total() const { return _total; }
+
+        //! Returns the weight of the correctly classified records, scaled to n.
+        double score() const { return (_total > 0.0) ? (_w * _n / _total) : 0.0; }
+
+    protected:
+        std::size_t _n; //!< Number of records to score.
+        std::size_t _examined; //!< Number of records added.
+        double _w; //!< Weight of the correctly classified records.
+        double _total; //!< Weight of all records added.
+    };
+
+} // lidx
+
+#endif
@@ -0,0 +1,503 @@
+/* lidx_packed.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _LIDX_PACKED_H_
+#define _LIDX_PACKED_H_
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <evocadx/db/bit_vector.h>
+#include <evocadx/db/mapped_file.h>
+
+/* Packed (v2) lidx format.
+
+ A packed lidx file is laid out so that it can be memory-mapped and used
+ without any parsing:
+
+    header      packed_header (24 bytes)
+    dims        ndims x uint32, padded to a multiple of 8 bytes
+    labels      count x label type, padded to a multiple of 8 bytes
+    data        count x prod(dims) x data type, record after record
+
+ Data may also be stored at 1 bit per element (DT_BIT), in which case each
+ record starts on a byte boundary, and is packed as a bit_vector.
+
+ All values are in host byte order; the version field doubles as a byte order
+ mark, so files written on a host of the other endianness are rejected
+ instead of silently misread.
+ */
+namespace lidx {
+
+    //! Element types that can be stored in a packed lidx file.
+    enum dtype {
+        DT_UINT8=1, DT_INT8, DT_UINT16, DT_INT16, DT_UINT32, DT_INT32, DT_FLOAT32, DT_FLOAT64, DT_BIT
+    };
+
+    //! Element type for 0/1 data, stored at 1 bit per element.
+    struct bit { };
+
+    //! Maps element types to their dtype.
+    template <typename T> struct dtype_of { };
+    template <> struct dtype_of<uint8_t> { static const dtype value=DT_UINT8; };
+    template <> struct dtype_of<int8_t> { static const dtype value=DT_INT8; };
+    template <> struct dtype_of<uint16_t> { static const dtype value=DT_UINT16; };
+    template <> struct dtype_of<int16_t> { static const dtype value=DT_INT16; };
+    template <> struct dtype_of<uint32_t> { static const dtype value=DT_UINT32; };
+    template <> struct dtype_of<int32_t> { static const dtype value=DT_INT32; };
+    template <> struct dtype_of<float> { static const dtype value=DT_FLOAT32; };
+    template <> struct dtype_of<double> { static const dtype value=DT_FLOAT64; };
+    template <> struct dtype_of<bit> { static const dtype value=DT_BIT; };
+
+    //! In-memory storage for records of element type T.
+    template <typename T> struct storage {
+        typedef std::vector<T> vector_type;
+
+        //! Returns the number of elements a record of n elements occupies in a packed block of records.
+        static std::size_t stride(std::size_t n) { return n; }
+    };
+
+    //! Bit elements are stored in a bit_vector (and read as uint8_t 0/1).
+    template <> struct storage<bit> {
+        typedef bit_vector vector_type;
+
+        //! Packed records of bits start on byte boundaries.
+        static std::size_t stride(std::size_t n) { return (n + 7) & ~static_cast<std::size_t>(7); }
+    };
+
+    //! Returns the size in bytes of an element of type t, or 0 if t is unknown (or DT_BIT).
+    inline std::size_t dtype_size(unsigned int t) {
+        switch(t) {
+            case DT_UINT8: case DT_INT8: return 1;
+            case DT_UINT16: case DT_INT16: return 2;
+            case DT_UINT32: case DT_INT32: case DT_FLOAT32: return 4;
+            case DT_FLOAT64: return 8;
+            default: return 0;
+        }
+    }
+
+    //! Returns the size in bytes of n packed elements of type t.
+    inline std::size_t packed_size(unsigned int t, std::size_t n) {
+        return (t == DT_BIT) ? ((n + 7) / 8) : (n * dtype_size(t));
+    }
+
+    //! Header of a packed lidx file.
+    struct packed_header {
+        char magic[4]; //!< "LIDX".
+        uint16_t version; //!< Format version (2); also a byte order mark.
+        uint8_t label_type; //!< dtype of labels.
+        uint8_t data_type; //!< dtype of data.
+        uint32_t ndims; //!< Number of dimensions.
+        uint32_t reserved; //!< Reserved (0).
+        uint64_t count; //!< Number of records.
+
+        //! Returns true if the n bytes at p start with the packed magic.
+        static bool match(const void* p, std::size_t n) {
+            return (n >= 4) && (std::memcmp(p, "LIDX", 4) == 0);
+        }
+
+        //! Returns the offset of the first label.
+        std::size_t labels_offset() const {
+            return pad(sizeof(packed_header) + ndims*sizeof(uint32_t));
+        }
+
+        //! Returns the offset of the first record's data.
+        std::size_t data_offset() const {
+            return labels_offset() + pad(count * dtype_size(label_type));
+        }
+
+        //! Returns the size of each record's data, given the number of elements n in each.
+        std::size_t record_bytes(std::size_t n) const {
+            return packed_size(data_type, n);
+        }
+
+        //! Returns n rounded up to a multiple of 8.
+        static std::size_t pad(std::size_t n) { return (n + 7) & ~static_cast<std::size_t>(7); }
+
+        //! Throws std::runtime_error if this isn't a header we can read.
+        void check() const {
+            if(!match(magic, 4)) {
+                throw std::runtime_error("lidx_packed.h: not a packed lidx file");
+            }
+            if(version != 2) {
+                throw std::runtime_error("lidx_packed.h: unsupported version or byte order");
+            }
+            if((dtype_size(label_type) == 0) || ((dtype_size(data_type) == 0) && (data_type != DT_BIT))) {
+                throw std::runtime_error("lidx_packed.h: unknown element type");
+            }
+        }
+    };
+
+    //! Selector for packed (v2) IO.
+    struct packedS { };
+
+    namespace detail {
+
+        //! Returns the lowest value of T.
+        template <typename T>
+        double lowest() {
+            return std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max();
+        }
+
+        /*! Throw std::runtime_error if any of the n elements at s is outside
+         the range of T (only checked if S is wider than T).
+         */
+        template <typename S, typename T>
+        void check_range(const S* s, std::size_t n, const T*) {
+            const double lo=lowest<T>(), hi=std::numeric_limits<T>::max();
+            if((lowest<S>() >= lo) && (std::numeric_limits<S>::max() <= hi)) {
+                return;
+            }
+            for(std::size_t i=0; i<n; ++i) {
+                const double x=s[i];
+                if((x < lo) || (x > hi)) {
+                    throw std::runtime_error("lidx_packed.h: value out of range of the database's element type");
+                }
+            }
+        }
+
+        //! Any element fits in a bit (as x != 0).
+        template <typename S>
+        void check_range(const S*, std::size_t, const bit*) {
+        }
+
+        //! Copy n elements from s to dst, throwing std::runtime_error if any is outside the range of T.
+        template <typename S, typename T>
+        void checked_copy(const S* s, std::size_t n, T* dst) {
+            check_range(s, n, dst);
+            std::copy(s, s+n, dst);
+        }
+
+        /*! Copy n elements of type t from src to dst, converting them to T;
+         throws std::runtime_error if any is outside the range of T.
+         */
+        template <typename T>
+        void convert(const unsigned char* src, unsigned int t, std::size_t n, T* dst) {
+            if(t == static_cast<unsigned int>(dtype_of<T>::value)) {
+                std::memcpy(dst, src, n * sizeof(T));
+                return;
+            }
+            switch(t) {
+                case DT_UINT8: checked_copy(src, n, dst); break;
+                case DT_INT8: checked_copy(reinterpret_cast<const int8_t*>(src), n, dst); break;
+                case DT_UINT16: checked_copy(reinterpret_cast<const uint16_t*>(src), n, dst); break;
+                case DT_INT16: checked_copy(reinterpret_cast<const int16_t*>(src), n, dst); break;
+                case DT_UINT32: checked_copy(reinterpret_cast<const uint32_t*>(src), n, dst); break;
+                case DT_INT32: checked_copy(reinterpret_cast<const int32_t*>(src), n, dst); break;
+                case DT_FLOAT32: checked_copy(reinterpret_cast<const float*>(src), n, dst); break;
+                case DT_FLOAT64: checked_copy(reinterpret_cast<const double*>(src), n, dst); break;
+                default: throw std::runtime_error("lidx_packed.h: unknown element type");
+            }
+        }
+
+        //! Load n packed elements of type t from src into v.
+        template <typename T>
+        void load_elements(const unsigned char* src, unsigned int t, std::size_t n, std::vector<T>& v) {
+            v.resize(n);
+            if(t == DT_BIT) {
+                for(std::size_t i=0; i<n; ++i) {
+                    v[i] = (src[i >> 3] >> (i & 7)) & 0x01;
+                }
+            } else if(n > 0) {
+                convert(src, t, n, &v[0]);
+            }
+        }
+
+        //! Load n packed elements of type t from src into v, as (x != 0).
+        inline void load_elements(const unsigned char* src, unsigned int t, std::size_t n, bit_vector& v) {
+            if(t == DT_BIT) {
+                v.assign_bytes(src, n);
+            } else {
+                std::vector<double> x;
+                load_elements(src, t, n, x);
+                v.assign(x.begin(), x.end());
+            }
+        }
+
+        //! Write the elements of v to out, packed.
+        template <typename T>
+        void store_elements(std::ostream& out, const std::vector<T>& v) {
+            if(!v.empty()) {
+                out.write(reinterpret_cast<const char*>(&v[0]), v.size()*sizeof(T));
+            }
+        }
+
+        //! Write the elements of v to out, packed.
+        inline void store_elements(std::ostream& out, const bit_vector& v) {
+            out.write(reinterpret_cast<const char*>(v.bytes()), v.nbytes());
+        }
+
+        //! Returns the number of elements in each record of a database with the given dims.
+        template <typename DimList>
+        std::size_t record_size(const DimList& dims) {
+            std::size_t n=1;
+            for(typename DimList::const_iterator i=dims.begin(); i!=dims.end(); ++i) {
+                n *= *i;
+            }
+            return n;
+        }
+
+        /*! Write the header, dims, and labels of a packed file with count
+         records of type Label and Data to out; the records' data must follow.
+         */
+        template <typename Label, typename Data, typename DimList>
+        packed_header write_prefix(std::ostream& out, const DimList& dims, std::size_t count, const Label* labels) {
+            packed_header h;
+            std::memcpy(h.magic, "LIDX", 4);
+            h.version = 2;
+            h.label_type = dtype_of<Label>::value;
+            h.data_type = dtype_of<Data>::value;
+            h.ndims = dims.size();
+            h.reserved = 0;
+            h.count = count;
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+            std::vector<uint32_t> d(dims.begin(), dims.end());
+            d.resize((h.labels_offset() - sizeof(h)) / sizeof(uint32_t), 0);
+            if(!d.empty()) {
+                out.write(reinterpret_cast<const char*>(&d[0]), d.size()*sizeof(uint32_t));
+            }
+
+            out.write(reinterpret_cast<const char*>(labels), count*sizeof(Label));
+            static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+            out.write(zeros, h.data_offset() - h.labels_offset() - count*sizeof(Label));
+            return h;
+        }
+
+        //! Write db to out in packed format.
+        template <typename DB>
+        void write_packed(std::ostream& out, DB& db) {
+            typedef typename DB::record_type::label_type label_type;
+            typedef typename DB::record_type::data_type data_type;
+            const std::size_t rsize = record_size(db.dims());
+
+            std::vector<label_type> labels;
+            labels.reserve(db.records().size());
+            for(std::size_t i=0; i<db.records().size(); ++i) {
+                labels.push_back(db[i].label);
+            }
+            write_prefix<label_type,data_type>(out, db.dims(), labels.size(), labels.empty() ? 0 : &labels[0]);
+
+            for(std::size_t i=0; i<labels.size(); ++i) {
+                if(db[i].data.size() != rsize) {
+                    throw std::runtime_error("lidx_packed.h: record size doesn't match dims");
+                }
+                store_elements(out, db[i].data);
+            }
+            if(!out) {
+                throw std::runtime_error("lidx_packed.h: write failed");
+            }
+        }
+
+        //! Set the dims of db from header h and its dims d, and return the number of elements in each record.
+        template <typename DB>
+        std::size_t prepare_dims(const packed_header& h, const uint32_t* d, DB& db) {
+            typedef typename DB::dim_list_type::value_type dim_type;
+            for(std::size_t i=0; i<h.ndims; ++i) {
+                if(d[i] > std::numeric_limits<dim_type>::max()) {
+                    throw std::runtime_error("lidx_packed.h: dimension too large");
+                }
+            }
+            db.dims().assign(d, d + h.ndims);
+            return record_size(db.dims());
+        }
+
+        //! Set the dims of db, and size its record list, from header h and its dims d.
+        template <typename DB>
+        std::size_t prepare_packed(const packed_header& h, const uint32_t* d, DB& db) {
+            std::size_t rsize = prepare_dims(h, d, db);
+            db.records().clear();
+            db.records().resize(h.count);
+            return rsize;
+        }
+
+        //! Returns the header of the packed file in the n bytes at p, throwing if the file is truncated.
+        inline const packed_header& mapped_header(const unsigned char* p, std::size_t n) {
+            if(n < sizeof(packed_header)) {
+                throw std::runtime_error("lidx_packed.h: truncated header");
+            }
+            const packed_header& h = *reinterpret_cast<const packed_header*>(p);
+            h.check();
+            const uint32_t* d = reinterpret_cast<const uint32_t*>(p + sizeof(h));
+            if((n < h.labels_offset()) || (n < h.data_offset() + h.count * h.record_bytes(record_size(std::vector<uint64_t>(d, d + h.ndims))))) {
+                throw std::runtime_error("lidx_packed.h: truncated file");
+            }
+            return h;
+        }
+
+        /*! Read a packed database from the n bytes at p (typically, a mapped
+         file), converting labels and data to the db's types.
+         */
+        template <typename DB>
+        void read_packed(const unsigned char* p, std::size_t n, DB& db) {
+            const packed_header& h = mapped_header(p, n);
+            const std::size_t ls = dtype_size(h.label_type);
+            const std::size_t rsize = prepare_packed(h, reinterpret_cast<const uint32_t*>(p + sizeof(h)), db);
+            const std::size_t rbytes = h.record_bytes(rsize);
+            const unsigned char* labels = p + h.labels_offset();
+            const unsigned char* data = p + h.data_offset();
+            for(std::size_t i=0; i<h.count; ++i) {
+                convert(labels + i*ls, h.label_type, 1, &db[i].label);
+                load_elements(data + i*rbytes, h.data_type, rsize, db[i].data);
+            }
+        }
+
+        //! Read exactly n bytes from in to p, throwing if the stream ends early.
+        inline void read_bytes(std::istream& in, void* p, std::size_t n) {
+            if(n == 0) {
+                return;
+            }
+            if(!in.read(static_cast<char*>(p), n) || (static_cast<std::size_t>(in.gcount()) != n)) {
+                throw std::runtime_error("lidx_packed.h: truncated file");
+            }
+        }
+
+        /*! Read the header, dims, and labels of a packed file from a stream,
+         setting the dims of db; the (unconverted) labels are left in buf.
+         */
+        template <typename DB>
+        packed_header read_prefix(std::istream& in, std::vector<unsigned char>& buf, DB& db) {
+            packed_header h;
+            read_bytes(in, &h, sizeof(h));
+            h.check();
+            buf.resize(std::max<std::size_t>(h.labels_offset() - sizeof(h), 8));
+            read_bytes(in, &buf[0], h.labels_offset() - sizeof(h));
+            prepare_dims(h, reinterpret_cast<const uint32_t*>(&buf[0]), db);
+            buf.resize(std::max<std::size_t>(h.data_offset() - h.labels_offset(), 8));
+            read_bytes(in, &buf[0], h.data_offset() - h.labels_offset());
+            return h;
+        }
+
+        //! Read a packed database from a stream (e.g., a gzip decompressor), one record at a time.
+        template <typename DB>
+        void read_packed(std::istream& in, DB& db) {
+            std::vector<unsigned char> buf;
+            const packed_header h = read_prefix(in, buf, db);
+            const std::size_t rsize = record_size(db.dims());
+            const std::size_t ls = dtype_size(h.label_type), rbytes = h.record_bytes(rsize);
+            db.records().clear();
+            db.records().resize(h.count);
+            for(std::size_t i=0; i<h.count; ++i) {
+                convert(&buf[i*ls], h.label_type, 1, &db[i].label);
+            }
+            buf.resize(std::max<std::size_t>(rbytes, 8));
+            for(std::size_t i=0; i<h.count; ++i) {
+                read_bytes(in, &buf[0], rbytes);
+                load_elements(&buf[0], h.data_type, rsize, db[i].data);
+            }
+        }
+
+    } // detail
+
+    /*! Read-only, memory-mapped packed lidx file.
+
+     Labels and data are accessed in place, straight from the mapping; nothing
+     is parsed or copied beyond the header.  Typed accessors throw
+     std::runtime_error if the requested type isn't the one stored; bit data
+     is accessed through bytes().
+     */
+    class packed_file {
+    public:
+        //! Constructor; maps fname.
+        packed_file(const std::string& fname) : _file(fname) {
+            init();
+        }
+
+        //! Constructor; uses an existing mapping.
+        packed_file(const mapped_file& file) : _file(file) {
+            init();
+        }
+
+        //! Returns the header.
+        const packed_header& header() const { return *_h; }
+
+        //! Returns the number of records.
+        std::size_t size() const { return _h->count; }
+
+        //! Returns the number of dimensions.
+        std::size_t ndims() const { return _h->ndims; }
+
+        //! Returns the size of dimension n.
+        std::size_t dim(std::size_t n) const { return _dims[n]; }
+
+        //! Returns the number of elements in each record.
+        std::size_t record_size() const { return _rsize; }
+
+        //! Returns the number of bytes of data in each record.
+        std::size_t record_bytes() const { return _h->record_bytes(_rsize); }
+
+        //! Returns a pointer to the packed data of record i, of any type.
+        const unsigned char* bytes(std::size_t i) const {
+            return _file.data() + _h->data_offset() + i*record_bytes();
+        }
+
+        //! Returns a pointer to the labels of all records.
+        template <typename T>
+        const T* labels() const {
+            check<T>(_h->label_type);
+            return reinterpret_cast<const T*>(_file.data() + _h->labels_offset());
+        }
+
+        //! Returns a pointer to the data of record i.
+        template <typename T>
+        const T* data(std::size_t i) const {
+            check<T>(_h->data_type);
+            return reinterpret_cast<const T*>(_file.data() + _h->data_offset()) + i*_rsize;
+        }
+
+    protected:
+        //! Validate the header and the size of the mapping.
+        void init() {
+            if(_file.size() < sizeof(packed_header)) {
+                throw std::runtime_error("lidx_packed.h: truncated header");
+            }
+            _h = reinterpret_cast<const packed_header*>(_file.data());
+            _h->check();
+            if(_file.size() < _h->labels_offset()) {
+                throw std::runtime_error("lidx_packed.h: truncated file");
+            }
+            _dims = reinterpret_cast<const uint32_t*>(_file.data() + sizeof(packed_header));
+            _rsize = detail::record_size(std::vector<uint64_t>(_dims, _dims + _h->ndims));
+            if(_file.size() < _h->data_offset() + _h->count * _h->record_bytes(_rsize)) {
+                throw std::runtime_error("lidx_packed.h: truncated file");
+            }
+        }
+
+        //! Throws if T isn't dtype t.
+        template <typename T>
+        void check(unsigned int t) const {
+            if(t != static_cast<unsigned int>(dtype_of<T>::value)) {
+                throw std::runtime_error("lidx_packed.h: element type mismatch");
+            }
+        }
+
+        mapped_file _file; //!< Underlying mapping.
+        const packed_header* _h; //!< Header.
+        const uint32_t* _dims; //!< Dimension sizes.
+        std::size_t _rsize; //!< Number of elements in each record.
+    };
+
+} // lidx
+
+#endif
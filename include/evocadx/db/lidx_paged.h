@@ -0,0 +1,238 @@
+/* lidx_paged.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _LIDX_PAGED_H_
+#define _LIDX_PAGED_H_
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <utility>
+#include <evocadx/db/lidx.h>
+
+namespace lidx {
+
+    /*! Out-of-core, read-only lidx database.
+
+     Only the labels are read when a paged_db is opened.  Records are grouped
+     into blocks of consecutive records, which are decoded (and converted to
+     Label and Data) when one of their records is first accessed, and kept in
+     an LRU cache whose size is bounded by a memory budget, so a database can
+     be much larger than memory.  Accessing a record whose block isn't cached
+     (a miss) evicts least recently used blocks as needed to stay within the
+     budget; at least one block is always cached.
+
+     The file must be packed, either uncompressed (blocks are read from the
+     mapping) or gzipped by lidx (blocks are read through the index at the end
+     of the file; see block_gzip.h).  Other files can't be paged, and throw
+     std::runtime_error.
+
+     Records are accessed through the same spans as an arena_db, so a paged_db
+     can stand in for one:
+
+        lidx::paged_db<int, uint8_t> db("train.lidx.gz", 512 << 20);
+        sequence_matrix<lidx::paged_db<int, uint8_t>::span_type> M(db[i], db.dim(0), db.dim(1));
+
+     Since every miss decodes a whole block, records should be visited a
+     block at a time (see epoch_permutation::advance()) rather than in a
+     uniformly random order, which misses on nearly every access once the
+     file is larger than the budget.
+
+     A span stays valid until its block is evicted, which can happen on any
+     later miss.  A paged_db isn't thread-safe, even for reading.
+     */
+    template <typename Label, typename Data>
+    class paged_db : boost::noncopyable {
+    public:
+        typedef Label label_type; //!< Type of labels.
+        typedef Data data_type; //!< Element type of records.
+        typedef arena_db<Label,Data> block_type; //!< Type of a decoded block.
+        typedef typename block_type::span_type span_type; //!< View of a single record.
+        typedef typename block_type::vector_type vector_type; //!< Type of a block's arena.
+        typedef std::vector<label_type> label_list_type; //!< Type of the label array.
+        typedef std::vector<uint16_t> dim_list_type; //!< Type for a list of dimension sizes.
+
+        /*! Constructor; opens fname, with a cache of at most budget bytes of
+         decoded records, in blocks of about block_size bytes each.
+         */
+        paged_db(const std::string& fname, std::size_t budget=256<<20, std::size_t block_size=256<<10)
+        : _file(fname), _budget(budget), _hits(0), _misses(0) {
+            if(packed_header::match(_file.data(), _file.size())) {
+                _gz = false;
+            } else if(_idx.load(_file.data(), _file.size())) {
+                _gz = true;
+            } else {
+                throw std::runtime_error("lidx_paged.h: only packed lidx files can be paged: " + fname);
+            }
+
+            read(0, sizeof(_h), reinterpret_cast<unsigned char*>(&_h));
+            _h.check();
+            std::vector<uint32_t> d(_h.ndims + 1);
+            read(sizeof(_h), _h.ndims*sizeof(uint32_t), reinterpret_cast<unsigned char*>(&d[0]));
+            detail::prepare_dims(_h, &d[0], *this);
+            _rbytes = _h.record_bytes(record_size());
+            if(source_size() < _h.data_offset() + _h.count*_rbytes) {
+                throw std::runtime_error("lidx_paged.h: truncated file");
+            }
+
+            std::vector<unsigned char> labels(std::max<std::size_t>(_h.count * dtype_size(_h.label_type), 8));
+            read(_h.labels_offset(), _h.count * dtype_size(_h.label_type), &labels[0]);
+            _labels.resize(_h.count);
+            if(_h.count > 0) {
+                detail::convert(&labels[0], _h.label_type, _h.count, &_labels[0]);
+            }
+
+            _block_records = std::max<std::size_t>(1, block_size / std::max<std::size_t>(1, record_memory()));
+            _slots.assign((_h.count + _block_records - 1) / _block_records, _lru.end());
+        }
+
+        //! Get the dimension vector.
+        dim_list_type& dims() { return _dims; }
+
+        //! Get the size of dimension n.
+        std::size_t dim(std::size_t n) const { return _dims[n]; }
+
+        //! Returns the number of records.
+        std::size_t size() const { return _labels.size(); }
+
+        //! Returns the number of elements in each record.
+        std::size_t record_size() const { return detail::record_size(_dims); }
+
+        //! Get the label array (all labels are always in memory).
+        const label_list_type& labels() const { return _labels; }
+
+        //! Returns a view of record i, decoding its block if it isn't cached.
+        span_type operator[](const std::size_t i) {
+            block_type& b = fault(i / _block_records);
+            return b[i % _block_records];
+        }
+
+        //! Returns the number of records in each block.
+        std::size_t block_records() const { return _block_records; }
+
+        //! Returns the number of bytes of decoded records in each (full) block.
+        std::size_t block_memory() const { return _block_records * record_memory(); }
+
+        //! Returns the number of blocks that fit in the budget (at least 1).
+        std::size_t capacity() const {
+            return std::max<std::size_t>(1, _budget / std::max<std::size_t>(1, block_memory()));
+        }
+
+        //! Returns the memory budget, in bytes.
+        std::size_t budget() const { return _budget; }
+
+        //! Set the memory budget to n bytes, evicting blocks if needed.
+        void budget(std::size_t n) {
+            _budget = n;
+            evict(capacity());
+        }
+
+        //! Returns the number of blocks currently cached.
+        std::size_t cached() const { return _lru.size(); }
+
+        //! Returns the number of accesses whose block was cached.
+        std::size_t hits() const { return _hits; }
+
+        //! Returns the number of accesses that had to decode their block.
+        std::size_t misses() const { return _misses; }
+
+        //! Reset the hit and miss counters.
+        void reset_counters() {
+            _hits = _misses = 0;
+        }
+
+    protected:
+        typedef std::list<std::pair<std::size_t, boost::shared_ptr<block_type> > > lru_type; //!< Cached blocks, most recently used first.
+
+        //! Returns the memory used by the data and label of a decoded record.
+        std::size_t record_memory() const {
+            return packed_size(dtype_of<Data>::value, record_size()) + sizeof(Label);
+        }
+
+        //! Returns the size of the (uncompressed) file.
+        uint64_t source_size() const {
+            return _gz ? _idx.uncompressed_size() : _file.size();
+        }
+
+        //! Read n bytes of the (uncompressed) file starting at offset to s.
+        void read(uint64_t offset, std::size_t n, unsigned char* s) const {
+            if(offset + n > source_size()) {
+                throw std::runtime_error("lidx_paged.h: truncated file");
+            }
+            if(_gz) {
+                detail::block_bytes(_file.data(), _idx).read(offset, n, s);
+            } else {
+                detail::mapped_bytes(_file.data(), _file.size()).read(offset, n, s);
+            }
+        }
+
+        //! Evict least recently used blocks until at most n are cached.
+        void evict(std::size_t n) {
+            while(_lru.size() > n) {
+                _slots[_lru.back().first] = _lru.end();
+                _lru.pop_back();
+            }
+        }
+
+        //! Returns block b, decoding it if it isn't cached.
+        block_type& fault(std::size_t b) {
+            if(_slots[b] != _lru.end()) {
+                ++_hits;
+                _lru.splice(_lru.begin(), _lru, _slots[b]);
+                return *_lru.front().second;
+            }
+
+            ++_misses;
+            evict(capacity() - 1);
+            const std::size_t first=b * _block_records;
+            const std::size_t count=std::min(_block_records, size() - first);
+            boost::shared_ptr<block_type> p(new block_type());
+            p->dims() = _dims;
+            p->labels().assign(_labels.begin() + first, _labels.begin() + first + count);
+            if(_gz) {
+                _buf.resize(std::max<std::size_t>(count * _rbytes, 8));
+                read(_h.data_offset() + first*_rbytes, count*_rbytes, &_buf[0]);
+                detail::load_arena(&_buf[0], _h, count, *p);
+            } else {
+                detail::load_arena(_file.data() + _h.data_offset() + first*_rbytes, _h, count, *p);
+            }
+            _lru.push_front(std::make_pair(b, p));
+            _slots[b] = _lru.begin();
+            return *p;
+        }
+
+        mapped_file _file; //!< Mapping of the file.
+        block_gzip::index _idx; //!< Index of the file's members, if it's gzipped.
+        bool _gz; //!< True if the file is gzipped.
+        packed_header _h; //!< Header of the file.
+        std::size_t _rbytes; //!< Size of each packed record.
+        dim_list_type _dims; //!< Number and size of dimensions present in records.
+        label_list_type _labels; //!< Labels of all records.
+        std::size_t _budget; //!< Memory budget for cached blocks, in bytes.
+        std::size_t _block_records; //!< Number of records in each block.
+        lru_type _lru; //!< Cached blocks.
+        std::vector<typename lru_type::iterator> _slots; //!< Position of each block in _lru, or _lru.end().
+        std::vector<unsigned char> _buf; //!< Decompressed data of a block.
+        std::size_t _hits; //!< Accesses whose block was cached.
+        std::size_t _misses; //!< Accesses that decoded their block.
+    };
+
+} // lidx
+
+#endif
@@ -0,0 +1,174 @@
+/* lidx_sampling.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _LIDX_SAMPLING_H_
+#define _LIDX_SAMPLING_H_
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace lidx {
+
+    /*! Index of the records of a database by label.
+
+     Maps each label to the (ascending) indices of the records with that label.
+     The index isn't updated when records are added, removed, or reordered;
+     build() must be called again.
+     */
+    template <typename Label>
+    class label_index {
+    public:
+        typedef Label label_type; //!< Type of labels.
+        typedef std::vector<std::size_t> index_list_type; //!< Type of a list of record indices.
+        typedef std::map<Label, index_list_type> map_type; //!< Type of the map from labels to records.
+        typedef typename map_type::const_iterator const_iterator; //!< Iterator over (label, indices) pairs.
+
+        //! Constructor.
+        label_index() : _n(0) {
+        }
+
+        //! Index the records labeled [first, last), in order.
+        template <typename InputIterator>
+        void build(InputIterator first, InputIterator last) {
+            _map.clear();
+            _n = 0;
+            for( ; first!=last; ++first, ++_n) {
+                _map[*first].push_back(_n);
+            }
+        }
+
+        //! Returns the number of distinct labels.
+        std::size_t size() const { return _map.size(); }
+
+        //! Returns the number of records indexed.
+        std::size_t records() const { return _n; }
+
+        //! Returns the indices of the records labeled l (empty if there are none).
+        const index_list_type& operator[](const label_type& l) const {
+            static const index_list_type none;
+            const_iterator i=_map.find(l);
+            return (i == _map.end()) ? none : i->second;
+        }
+
+        //! Returns an iterator to the first (label, indices) pair.
+        const_iterator begin() const { return _map.begin(); }
+
+        //! Returns an iterator past the last (label, indices) pair.
+        const_iterator end() const { return _map.end(); }
+
+    protected:
+        map_type _map; //!< Indices of the records with each label.
+        std::size_t _n; //!< Number of records indexed.
+    };
+
+
+    /*! Draws class-balanced samples of record indices.
+
+     Each sample of n indices has n/k records of each of the k labels, and
+     the remaining n%k are drawn from distinct labels chosen at random, so
+     even small samples represent every class.  Within a label, records are
+     drawn without replacement from a shuffled order, which is reshuffled only
+     once all of the label's records have been drawn, so consecutive samples
+     cover each class evenly.  Samples are returned in random order.
+
+     Records are never moved: samples are lists of indices into the
+     database.  RNG is called as rng(m), for a random integer in [0, m) (as by
+     std::random_shuffle).
+     */
+    template <typename Label>
+    class stratified_sampler {
+    public:
+        typedef label_index<Label> index_type; //!< Type of the label index.
+        typedef std::vector<std::size_t> index_list_type; //!< Type of a list of record indices.
+
+        //! Constructor.
+        stratified_sampler() {
+        }
+
+        //! Constructor; samples the records indexed by idx.
+        stratified_sampler(const index_type& idx) {
+            reset(idx);
+        }
+
+        //! Sample the records indexed by idx (from scratch).
+        void reset(const index_type& idx) {
+            _classes.clear();
+            for(typename index_type::const_iterator i=idx.begin(); i!=idx.end(); ++i) {
+                _classes.push_back(stratum());
+                _classes.back().records = i->second;
+                _classes.back().next = i->second.size(); // shuffled on first draw
+            }
+        }
+
+        //! Returns the number of classes sampled.
+        std::size_t size() const { return _classes.size(); }
+
+        //! Draw a balanced sample of n record indices into s.
+        template <typename RNG>
+        void sample(std::size_t n, RNG& rng, index_list_type& s) {
+            s.clear();
+            if(_classes.empty()) {
+                return;
+            }
+            const std::size_t k=_classes.size();
+            std::vector<std::size_t> extra(k);
+            for(std::size_t i=0; i<k; ++i) {
+                extra[i] = i;
+            }
+            std::random_shuffle(extra.begin(), extra.end(), rng);
+            extra.resize(n % k);
+            std::sort(extra.begin(), extra.end());
+
+            for(std::size_t i=0, e=0; i<k; ++i) {
+                std::size_t m=n / k;
+                if((e < extra.size()) && (extra[e] == i)) {
+                    ++m;
+                    ++e;
+                }
+                for(std::size_t j=0; j<m; ++j) {
+                    s.push_back(_classes[i].draw(rng));
+                }
+            }
+            std::random_shuffle(s.begin(), s.end(), rng);
+        }
+
+    protected:
+        //! Records of a single class.
+        struct stratum {
+            index_list_type records; //!< Records of this class, in draw order.
+            std::size_t next; //!< Next record to draw.
+
+            //! Draw the next record, reshuffling once all have been drawn.
+            template <typename RNG>
+            std::size_t draw(RNG& rng) {
+                if(next >= records.size()) {
+                    std::random_shuffle(records.begin(), records.end(), rng);
+                    next = 0;
+                }
+                return records[next++];
+            }
+        };
+
+        std::vector<stratum> _classes; //!< Records of each class.
+    };
+
+} // lidx
+
+#endif
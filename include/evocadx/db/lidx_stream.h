@@ -0,0 +1,339 @@
+/* lidx_stream.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _LIDX_STREAM_H_
+#define _LIDX_STREAM_H_
+
+#include <boost/scoped_ptr.hpp>
+#include <cstdio>
+#include <iterator>
+#include <evocadx/db/lidx.h>
+
+namespace lidx {
+
+    /*! Reads the records of a lidx file one at a time.
+
+     Packed files (gzipped or not) are read in bounded memory: only the labels
+     and the current record are held, whatever the size of the file.  Legacy
+     archives can't be read incrementally, and are read whole (as <int,int>
+     records) when the reader is opened.
+
+     Records are converted to Label and Data as they're read.  They can be
+     read with next(), or through an input iterator:
+
+        lidx::reader<int, uint8_t> r("train.lidx.gz");
+        for(lidx::reader<int, uint8_t>::iterator i=r.begin(); i!=r.end(); ++i) {
+            ... i->label, i->data ...
+        }
+     */
+    template <typename Label, typename Data>
+    class reader {
+    public:
+        typedef lidx_record<Label,Data> record_type; //!< Type of records read.
+        typedef std::vector<uint16_t> dim_list_type; //!< Type for a list of dimension sizes.
+        typedef lidx_db<int, int, binaryS> legacy_db_type; //!< Type of database used for legacy archives.
+
+        //! Input iterator over the (remaining) records of a reader.
+        class iterator {
+        public:
+            typedef std::input_iterator_tag iterator_category; //!< Iterator category.
+            typedef record_type value_type; //!< Type of records.
+            typedef std::ptrdiff_t difference_type; //!< Type of distances between iterators.
+            typedef const record_type* pointer; //!< Pointer to a record.
+            typedef const record_type& reference; //!< Reference to a record.
+
+            //! Constructor; an end iterator.
+            iterator() : _r(0) {
+            }
+
+            //! Constructor; reads the first record of r.
+            iterator(reader* r) : _r(r) {
+                ++(*this);
+            }
+
+            //! Returns the current record.
+            const record_type& operator*() const { return _rec; }
+
+            //! Returns a pointer to the current record.
+            const record_type* operator->() const { return &_rec; }
+
+            //! Read the next record.
+            iterator& operator++() {
+                if(_r && !_r->next(_rec)) {
+                    _r = 0;
+                }
+                return *this;
+            }
+
+            //! Returns true if this and i are both (or both not) at the end.
+            bool operator==(const iterator& i) const { return _r == i._r; }
+
+            //! Returns true if this and i aren't both (or both not) at the end.
+            bool operator!=(const iterator& i) const { return _r != i._r; }
+
+        protected:
+            reader* _r; //!< Reader, or 0 at the end.
+            record_type _rec; //!< Current record.
+        };
+
+        //! Constructor; opens fname, and reads its header.
+        reader(const std::string& fname) : _file(fname), _stream(0), _p(0), _next(0) {
+            std::memset(&_h, 0, sizeof(_h));
+            static const boost::regex e(".*\\.gz$");
+            namespace bio = boost::iostreams;
+            _raw.reset(new bio::stream<mapped_file::source_type>(_file.source()));
+
+            std::istream* in=_raw.get();
+            if(boost::regex_match(fname, e)) {
+                _in.reset(new bio::filtering_stream<bio::input>());
+                detail::push_decompressor(*_in, _file);
+                _in->push(*_raw);
+                in = _in.get();
+            } else if(packed_header::match(_file.data(), _file.size())) {
+                // read straight from the mapping:
+                _h = detail::mapped_header(_file.data(), _file.size());
+                detail::prepare_dims(_h, reinterpret_cast<const uint32_t*>(_file.data() + sizeof(_h)), *this);
+                _labels.assign(_file.data() + _h.labels_offset(), _file.data() + _h.data_offset());
+                _p = _file.data() + _h.data_offset();
+                return;
+            }
+
+            switch(in->peek()) {
+                case 'L': {
+                    _h = detail::read_prefix(*in, _labels, *this);
+                    _stream = in;
+                    break;
+                }
+                case '<': {
+                    _legacy.reset(new legacy_db_type());
+                    detail::read(*in, *_legacy, xmlS());
+                    break;
+                }
+                default: {
+                    _legacy.reset(new legacy_db_type());
+                    detail::read(*in, *_legacy, binaryS());
+                    break;
+                }
+            }
+            if(_legacy) {
+                _dims = _legacy->dims();
+                _h.count = _legacy->records().size();
+            }
+        }
+
+        //! Get the dimension vector.
+        dim_list_type& dims() { return _dims; }
+
+        //! Get the size of dimension n.
+        std::size_t dim(std::size_t n) const { return _dims[n]; }
+
+        //! Returns the number of records in the file.
+        std::size_t size() const { return _h.count; }
+
+        //! Read the next record into r; returns false if there are no more records.
+        bool next(record_type& r) {
+            if(_next >= _h.count) {
+                return false;
+            }
+            if(_legacy) {
+                typename legacy_db_type::record_type& l=(*_legacy)[_next];
+                r.label = static_cast<Label>(l.label);
+                r.data.assign(l.data.begin(), l.data.end());
+                std::vector<int>().swap(l.data);
+            } else {
+                const std::size_t rsize=detail::record_size(_dims), rbytes=_h.record_bytes(rsize);
+                detail::convert(&_labels[_next * dtype_size(_h.label_type)], _h.label_type, 1, &r.label);
+                if(_p) {
+                    detail::load_elements(_p + _next*rbytes, _h.data_type, rsize, r.data);
+                } else {
+                    _buf.resize(std::max<std::size_t>(rbytes, 8));
+                    detail::read_bytes(*_stream, &_buf[0], rbytes);
+                    detail::load_elements(&_buf[0], _h.data_type, rsize, r.data);
+                }
+            }
+            ++_next;
+            return true;
+        }
+
+        //! Returns an iterator to the next record.
+        iterator begin() { return iterator(this); }
+
+        //! Returns an iterator past the last record.
+        iterator end() { return iterator(); }
+
+    protected:
+        mapped_file _file; //!< Mapping of the file.
+        boost::scoped_ptr<boost::iostreams::stream<mapped_file::source_type> > _raw; //!< Stream over the mapping.
+        boost::scoped_ptr<boost::iostreams::filtering_stream<boost::iostreams::input> > _in; //!< Decompressor, for gzipped files.
+        std::istream* _stream; //!< Stream that packed records are read from.
+        const unsigned char* _p; //!< Data of an uncompressed packed file, or 0.
+        boost::scoped_ptr<legacy_db_type> _legacy; //!< Legacy archive, or 0.
+        packed_header _h; //!< Header of a packed file (only the count is used for legacy archives).
+        dim_list_type _dims; //!< Number and size of dimensions present in records.
+        std::vector<unsigned char> _labels; //!< (Unconverted) labels of a packed file.
+        std::vector<unsigned char> _buf; //!< Buffer for the current record.
+        std::size_t _next; //!< Index of the next record.
+    };
+
+
+    /*! Writes a packed lidx file one record at a time.
+
+     Records are written as they come, so only the labels written so far are
+     held in memory.  Since the labels precede the data in a packed file, the
+     data is spooled to a temporary file (fname.spool) until close(), which
+     writes the file proper (block gzipped, if fname ends in .gz).  close() is
+     called by the destructor, if it hasn't been already, but errors can only
+     be reported by calling close() explicitly.
+
+     Records can be written with write(), or through an output iterator:
+
+        lidx::writer<int, uint8_t> w("train.lidx", dims);
+        std::copy(records.begin(), records.end(), w.begin());
+     */
+    template <typename Label, typename Data>
+    class writer {
+    public:
+        typedef lidx_record<Label,Data> record_type; //!< Type of records written.
+        typedef std::vector<uint16_t> dim_list_type; //!< Type for a list of dimension sizes.
+
+        //! Output iterator that writes records to a writer.
+        class iterator {
+        public:
+            typedef std::output_iterator_tag iterator_category; //!< Iterator category.
+            typedef void value_type; //!< Unused.
+            typedef void difference_type; //!< Unused.
+            typedef void pointer; //!< Unused.
+            typedef void reference; //!< Unused.
+
+            //! Constructor.
+            iterator(writer& w) : _w(&w) {
+            }
+
+            //! Returns this iterator (writes happen on assignment).
+            iterator& operator*() { return *this; }
+
+            //! No-op.
+            iterator& operator++() { return *this; }
+
+            //! No-op.
+            iterator& operator++(int) { return *this; }
+
+            //! Write a record, or anything with a label and data.
+            template <typename Record>
+            iterator& operator=(const Record& r) {
+                _w->write(r.label, r.data);
+                return *this;
+            }
+
+        protected:
+            writer* _w; //!< Writer.
+        };
+
+        //! Constructor; records written to fname will have the given dims.
+        writer(const std::string& fname, const dim_list_type& dims)
+        : _fname(fname), _spool_name(fname + ".spool"), _dims(dims), _rsize(detail::record_size(dims)), _closed(false) {
+            _spool.open(_spool_name.c_str(), std::ios::in|std::ios::out|std::ios::binary|std::ios::trunc);
+            if(!_spool.is_open()) {
+                throw std::runtime_error("lidx_stream.h: could not open " + _spool_name);
+            }
+        }
+
+        //! Destructor; closes the file if needed.
+        ~writer() {
+            try {
+                close();
+            } catch(std::exception&) {
+            }
+        }
+
+        //! Returns the number of records written so far.
+        std::size_t size() const { return _labels.size(); }
+
+        //! Write a record labeled l, with data s (of record_size() elements).
+        template <typename Sequence>
+        void write(const Label& l, const Sequence& s) {
+            if(_closed) {
+                throw std::runtime_error("lidx_stream.h: write after close");
+            }
+            if(static_cast<std::size_t>(s.size()) != _rsize) {
+                throw std::runtime_error("lidx_stream.h: record size doesn't match dims");
+            }
+            _rec.resize(_rsize);
+            for(std::size_t j=0; j<_rsize; ++j) {
+                _rec[j] = s[j];
+            }
+            detail::store_elements(_spool, _rec);
+            if(!_spool) {
+                throw std::runtime_error("lidx_stream.h: could not write to " + _spool_name);
+            }
+            _labels.push_back(l);
+        }
+
+        //! Write record r.
+        void write(const record_type& r) {
+            write(r.label, r.data);
+        }
+
+        //! Returns an output iterator that writes to this writer.
+        iterator begin() { return iterator(*this); }
+
+        //! Write the file, and remove the spool.
+        void close() {
+            if(_closed) {
+                return;
+            }
+            _closed = true;
+            namespace bio = boost::iostreams;
+            static const boost::regex e(".*\\.gz$");
+            std::ofstream ofs(_fname.c_str(), std::ios::out|std::ios::binary|std::ios::trunc);
+            bio::filtering_stream<bio::output> out;
+            if(boost::regex_match(_fname, e)) {
+                out.push(block_gzip::compressor());
+            }
+            out.push(ofs);
+
+            detail::write_prefix<Label,Data>(out, _dims, _labels.size(), _labels.empty() ? 0 : &_labels[0]);
+            _spool.seekg(0);
+            std::vector<char> buf(1 << 20);
+            while(_spool.read(&buf[0], buf.size()) || (_spool.gcount() > 0)) {
+                out.write(&buf[0], _spool.gcount());
+            }
+            _spool.close();
+            std::remove(_spool_name.c_str());
+            out.reset();
+            ofs.close();
+            if(!ofs) {
+                throw std::runtime_error("lidx_stream.h: could not write " + _fname);
+            }
+        }
+
+    protected:
+        std::string _fname; //!< Name of the file being written.
+        std::string _spool_name; //!< Name of the spool file.
+        dim_list_type _dims; //!< Number and size of dimensions present in records.
+        std::size_t _rsize; //!< Number of elements in each record.
+        std::fstream _spool; //!< Spooled record data.
+        std::vector<Label> _labels; //!< Labels of the records written so far.
+        typename storage<Data>::vector_type _rec; //!< Packing buffer for the current record.
+        bool _closed; //!< True once the file has been written.
+    };
+
+} // lidx
+
+#endif
@@ -0,0 +1,64 @@
+/* mapped_file.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _MAPPED_FILE_H_
+#define _MAPPED_FILE_H_
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <stdexcept>
+#include <string>
+
+/*! Read-only, memory-mapped view of a file.
+
+ Mapping a file (instead of reading it into a buffer) lets every process on a
+ node that reads the same data set share a single copy of it in the page
+ cache.  The mapping is released when the last copy of this object (or of
+ its source()) is destroyed.
+ */
+class mapped_file {
+public:
+    typedef boost::iostreams::mapped_file_source source_type; //!< Type of the underlying boost.iostreams device.
+
+    //! Constructor; maps fname, throwing std::runtime_error if it can't be mapped (e.g., it is empty).
+    mapped_file(const std::string& fname) {
+        try {
+            _src.open(fname);
+        } catch(std::exception&) {
+        }
+        if(!_src.is_open()) {
+            throw std::runtime_error("mapped_file.h: could not map " + fname);
+        }
+    }
+
+    //! Returns a pointer to the first byte of the file.
+    const unsigned char* data() const { return reinterpret_cast<const unsigned char*>(_src.data()); }
+
+    //! Returns the size of the file, in bytes.
+    std::size_t size() const { return _src.size(); }
+
+    /*! Returns the mapping as a boost.iostreams Direct source, which can be
+     used with bio::stream (zero-copy) or pushed onto a filtering_stream.
+     */
+    source_type& source() { return _src; }
+
+protected:
+    source_type _src; //!< Underlying mapping.
+};
+
+#endif
@@ -21,8 +21,41 @@
 #define _MNIST_H_
 
 #include <algorithm>
+#include <fstream>
+#include <string>
 #include <vector>
 
+/*! Reads the images of an MNIST data set one at a time, from its label and
+ image files, so that only the current image is held in memory.
+ */
+class mnist_reader {
+public:
+    //! Constructor; opens the label file lname and the image file iname.
+    mnist_reader(const std::string& lname, const std::string& iname);
+
+    //! Returns the number of images.
+    std::size_t size() const { return _n; }
+
+    //! Returns the number of rows in each image.
+    std::size_t rows() const { return _rows; }
+
+    //! Returns the number of columns in each image.
+    std::size_t cols() const { return _cols; }
+
+    //! Read the next image and its label; returns false if there are no more images.
+    bool next(unsigned char& label, std::vector<unsigned char>& img);
+
+protected:
+    std::string _lname; //!< Name of the label file.
+    std::string _iname; //!< Name of the image file.
+    std::ifstream _labels; //!< Label file.
+    std::ifstream _images; //!< Image file.
+    std::size_t _n; //!< Number of images.
+    std::size_t _rows; //!< Number of rows in each image.
+    std::size_t _cols; //!< Number of columns in each image.
+    std::size_t _next; //!< Index of the next image.
+};
+
 class mnist {
 public:
     //! Struct that contains information about a single image.
@@ -0,0 +1,80 @@
+/* pgm_writer.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _PGM_WRITER_H_
+#define _PGM_WRITER_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <evocadx/db/png.h>
+
+/*! Writes images as (binary) pgms on a background thread.
+
+ write() queues an image and returns right away, unless capacity images are
+ already waiting, in which case it blocks until one has been written; this
+ bounds the memory held by the queue.  Images are shared, not copied, so the
+ caller can drop its own pointer as soon as write() returns.
+
+ Files that can't be written are reported on std::cerr and recorded in
+ failures().  The destructor writes everything still queued.
+ */
+class pgm_writer {
+public:
+    typedef boost::shared_ptr<const png> png_ptr_type; //!< Pointer to an image to be written.
+    typedef std::vector<std::string> filename_vector_type; //!< Type for storing filenames.
+
+    //! Constructor.
+    pgm_writer(std::size_t capacity=8);
+
+    //! Destructor; writes all queued images.
+    ~pgm_writer();
+
+    //! Queue img to be written to filename.
+    void write(const std::string& filename, png_ptr_type img);
+
+    //! Wait until all queued images have been written.
+    void flush();
+
+    //! Returns the filenames that couldn't be written so far.
+    filename_vector_type failures();
+
+private:
+    typedef std::pair<std::string, png_ptr_type> job_type; //!< An image and where to write it.
+
+    //! Worker thread body.
+    void worker();
+
+    std::size_t _capacity; //!< Maximum number of queued images.
+    boost::mutex _mutex; //!< Guards all of the below.
+    boost::condition_variable _cond; //!< Signaled whenever the queue or _busy changes.
+    std::deque<job_type> _queue; //!< Images waiting to be written.
+    bool _busy; //!< True while the worker is writing an image.
+    bool _done; //!< True when the worker should exit (once the queue is empty).
+    filename_vector_type _failures; //!< Filenames that couldn't be written.
+    boost::scoped_ptr<boost::thread> _thread; //!< Worker thread.
+};
+
+#endif
@@ -20,22 +20,80 @@
 #ifndef _PNG_H
 #define _PNG_H
 
+#include <boost/shared_ptr.hpp>
 #include <vector>
 #include <string>
 #include <stdint.h>
+#include <evocadx/db/integral.h>
+#include <evocadx/db/histogram.h>
 
 /*! This class loads a PNG and stores the pixel values and metadata in object form.
  */
 class png {
 public:
     typedef uint16_t value_type; //!< Value type for pixel data.
-    typedef std::vector<double> histogram_vector_type; //<! Type for storing histograms.
     typedef std::vector<uint16_t> pixel_vector_type; //<! Type for storing pixel data.
     typedef std::pair<double, double> centroid_type; //<! Type for storing centroid.
+    typedef std::pair<unsigned long, unsigned long> origin_type; //<! Type for storing the (x,y) origin of a cropped image.
+
+    //! Engines that can be used to inflate the compressed image data.
+    enum inflate_type { PICOPNG_INFLATE, TABLE_INFLATE };
+
+    /*! Filters that can be used to downscale an image:
+     SUBSAMPLE_DOWNSCALE keeps the center pixel of each window;
+     REFERENCE_DOWNSCALE is the original triangle filter, applied per pixel;
+     SEPARABLE_DOWNSCALE is the same triangle filter applied as a row pass and
+     a column pass (equal to the reference within rounding); and
+     BOX_DOWNSCALE is the unweighted window mean.  All but subsampling stretch
+     the result back to the input's range of values.
+     */
+    enum downscale_type { SUBSAMPLE_DOWNSCALE, REFERENCE_DOWNSCALE, SEPARABLE_DOWNSCALE, BOX_DOWNSCALE };
+
+    /*! Methods that can be used to calculate the threshold when it isn't
+     given: TAIL_THRESHOLD is the original heuristic (the value above which
+     40% of the pixels lie, see tail_threshold()), and OTSU_THRESHOLD is
+     Otsu's method (see otsu_threshold()).
+     */
+    enum threshold_type { TAIL_THRESHOLD, OTSU_THRESHOLD };
+
+    /*! Layouts that can be used to store the pixels: ROW_MAJOR_LAYOUT is the
+     usual one; TILED_LAYOUT stores 8x8 tiles of pixels, row-major both
+     within and between tiles; and MORTON_LAYOUT stores 16x16 tiles in
+     row-major order, with the pixels of each tile in Z-order.  Tiles keep
+     the pixels of a small square (e.g., a camera's fovea) in a few cache
+     lines, however the camera moves.  The layout only changes how pixels
+     are stored; all accessors work the same for every layout.
+     */
+    enum layout_type { ROW_MAJOR_LAYOUT, TILED_LAYOUT, MORTON_LAYOUT };
+
+    //! Options that control how an image is loaded.
+    struct options {
+        //! Constructor; defaults are the same as for png(filename).
+        options() : weighted(false), threshold(0), downscale_fact(0), inflate(TABLE_INFLATE), streaming(false), integral(false), pyramid_levels(0),
+        downscale(REFERENCE_DOWNSCALE), threads(1), thresholding(TAIL_THRESHOLD),
+        layout(ROW_MAJOR_LAYOUT), crop(false) {
+        }
+
+        bool weighted; //!< If true, weight the centroid by intensity instead of thresholding.
+        value_type threshold; //!< Threshold; 0 implies calculate the threshold.
+        unsigned int downscale_fact; //!< Downscale factor; <= 1 implies no downscaling.
+        inflate_type inflate; //!< Inflate engine.
+        bool streaming; //!< If true, decode and preprocess one scanline at a time (8b and 16b greyscale only).
+        bool integral; //!< If true, build an integral image of the (preprocessed) pixels.
+        unsigned int pyramid_levels; //!< Number of levels in the mip pyramid, including this image; <= 1 implies no pyramid.
+        downscale_type downscale; //!< Downscale filter.
+        unsigned int threads; //!< Number of threads used to downscale and build the histogram (when not streaming).
+        threshold_type thresholding; //!< Method used to calculate the threshold, if it isn't given.
+        layout_type layout; //!< Layout of the pixels (of this image and its mip pyramid), once preprocessed.
+        bool crop; //!< If true, crop the preprocessed image to the bounding box of its non-zero pixels (see crop()).
+    };
     
     //! Constructor.
     png(const std::string& filename, bool weighted=false, value_type threshold=0,unsigned int downscale_fact=0);
 
+    //! Constructor; load filename with the given options.
+    png(const std::string& filename, const options& opts);
+
     //! Returns the width of this image, in pixels.
     unsigned long width() const;
     
@@ -51,34 +109,132 @@ public:
     //! Returns the number of columns (when treating this image as a matrix).
     unsigned long size2() const;
     
+    //! Returns the width of the image this one was cropped from (its own width, if it wasn't cropped).
+    unsigned long full_width() const { return _full_width; }
+
+    //! Returns the height of the image this one was cropped from (its own height, if it wasn't cropped).
+    unsigned long full_height() const { return _full_height; }
+
+    /*! Returns the (x,y) position of this image's top-left pixel in the image
+     it was cropped from; pixel (x,y) here is pixel (x+origin.first,
+     y+origin.second) there.
+     */
+    const origin_type& origin() const { return _origin; }
+
+    /*! Crop this image to the bounding box of its non-zero pixels (after
+     thresholding, the pixels above the threshold), if there are any.
+
+     The centroid moves with the pixels, so distances to it are unchanged;
+     origin(), full_width(), and full_height() relate the cropped image to
+     the original, e.g., to normalize distances by the original diagonal.
+     */
+    void crop();
+
     //! Returns the number of bytes per pixel.
     unsigned long get_bpp() const;
     
     //! Returns the image centoid
     centroid_type& get_centroid();
 
-    //! Returns the image centoid
-    bool write_pgm(const std::string& outfilename);
+    //! Returns the image centoid (const-qualified).
+    const centroid_type& get_centroid() const;
+
+    /*! Write this image to outfilename as a pgm, with a cross marking the
+     centroid; binary (P5) pgms store 16b pixels as 2 big-endian bytes, text
+     (P2) pgms store one value per line.  Returns false if the file couldn't
+     be written.
+     */
+    bool write_pgm(const std::string& outfilename, bool binary=true) const;
 
     //! Downscale this image into a binary image
     void downscale(std::size_t dfact,bool use_filter=false);
 
+    //! Downscale this image by dfact with the given filter, using nthreads threads (each computes a band of rows).
+    void downscale(std::size_t dfact, downscale_type type, unsigned int nthreads=1);
+
     //! Returns the 16b value of the n'th pixel.
     value_type& operator[](std::size_t n);
 
     //! Returns the 16b value of the n'th pixel (const-qualified).
     const value_type& operator[](std::size_t n) const;
 
+    //! Returns the 16b value of pixel (i,j) (row, column).
+    value_type operator()(std::size_t i, std::size_t j) const { return _pixels[offset(i, j)]; }
+
+    //! Returns the layout of the pixels.
+    layout_type layout() const { return _layout; }
+
+    //! Change the layout of the pixels.
+    void layout(layout_type l);
+
+    //! Returns the offset of pixel (i,j) (row, column) in the pixel data.
+    std::size_t offset(std::size_t i, std::size_t j) const {
+        switch(_layout) {
+            case TILED_LAYOUT: return ((i>>3)*_tiles + (j>>3))*64 + ((i&7)<<3) + (j&7);
+            case MORTON_LAYOUT: return ((i>>4)*_tiles + (j>>4))*256 + (spread4(i&15)<<1) + spread4(j&15);
+            default: return i*_width + j;
+        }
+    }
+
     //! Returns the distance of specified (x,y) coordinate to the centroid of this image.
     double distance_to_centroid(std::size_t x, std::size_t y);
+
+    /*! Returns the integral image of this png, for O(1) rectangle queries; it
+     is empty unless options::integral was set when this image was loaded.
+     */
+    const integral_image& integral() const { return _integral; }
+
+    //! Returns the number of levels in this image's mip pyramid (1 if it doesn't have one).
+    std::size_t levels() const { return 1 + _pyramid.size(); }
+
+    /*! Returns level k of this image's mip pyramid; level 0 is this image,
+     and each level after that is half the width and height of the one
+     before it.
+     */
+    const png& level(std::size_t k) const { return k ? *_pyramid[k-1] : *this; }
+
+    /*! Returns this image downscaled by 2 in each dimension (rounding up),
+     with each pixel the mean of a 2x2 block; the centroid is scaled to match.
+     */
+    png halve() const;
     
 private:
+    //! Spread the low 4 bits of x to the even bits of the result (abcd -> 0a0b0c0d).
+    static std::size_t spread4(std::size_t x) {
+        x = (x | (x << 2)) & 0x33;
+        return (x | (x << 1)) & 0x55;
+    }
+
+    //! Constructor; an empty image (used for pyramid levels).
+    png();
+
+    //! Load, decode, and preprocess filename.
+    void load(const std::string& filename, const options& opts);
+
+    //! Streaming decode and preprocess; returns false if the format can't be streamed.
+    bool stream(const unsigned char* data, std::size_t size, const options& opts);
+
+    //! Calculate the threshold (if needed) and centroid from h, and threshold the pixels.
+    void threshold(const histogram& h, const options& opts);
+
     pixel_vector_type _pixels; //!< Pixel data.
     unsigned int _bpp; //!< Bytes per pixel.
     unsigned long _width; //!< Width of image in pixels.
     unsigned long _height; //<! Height of image in pixels.
     value_type _threshold; //!< Value below which pixels are set to 0.
+    layout_type _layout; //!< Layout of the pixel data.
+    std::size_t _tiles; //!< Number of tiles per row of tiles (tiled layouts).
+    unsigned long _full_width; //!< Width of the image before cropping.
+    unsigned long _full_height; //!< Height of the image before cropping.
+    origin_type _origin; //!< Position of this image in the image before cropping.
     centroid_type _centroid; //!< Centroid of the image.
+    integral_image _integral; //!< Integral image (optional).
+    std::vector<boost::shared_ptr<png> > _pyramid; //!< Coarser levels of the mip pyramid (optional).
 };
 
+/*! Decode a png file buffer in memory into a raw pixel buffer (see png.cpp);
+ returns 0 if successful, a picopng error code otherwise.
+ */
+int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, std::size_t in_size, bool convert_to_rgba32, png::inflate_type inflate=png::TABLE_INFLATE);
+
 #endif
@@ -0,0 +1,76 @@
+/* png_loader.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _PNG_LOADER_H_
+#define _PNG_LOADER_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <string>
+#include <vector>
+#include <evocadx/db/png.h>
+
+/*! Loads a batch of png images concurrently.
+
+ Each worker thread repeatedly claims the next unloaded filename and decodes
+ and preprocesses it with the given options.  Images are returned in the same
+ order as their filenames regardless of which thread loaded them, so the
+ result is identical to loading them serially.
+ */
+class png_loader {
+public:
+    typedef boost::shared_ptr<png> png_ptr_type; //!< Pointer to a loaded image.
+    typedef std::vector<png_ptr_type> image_vector_type; //!< Type for storing loaded images.
+    typedef std::vector<std::string> filename_vector_type; //!< Type for storing filenames.
+    typedef std::vector<double> time_vector_type; //!< Type for storing load times.
+
+    //! Constructor; nthreads == 0 implies one thread per hardware core.
+    png_loader(const png::options& opts, unsigned int nthreads=0);
+
+    /*! Load the images in filenames, and return them in the same order.
+
+     If any image fails to load, the remaining images are skipped and a
+     std::runtime_error naming the offending file is thrown after all
+     workers have finished.
+     */
+    image_vector_type load(const filename_vector_type& filenames);
+
+    //! Returns the number of worker threads used by load().
+    unsigned int threads() const { return _nthreads; }
+
+    //! Returns the wall-clock time (in seconds) taken to load each image by the last call to load().
+    const time_vector_type& times() const { return _times; }
+
+private:
+    //! Worker thread body.
+    void worker();
+
+    png::options _opts; //!< Options used for loading each image.
+    unsigned int _nthreads; //!< Number of worker threads.
+
+    // per-load state, shared by all workers:
+    boost::mutex _mutex; //!< Guards _next and _error.
+    const filename_vector_type* _filenames; //!< Filenames being loaded.
+    std::size_t _next; //!< Index of the next filename to be loaded.
+    image_vector_type _images; //!< Loaded images.
+    time_vector_type _times; //!< Per-image load times.
+    std::string _error; //!< Error message from the first failed load, if any.
+};
+
+#endif
@@ -0,0 +1,135 @@
+/* binary_camera.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _BINARY_CAMERA_H_
+#define _BINARY_CAMERA_H_
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <evocadx/db/binary_image.h>
+
+/*! Camera over a binary_image, for use as the input to a Markov network.
+
+ The camera sits at (_i, _j) (row, column) and produces fovea^2 + 8*retina
+ binary inputs, the same number as ealib's retina2_iterator:
+
+ - The fovea is the fovea x fovea square of pixels centered on the camera,
+ in row-major order; each of its rows is read with a single
+ binary_image::row_bits() call.
+ - The retina is made of rings r = 1..retina of 8 pixels each (N, NE, E, SE,
+ S, SW, W, NW), at a distance of fovea/2 + 2^r pixels from the camera, so
+ that peripheral vision covers more of the image with each ring.
+
+ Only the size of the input vector matches retina2_iterator: the retina is
+ sampled differently, so a network sees different inputs through a
+ binary_camera than through retina2_iterator at the same position, and
+ switching a run to binary_camera (evocadx.binary_camera) changes its
+ behaviour.
+
+ Pixels outside of the image read as 0.  Inputs are gathered whenever the
+ camera moves; begin() and end() give random access to them, e.g.,
+ N.update(camera.begin()).  If the image has an occupancy index (see
+ binary_image::build_index()), views of empty regions are filled with 0s
+ without reading their pixels.
+ */
+class binary_camera {
+public:
+    typedef std::vector<int> input_vector_type; //!< Type for storing inputs.
+    typedef input_vector_type::const_iterator iterator; //!< Iterator over inputs.
+
+    //! Constructor.
+    binary_camera(const binary_image& img, std::size_t fovea, std::size_t retina)
+    : _i(0), _j(0), _img(img), _fovea(fovea), _retina(retina), _inputs(fovea*fovea + 8*retina) {
+        if(_fovea > 64) {
+            throw std::invalid_argument("binary_camera.h: fovea size must be <= 64");
+        }
+        gather();
+    }
+
+    //! Move the camera to (i,j) (row, column), clamped to the image.
+    void position(long i, long j) {
+        _i = clamp(i, _img.size1());
+        _j = clamp(j, _img.size2());
+        gather();
+    }
+
+    //! Move the camera by (di,dj) rows and columns, clamped to the image.
+    void move(long di, long dj) {
+        position(static_cast<long>(_i) + di, static_cast<long>(_j) + dj);
+    }
+
+    //! Returns an iterator to the first input.
+    iterator begin() const { return _inputs.begin(); }
+
+    //! Returns an iterator past the last input.
+    iterator end() const { return _inputs.end(); }
+
+    //! Returns the number of inputs.
+    std::size_t size() const { return _inputs.size(); }
+
+    //! Clamp x to [0, n).
+    static std::size_t clamp(long x, std::size_t n) {
+        return (n == 0) ? 0 : static_cast<std::size_t>(std::max(0L, std::min(x, static_cast<long>(n) - 1)));
+    }
+
+    //! Write the fovea^2 + 8*retina inputs of a camera at (i,j) on img to o.
+    static void gather(const binary_image& img, long i, long j, std::size_t fovea, std::size_t retina, input_vector_type::iterator o) {
+        const long h=fovea/2;
+        if(img.indexed()) {
+            // nothing to read if the whole view (out to the farthest ring) is empty:
+            long d = h + (retina ? (1L << std::min(retina, static_cast<std::size_t>(30))) : 0);
+            if(img.empty(i-d, j-d, i+d+1, j+d+1)) {
+                std::fill(o, o + fovea*fovea + 8*retina, 0);
+                return;
+            }
+        }
+        for(std::size_t r=0; r<fovea; ++r) {
+            binary_image::word_type bits = img.row_bits(i - h + r, j - h, fovea);
+            for(std::size_t k=0; k<fovea; ++k, ++o) {
+                *o = (bits >> k) & 1;
+            }
+        }
+
+        static const int di[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+        static const int dj[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+        for(std::size_t r=1; r<=retina; ++r) {
+            long d = h + (1L << std::min(r, static_cast<std::size_t>(30)));
+            for(int k=0; k<8; ++k, ++o) {
+                *o = img.row_bits(i + di[k]*d, j + dj[k]*d, 1) & 1;
+            }
+        }
+    }
+
+    std::size_t _i; //!< Row of the camera.
+    std::size_t _j; //!< Column of the camera.
+
+protected:
+    //! Gather inputs at the current position.
+    void gather() {
+        gather(_img, _i, _j, _fovea, _retina, _inputs.begin());
+    }
+
+    const binary_image& _img; //!< Image being viewed.
+    std::size_t _fovea; //!< Fovea size.
+    std::size_t _retina; //!< Number of retina rings.
+    input_vector_type _inputs; //!< Inputs at the current position.
+};
+
+#endif
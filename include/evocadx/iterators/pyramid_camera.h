@@ -0,0 +1,103 @@
+/* pyramid_camera.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _PYRAMID_CAMERA_H_
+#define _PYRAMID_CAMERA_H_
+
+#include <algorithm>
+#include <evocadx/db/binary_image.h>
+#include <evocadx/iterators/binary_camera.h>
+
+/*! Camera over the mip pyramid of a binary_image, that can zoom in and out.
+
+ The camera's position (_i, _j) is always in full-resolution (level 0)
+ coordinates.  At level k, the camera views level k of the pyramid at
+ (_i>>k, _j>>k), and each step of a move covers 2^k full-resolution pixels,
+ so that a coarse-to-fine search can cross the image in far fewer updates
+ than a scan at full resolution.
+
+ Inputs are the same as those of binary_camera, gathered from the current
+ level.
+ */
+class pyramid_camera {
+public:
+    typedef binary_camera::input_vector_type input_vector_type; //!< Type for storing inputs.
+    typedef binary_camera::iterator iterator; //!< Iterator over inputs.
+
+    //! Constructor; the camera starts at the coarsest level of img's pyramid.
+    pyramid_camera(const binary_image& img, std::size_t fovea, std::size_t retina)
+    : _i(0), _j(0), _img(img), _level(img.levels()-1), _fovea(fovea), _retina(retina), _inputs(fovea*fovea + 8*retina) {
+        if(_fovea > 64) {
+            throw std::invalid_argument("pyramid_camera.h: fovea size must be <= 64");
+        }
+        gather();
+    }
+
+    //! Move the camera to (i,j) (full-resolution row, column), clamped to the image.
+    void position(long i, long j) {
+        _i = binary_camera::clamp(i, _img.size1());
+        _j = binary_camera::clamp(j, _img.size2());
+        gather();
+    }
+
+    //! Move the camera by (di,dj) steps of the current level.
+    void move(long di, long dj) {
+        const long step=1L << _level;
+        position(static_cast<long>(_i) + di*step, static_cast<long>(_j) + dj*step);
+    }
+
+    //! Zoom in (z > 0, toward full resolution) or out (z < 0) by one level, if possible.
+    void zoom(int z) {
+        if((z > 0) && (_level > 0)) {
+            --_level;
+        } else if((z < 0) && ((_level+1) < _img.levels())) {
+            ++_level;
+        }
+        gather();
+    }
+
+    //! Returns the current level (0 == full resolution).
+    std::size_t level() const { return _level; }
+
+    //! Returns an iterator to the first input.
+    iterator begin() const { return _inputs.begin(); }
+
+    //! Returns an iterator past the last input.
+    iterator end() const { return _inputs.end(); }
+
+    //! Returns the number of inputs.
+    std::size_t size() const { return _inputs.size(); }
+
+    std::size_t _i; //!< Row of the camera, at full resolution.
+    std::size_t _j; //!< Column of the camera, at full resolution.
+
+protected:
+    //! Gather inputs at the current position and level.
+    void gather() {
+        binary_camera::gather(_img.level(_level), _i >> _level, _j >> _level, _fovea, _retina, _inputs.begin());
+    }
+
+    const binary_image& _img; //!< Image being viewed.
+    std::size_t _level; //!< Current level of the pyramid.
+    std::size_t _fovea; //!< Fovea size.
+    std::size_t _retina; //!< Number of retina rings.
+    input_vector_type _inputs; //!< Inputs at the current position.
+};
+
+#endif
@@ -0,0 +1,188 @@
+/* binary_image.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cmath>
+#include <evocadx/db/binary_image.h>
+
+//! Returns the number of set bits in x.
+static unsigned int popcount(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+binary_image::binary_image(unsigned long width, unsigned long height)
+: _width(width), _height(height), _stride((width+63)/64), _bits(_stride*height, 0), _centroid(0.0, 0.0),
+_full_width(width), _full_height(height), _origin(0, 0) {
+}
+
+binary_image::binary_image(const png& img) {
+    pack(img);
+    for(std::size_t k=1; k<img.levels(); ++k) {
+        _pyramid.push_back(boost::shared_ptr<binary_image>(new binary_image()));
+        _pyramid.back()->pack(img.level(k));
+    }
+}
+
+void binary_image::pack(const png& img) {
+    _width = img.width();
+    _height = img.height();
+    _stride = (_width+63)/64;
+    _bits.assign(_stride*_height, 0);
+    _centroid = img.get_centroid();
+    _full_width = img.full_width();
+    _full_height = img.full_height();
+    _origin = img.origin();
+    for(std::size_t i=0; i<_height; ++i) {
+        word_type* row = &_bits[i*_stride];
+        for(std::size_t j=0; j<_width; ++j) {
+            row[j/64] |= static_cast<word_type>(img[i*_width + j] > 0) << (j%64);
+        }
+    }
+}
+
+binary_image::word_type binary_image::row_bits(long i, long j, unsigned int n) const {
+    if((i < 0) || (i >= static_cast<long>(_height)) || (n == 0)) {
+        return 0;
+    }
+    word_type r;
+    if(j < 0) {
+        if(-j >= static_cast<long>(n)) {
+            return 0;
+        }
+        r = word_at(i, 0) << (-j);
+    } else {
+        r = word_at(i, j);
+    }
+    return (n < 64) ? (r & ((static_cast<word_type>(1) << n) - 1)) : r;
+}
+
+std::size_t binary_image::count() const {
+    std::size_t c=0;
+    for(std::size_t i=0; i<_bits.size(); ++i) {
+        c += popcount(_bits[i]);
+    }
+    return c;
+}
+
+//! Returns the OR of each pair of adjacent bits of x, packed into the low 32 bits.
+static uint64_t pair_or(uint64_t x) {
+    x = (x | (x >> 1)) & 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffULL;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffULL;
+    return (x | (x >> 16)) & 0x00000000ffffffffULL;
+}
+
+binary_image binary_image::reduce() const {
+    binary_image r((_width+1)/2, (_height+1)/2);
+    for(std::size_t i=0; i<r._height; ++i) {
+        const word_type* a = &_bits[2*i*_stride];
+        const word_type* b = ((2*i+1) < _height) ? (a + _stride) : a;
+        word_type* o = &r._bits[i*r._stride];
+        for(std::size_t w=0; w<_stride; ++w) {
+            o[w/2] |= pair_or(a[w] | b[w]) << (32*(w%2));
+        }
+    }
+    return r;
+}
+
+void binary_image::build_index() {
+    _index.clear();
+    for(const binary_image* p=this; (p->_width > 1) || (p->_height > 1); p=_index.back().get()) {
+        _index.push_back(boost::shared_ptr<binary_image>(new binary_image(p->reduce())));
+    }
+    for(std::size_t k=0; k<_pyramid.size(); ++k) {
+        _pyramid[k]->build_index();
+    }
+}
+
+bool binary_image::any(std::size_t k, std::size_t i, std::size_t j, std::size_t i0, std::size_t j0, std::size_t i1, std::size_t j1) const {
+    const binary_image& level = k ? *_index[k-1] : *this;
+    if(!level.test(i, j)) {
+        return false;
+    }
+    // the block covers [bi0,bi1) x [bj0,bj1) of this image; if it's inside
+    // the rectangle, one of the rectangle's pixels is set:
+    std::size_t bi0=i<<k, bj0=j<<k;
+    std::size_t bi1=std::min(static_cast<std::size_t>(_height), (i+1)<<k), bj1=std::min(static_cast<std::size_t>(_width), (j+1)<<k);
+    if((k == 0) || ((i0 <= bi0) && (bi1 <= i1) && (j0 <= bj0) && (bj1 <= j1))) {
+        return true;
+    }
+    // otherwise, check the children that overlap the rectangle:
+    const std::size_t half=static_cast<std::size_t>(1) << (k-1);
+    for(std::size_t ci=2*i; (ci < 2*i+2) && ((ci*half) < i1); ++ci) {
+        if(((ci+1)*half) <= i0) {
+            continue;
+        }
+        for(std::size_t cj=2*j; (cj < 2*j+2) && ((cj*half) < j1); ++cj) {
+            if((((cj+1)*half) > j0) && any(k-1, ci, cj, i0, j0, i1, j1)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool binary_image::empty(long i0, long j0, long i1, long j1) const {
+    i0 = std::max(i0, 0L);
+    j0 = std::max(j0, 0L);
+    i1 = std::min(i1, static_cast<long>(_height));
+    j1 = std::min(j1, static_cast<long>(_width));
+    if((i0 >= i1) || (j0 >= j1)) {
+        return true;
+    }
+    if(indexed()) {
+        // start at the smallest level whose blocks are at least as large as
+        // the rectangle, where it overlaps at most 2x2 blocks:
+        std::size_t k=0;
+        while((k < _index.size()) && ((1L << k) < std::max(i1-i0, j1-j0))) {
+            ++k;
+        }
+        for(std::size_t i=(i0 >> k); i<=static_cast<std::size_t>((i1-1) >> k); ++i) {
+            for(std::size_t j=(j0 >> k); j<=static_cast<std::size_t>((j1-1) >> k); ++j) {
+                if(any(k, i, j, i0, j0, i1, j1)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    for(long i=i0; i<i1; ++i) {
+        for(long j=j0; j<j1; j+=64) {
+            if(row_bits(i, j, std::min(64L, j1-j))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Same as png::distance_to_centroid.
+ */
+double binary_image::distance_to_centroid(std::size_t x, std::size_t y) const {
+    return sqrt(pow((x - _centroid.first), 2) + pow((y - _centroid.second), 2));
+}
@@ -37,22 +37,34 @@ LIBEA_MD_DECL(EVOCADX_FOVEA_SIZE, "evocadx.fovea_size", std::size_t);
 LIBEA_MD_DECL(EVOCADX_RETINA_SIZE, "evocadx.retina_size", std::size_t);
 LIBEA_MD_DECL(EVOCADX_PIXEL_THRESHOLD, "evocadx.pixel_threshold", unsigned int);
 LIBEA_MD_DECL(EVOCADX_IMAGE_DOWNSCALE_FACTOR, "evocadx.image_downscale_factor", unsigned int);
+LIBEA_MD_DECL(EVOCADX_LOADER_THREADS, "evocadx.loader_threads", unsigned int);
+LIBEA_MD_DECL(EVOCADX_BINARY_CAMERA, "evocadx.binary_camera", bool);
+LIBEA_MD_DECL(EVOCADX_PYRAMID_LEVELS, "evocadx.pyramid_levels", unsigned int);
+LIBEA_MD_DECL(EVOCADX_OTSU_THRESHOLD, "evocadx.otsu_threshold", bool);
+LIBEA_MD_DECL(EVOCADX_OCCUPANCY_INDEX, "evocadx.occupancy_index", bool);
+LIBEA_MD_DECL(EVOCADX_CROP, "evocadx.crop", bool);
+LIBEA_MD_DECL(EVOCADX_ORIENTATIONS, "evocadx.orientations", unsigned int);
+LIBEA_MD_DECL(EVOCADX_CACHE_MB, "evocadx.cache_mb", unsigned int);
+LIBEA_MD_DECL(EVOCADX_STRATIFIED, "evocadx.stratified", bool);
+LIBEA_MD_DECL(EVOCADX_EPOCH_UPDATES, "evocadx.epoch_updates", unsigned int);
+LIBEA_MD_DECL(EVOCADX_DEDUP, "evocadx.dedup", bool);
 
 
 typedef std::vector<std::string> filename_vector_type;
 filename_vector_type find_files(const std::string& d, const std::string& r);
 
 
-//! Randomly shuffles the list of images at the end of every update.
+/*! Advances the order in which images are visited at the end of every update
+ (see epoch_permutation), past the examine_n images read during the update;
+ the images themselves are never moved.
+ */
 template <typename EA>
 struct evocadx_shuffle_images : end_of_update_event<EA> {
     evocadx_shuffle_images(EA& ea) : end_of_update_event<EA>(ea) { }
     virtual ~evocadx_shuffle_images() { }
     
     virtual void operator()(EA& ea) {
-        std::random_shuffle(ea.fitness_function()._images.begin(),
-                            ea.fitness_function()._images.end(),
-                            ea.rng());
+        ea.fitness_function()._order.advance(ea.rng(), get<EVOCADX_EXAMINE_N>(ea));
     }
 };
 
@@ -0,0 +1,138 @@
+/* histogram.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <evocadx/db/histogram.h>
+
+const std::size_t histogram::bins;
+
+histogram::histogram() : _count(bins, 0), _x(bins, 0), _y(bins, 0), _total(0) {
+}
+
+void histogram::add_row(const value_type* row, std::size_t n, std::size_t y) {
+    for(std::size_t j=0; j<n; ) {
+        // find the run of pixels [j, k) equal to row[j]:
+        value_type v=row[j];
+        std::size_t k=j+1;
+        while((k < n) && (row[k] == v)) {
+            ++k;
+        }
+        sum_type r=k-j;
+        _count[v] += r;
+        _x[v] += r*j + r*(r-1)/2; // j + (j+1) + ... + (k-1)
+        _y[v] += r*y;
+        j = k;
+    }
+    _total += n;
+}
+
+//! Adds a band of rows to a private histogram; used by histogram::add.
+struct histogram_band {
+    //! Add rows [first, last) of pixels to h.
+    static void run(histogram* h, const histogram::value_type* pixels, std::size_t width, std::size_t first, std::size_t last) {
+        for(std::size_t y=first; y<last; ++y) {
+            h->add_row(pixels + y*width, width, y);
+        }
+    }
+};
+
+void histogram::add(const value_type* pixels, std::size_t width, std::size_t height, unsigned int nthreads) {
+    nthreads = std::max(1u, std::min(nthreads, static_cast<unsigned int>(height)));
+    if(nthreads == 1) {
+        histogram_band::run(this, pixels, width, 0, height);
+        return;
+    }
+
+    // the first band is added here, the rest on their own threads:
+    std::size_t band=(height + nthreads - 1) / nthreads;
+    std::vector<histogram> h(nthreads-1);
+    boost::thread_group threads;
+    for(unsigned int t=1; t<nthreads; ++t) {
+        threads.add_thread(new boost::thread(&histogram_band::run, &h[t-1], pixels, width,
+                                             std::min(height, t*band), std::min(height, (t+1)*band)));
+    }
+    histogram_band::run(this, pixels, width, 0, std::min(height, band));
+    threads.join_all();
+    for(std::size_t t=0; t<h.size(); ++t) {
+        merge(h[t]);
+    }
+}
+
+void histogram::merge(const histogram& h) {
+    for(std::size_t v=0; v<bins; ++v) {
+        _count[v] += h._count[v];
+        _x[v] += h._x[v];
+        _y[v] += h._y[v];
+    }
+    _total += h._total;
+}
+
+histogram::centroid_type histogram::centroid(value_type t) const {
+    sum_type x=0, y=0;
+    unsigned int n=0;
+    for(std::size_t v=t; v<bins; ++v) {
+        n += _count[v];
+        x += _x[v];
+        y += _y[v];
+    }
+    return std::make_pair(round(static_cast<double>(x)/n), round(static_cast<double>(y)/n));
+}
+
+histogram::value_type tail_threshold(const histogram& h, double tail, double floor) {
+    int threshpos = 0;
+    double sum = 0.0;
+    int minpart = histogram::bins * floor;
+    for (int i = (int)histogram::bins-1; i >= minpart; i--) {
+        sum += static_cast<double>(h[i]) / h.total();
+        threshpos = i;
+        if (sum > tail) break;
+    }
+    return threshpos;
+}
+
+histogram::value_type otsu_threshold(const histogram& h) {
+    double total=0.0;
+    for(std::size_t v=0; v<histogram::bins; ++v) {
+        total += static_cast<double>(v) * h[v];
+    }
+
+    // the threshold is 1 above the last value in the background class:
+    double wb=0.0, sumb=0.0, best=-1.0;
+    std::size_t k=0;
+    for(std::size_t v=0; v<histogram::bins; ++v) {
+        wb += h[v];
+        if(wb == 0.0) {
+            continue;
+        }
+        double wf = h.total() - wb;
+        if(wf == 0.0) {
+            break;
+        }
+        sumb += static_cast<double>(v) * h[v];
+        double mb=sumb/wb, mf=(total-sumb)/wf;
+        double var=wb * wf * (mb-mf) * (mb-mf);
+        if(var > best) {
+            best = var;
+            k = v;
+        }
+    }
+    return static_cast<histogram::value_type>(std::min(k+1, histogram::bins-1));
+}
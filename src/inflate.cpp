@@ -0,0 +1,419 @@
+/* inflate.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <boost/predef/other/endian.h>
+#include <cstring>
+#include <limits>
+
+#include "inflate.h"
+
+namespace {
+    // Base values and extra bits for length and distance codes (RFC 1951, 3.2.5).
+    const uint16_t LENBASE[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+    const uint8_t LENEXTRA[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+    const uint16_t DISTBASE[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+    const uint8_t DISTEXTRA[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+    // Order in which code length code lengths are stored.
+    const uint8_t CLCL[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+    //! Load 8 bytes in little-endian order.
+    inline uint64_t load_le64(const unsigned char* p) {
+#if BOOST_ENDIAN_LITTLE_BYTE
+        uint64_t w;
+        std::memcpy(&w, p, sizeof(w));
+        return w;
+#else
+        uint64_t w=0;
+        for(int i=7; i>=0; --i) {
+            w = (w << 8) | p[i];
+        }
+        return w;
+#endif
+    }
+
+    //! Reverse the low n bits of c.
+    inline unsigned int reverse_bits(unsigned int c, unsigned int n) {
+        unsigned int r=0;
+        for(unsigned int i=0; i<n; ++i) {
+            r = (r << 1) | (c & 1);
+            c >>= 1;
+        }
+        return r;
+    }
+}
+
+/* Build a huffman code from a list of code lengths.  Over-subscribed codes are
+ an error; incomplete codes are allowed (they show up in single-code distance
+ trees), and decoding a missing code is caught in decode_slow.
+ */
+int inflater::huffman::build(const unsigned char* lengths, std::size_t n) {
+    std::memset(count, 0, sizeof(count));
+    for(std::size_t i=0; i<n; ++i) {
+        ++count[lengths[i]];
+    }
+    count[0] = 0;
+
+    int left=1;
+    for(int len=1; len<=MAX_BITS; ++len) {
+        left <<= 1;
+        left -= count[len];
+        if(left < 0) {
+            return 55; // over-subscribed
+        }
+    }
+
+    // symbols sorted by code length, then by value:
+    uint16_t offs[MAX_BITS+1];
+    offs[1] = 0;
+    for(int len=1; len<MAX_BITS; ++len) {
+        offs[len+1] = offs[len] + count[len];
+    }
+    for(std::size_t i=0; i<n; ++i) {
+        if(lengths[i]) {
+            symbol[offs[lengths[i]]++] = static_cast<uint16_t>(i);
+        }
+    }
+
+    // canonical codes; short codes are replicated across the fast table,
+    // indexed by their bit-reversed value (deflate packs codes msb-first):
+    unsigned int next[MAX_BITS+1];
+    unsigned int code=0;
+    next[0] = 0;
+    for(int len=1; len<=MAX_BITS; ++len) {
+        code = (code + count[len-1]) << 1;
+        next[len] = code;
+    }
+    std::memset(fast, 0, sizeof(fast));
+    for(std::size_t i=0; i<n; ++i) {
+        unsigned int len=lengths[i];
+        if(len == 0) {
+            continue;
+        }
+        unsigned int c=next[len]++;
+        if(len <= FAST_BITS) {
+            uint16_t e = static_cast<uint16_t>((len << 9) | i);
+            for(unsigned int j=reverse_bits(c,len); j<FAST_SIZE; j+=(1u<<len)) {
+                fast[j] = e;
+            }
+        }
+    }
+    return 0;
+}
+
+//! Constructor.
+inflater::inflater()
+: _seg(0), _in(0), _end(0), _overrun(0), _bitbuf(0), _bitcnt(0), _pos(0), _rpos(0), _error(0), _state(ZLIB), _final(false), _stored(0) {
+}
+
+//! Constructor.
+inflater::inflater(const unsigned char* in, std::size_t n)
+: _seg(0), _in(0), _end(0), _overrun(0), _bitbuf(0), _bitcnt(0), _pos(0), _rpos(0), _error(0), _state(ZLIB), _final(false), _stored(0) {
+    add_input(in, n);
+}
+
+//! Append a segment of input.
+void inflater::add_input(const unsigned char* in, std::size_t n) {
+    if(n > 0) {
+        _segs.push_back(std::make_pair(in, n));
+    }
+}
+
+/* Inflate a complete zlib stream.  As with picopng, the adler32 checksum is
+ not verified.
+ */
+int inflater::inflate(std::vector<unsigned char>& out) {
+    _out.swap(out); // reuse whatever space the caller reserved
+    _pos = 0;
+    inflate_until(std::numeric_limits<std::size_t>::max());
+    if(!_error) {
+        _out.resize(_pos);
+    }
+    out.swap(_out);
+    return _error;
+}
+
+/* Inflate the next n bytes of the stream.  Output that has been read and is
+ more than 32k behind the write position is discarded before inflating more.
+ */
+int inflater::read(unsigned char* dst, std::size_t n) {
+    while(!_error && (_state != DONE) && ((_pos - _rpos) < n)) {
+        std::size_t discard = std::min(_rpos, (_pos > 32768) ? (_pos - 32768) : 0);
+        if(discard >= 65536) {
+            std::memmove(&_out[0], &_out[discard], _pos - discard);
+            _pos -= discard;
+            _rpos -= discard;
+        }
+        inflate_until(_rpos + n);
+    }
+    if(_error) {
+        return _error;
+    }
+    if((_pos - _rpos) < n) {
+        return 91; // stream ended early
+    }
+    std::memcpy(dst, &_out[_rpos], n);
+    _rpos += n;
+    return 0;
+}
+
+//! Read the 2-byte zlib header.
+void inflater::begin_stream() {
+    std::size_t n=0;
+    for(std::size_t i=0; i<_segs.size(); ++i) {
+        n += _segs[i].second;
+    }
+    if(n < 2) { _error = 53; return; } // zlib data too small
+
+    _state = HEADER;
+    refill();
+    unsigned int cmf = bits(8), flg = bits(8);
+    if(((cmf << 8) | flg) % 31 != 0) { _error = 24; return; } // bad FCHECK
+    if(((cmf & 15) != 8) || (((cmf >> 4) & 15) > 7)) { _error = 25; return; } // only deflate with a 32k window
+    if((flg >> 5) & 1) { _error = 26; return; } // no preset dictionaries in png
+}
+
+/* Refill the bit buffer.  Away from the end of the input we load a whole
+ (unaligned) word and advance by however many bytes fit; near the end, we go
+ a byte at a time and pad with zeros, counting how far we've overrun.
+ */
+void inflater::refill() {
+    if((_end - _in) >= 8) {
+        _bitbuf |= load_le64(_in) << _bitcnt;
+        _in += (63 - _bitcnt) >> 3;
+        _bitcnt |= 56;
+    } else {
+        while(_bitcnt <= 56) {
+            if(_in == _end) {
+                next_segment();
+            }
+            if(_in < _end) {
+                _bitbuf |= static_cast<uint64_t>(*_in++) << _bitcnt;
+            } else {
+                ++_overrun;
+            }
+            _bitcnt += 8;
+        }
+        if(_overrun > 8) {
+            _error = 10; // end of input reached without an end code
+        }
+    }
+}
+
+//! Decode one symbol a bit at a time (puff-style canonical decoding).
+int inflater::decode_slow(const huffman& h) {
+    int code=0, first=0, index=0;
+    for(int len=1; len<=huffman::MAX_BITS; ++len) {
+        code |= static_cast<int>(bits(1));
+        int c=h.count[len];
+        if((code - c) < first) {
+            return h.symbol[index + (code - first)];
+        }
+        index += c;
+        first += c;
+        first <<= 1;
+        code <<= 1;
+    }
+    _error = 11; // no such code
+    return -1;
+}
+
+//! Inflate until at least target bytes are available.
+void inflater::inflate_until(std::size_t target) {
+    while(!_error && (_pos < target)) {
+        switch(_state) {
+            case ZLIB: begin_stream(); break;
+            case HEADER: {
+                if(_final) {
+                    _state = DONE;
+                } else {
+                    begin_block();
+                }
+                break;
+            }
+            case STORED: inflate_stored(); break;
+            case HUFFMAN: inflate_huffman(target); break;
+            case DONE: return;
+        }
+    }
+}
+
+//! Read a block header, and set up codes for huffman blocks.
+void inflater::begin_block() {
+    refill();
+    _final = bits(1);
+    unsigned int btype = bits(2);
+    switch(btype) {
+        case 0: {
+            // stored blocks start on a byte boundary:
+            bits(_bitcnt & 7);
+            refill();
+            unsigned int len = bits(16);
+            unsigned int nlen = bits(16);
+            if((len + nlen) != 65535) { _error = 21; return; }
+            _stored = len;
+            _state = STORED;
+            break;
+        }
+        case 1: {
+            unsigned char lengths[288+32];
+            std::memset(lengths, 8, 144);
+            std::memset(lengths+144, 9, 112);
+            std::memset(lengths+256, 7, 24);
+            std::memset(lengths+280, 8, 8);
+            std::memset(lengths+288, 5, 32);
+            _lit.build(lengths, 288);
+            _dist.build(lengths+288, 32);
+            _state = HUFFMAN;
+            break;
+        }
+        case 2: {
+            read_dynamic_trees();
+            _state = HUFFMAN;
+            break;
+        }
+        default: _error = 20; // invalid BTYPE
+    }
+}
+
+//! Read the code lengths for a dynamic block, and build the codes.
+void inflater::read_dynamic_trees() {
+    refill();
+    unsigned int hlit = bits(5) + 257;
+    unsigned int hdist = bits(5) + 1;
+    unsigned int hclen = bits(4) + 4;
+
+    unsigned char cl[19];
+    std::memset(cl, 0, sizeof(cl));
+    for(unsigned int i=0; i<hclen; ++i) {
+        if(_bitcnt < 3) refill();
+        cl[CLCL[i]] = static_cast<unsigned char>(bits(3));
+    }
+    huffman clcode;
+    if((_error = clcode.build(cl, 19))) {
+        return;
+    }
+
+    unsigned char lengths[288+32];
+    unsigned int i=0;
+    while(i < (hlit + hdist)) {
+        refill();
+        if(_error) return;
+        int code = decode(clcode);
+        if(code < 0) return;
+        if(code <= 15) {
+            lengths[i++] = static_cast<unsigned char>(code);
+            continue;
+        }
+
+        unsigned char value=0;
+        unsigned int rep=0;
+        switch(code) {
+            case 16: {
+                if(i == 0) { _error = 54; return; } // nothing to repeat
+                value = lengths[i-1];
+                rep = 3 + bits(2);
+                break;
+            }
+            case 17: rep = 3 + bits(3); break;
+            case 18: rep = 11 + bits(7); break;
+            default: _error = 16; return;
+        }
+        if((i + rep) > (hlit + hdist)) { _error = 13; return; }
+        std::memset(lengths+i, value, rep);
+        i += rep;
+    }
+
+    if(lengths[256] == 0) { _error = 64; return; } // must have an end code
+    if((_error = _lit.build(lengths, hlit))) return;
+    _error = _dist.build(lengths+hlit, hdist);
+}
+
+/* Copy a stored block.  Whole bytes still in the bit buffer come first, and
+ the rest is copied straight from the input segments.
+ */
+void inflater::inflate_stored() {
+    reserve(_stored);
+    while(_stored && (_bitcnt >= 8)) {
+        if((_bitcnt >> 3) <= _overrun) { _error = 23; return; } // only padding left
+        _out[_pos++] = static_cast<unsigned char>(bits(8));
+        --_stored;
+    }
+    if(_bitcnt == 0) {
+        _bitbuf = 0; // drop look-ahead from word refills; we're reading bytes directly
+    }
+    while(_stored) {
+        if(_in == _end) {
+            next_segment();
+            if(_in == _end) { _error = 23; return; } // reading outside of the input
+        }
+        std::size_t n = std::min(_stored, static_cast<std::size_t>(_end - _in));
+        std::memcpy(&_out[_pos], _in, n);
+        _pos += n;
+        _in += n;
+        _stored -= n;
+    }
+    _state = HEADER;
+}
+
+/* Decode symbols from a huffman block.  After a refill there are at least 56
+ bits buffered, which covers the longest length/distance pair (15+5+15+13).
+ */
+void inflater::inflate_huffman(std::size_t target) {
+    while(_pos < target) {
+        if(_bitcnt < 48) {
+            refill();
+            if(_error) return;
+        }
+
+        int sym = decode(_lit);
+        if(sym < 256) {
+            if(sym < 0) return;
+            reserve(1);
+            _out[_pos++] = static_cast<unsigned char>(sym);
+            continue;
+        }
+        if(sym == 256) {
+            _state = HEADER;
+            return;
+        }
+
+        sym -= 257;
+        if(sym >= 29) { _error = 18; return; }
+        std::size_t len = LENBASE[sym] + bits(LENEXTRA[sym]);
+
+        int dsym = decode(_dist);
+        if(dsym < 0) return;
+        if(dsym >= 30) { _error = 18; return; }
+        std::size_t dist = DISTBASE[dsym] + bits(DISTEXTRA[dsym]);
+        if(dist > _pos) { _error = 52; return; } // back reference before the start of output
+
+        reserve(len);
+        unsigned char* o = &_out[_pos];
+        const unsigned char* s = o - dist;
+        if(dist >= len) {
+            std::memcpy(o, s, len);
+        } else {
+            for(std::size_t i=0; i<len; ++i) {
+                o[i] = s[i];
+            }
+        }
+        _pos += len;
+    }
+}
@@ -0,0 +1,161 @@
+/* inflate.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _INFLATE_H_
+#define _INFLATE_H_
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/*! Table-driven inflater for the zlib streams found in png IDAT chunks.
+
+ Symbols are decoded with a single lookup into a FAST_BITS-wide table, falling
+ back to canonical decoding only for the (rare) longer codes, and input is
+ consumed from a 64-bit bit buffer that is refilled a word at a time.
+
+ Errors are reported with the same codes used by picopng / lodepng, so that
+ decode_png can use either engine interchangeably.
+ */
+class inflater {
+public:
+    //! Constructor; input must be added with add_input before inflating.
+    inflater();
+
+    //! Constructor; in points to a complete zlib stream (including its 2-byte header) of n bytes.
+    inflater(const unsigned char* in, std::size_t n);
+
+    /*! Append n bytes at in to the input.  The zlib stream may be split
+     across any number of segments (e.g., one per IDAT chunk); they are read
+     in place, and must remain valid for the lifetime of this inflater.
+     */
+    void add_input(const unsigned char* in, std::size_t n);
+
+    //! Inflates the entire stream into out, which is resized to fit; returns 0 on success or an error code.
+    int inflate(std::vector<unsigned char>& out);
+
+    /*! Inflates the next n bytes of the stream into dst; returns 0 on success
+     or an error code.
+
+     Only the 32k window needed for back references plus unread output is
+     kept in memory, so a stream can be consumed piecewise (e.g., one scanline
+     at a time) without ever holding all of its output.
+     */
+    int read(unsigned char* dst, std::size_t n);
+
+    //! Returns the error code of this inflater (0 == no error).
+    int error() const { return _error; }
+
+protected:
+    //! Huffman code with a fast lookup table.
+    struct huffman {
+        enum { FAST_BITS=10, FAST_SIZE=(1<<FAST_BITS), MAX_BITS=15 };
+
+        //! Build this code from a list of n code lengths; returns 0 or an error code.
+        int build(const unsigned char* lengths, std::size_t n);
+
+        uint16_t fast[FAST_SIZE]; //!< (length<<9 | symbol) for codes <= FAST_BITS long, 0 otherwise.
+        uint16_t count[MAX_BITS+1]; //!< Number of codes of each length.
+        uint16_t symbol[288]; //!< Symbols ordered by code.
+    };
+
+    //! Read and check the zlib header.
+    void begin_stream();
+
+    //! Inflate until at least target bytes of output have been produced, or the stream ends.
+    void inflate_until(std::size_t target);
+
+    //! Read the header of the next deflate block.
+    void begin_block();
+
+    //! Read the code lengths of a dynamic huffman block.
+    void read_dynamic_trees();
+
+    //! Copy stored (uncompressed) bytes.
+    void inflate_stored();
+
+    //! Decode huffman-compressed symbols.
+    void inflate_huffman(std::size_t target);
+
+    //! Advance to the next input segment, if any.
+    void next_segment() {
+        if(_seg < _segs.size()) {
+            _in = _segs[_seg].first;
+            _end = _in + _segs[_seg].second;
+            ++_seg;
+        }
+    }
+
+    //! Refill the bit buffer so that it holds at least 56 bits.
+    void refill();
+
+    //! Remove and return the low n bits of the bit buffer (n <= 32, must already be buffered).
+    uint32_t bits(unsigned int n) {
+        uint32_t r = static_cast<uint32_t>(_bitbuf & ((static_cast<uint64_t>(1) << n) - 1));
+        _bitbuf >>= n;
+        _bitcnt -= n;
+        return r;
+    }
+
+    //! Decode a single symbol with code h (at least 15 bits must already be buffered).
+    int decode(const huffman& h) {
+        uint16_t e = h.fast[_bitbuf & (huffman::FAST_SIZE-1)];
+        if(e) {
+            bits(e >> 9);
+            return e & 0x1ff;
+        }
+        return decode_slow(h);
+    }
+
+    //! Canonical (bit-at-a-time) decode of codes longer than FAST_BITS.
+    int decode_slow(const huffman& h);
+
+    //! Make sure there is room for at least n more bytes of output.
+    void reserve(std::size_t n) {
+        if((_pos + n) > _out.size()) {
+            _out.resize(std::max(2*_out.size(), _pos + n));
+        }
+    }
+
+    enum block_state { ZLIB, HEADER, STORED, HUFFMAN, DONE };
+    typedef std::vector<std::pair<const unsigned char*, std::size_t> > segment_list_type;
+
+    segment_list_type _segs; //!< Input segments.
+    std::size_t _seg; //!< Index of the next input segment.
+    const unsigned char* _in; //!< Next byte of input to be loaded into the bit buffer.
+    const unsigned char* _end; //!< End of the current input segment.
+    std::size_t _overrun; //!< Number of (zero) bytes loaded past the end of input.
+    uint64_t _bitbuf; //!< Bit buffer.
+    unsigned int _bitcnt; //!< Number of valid bits in the bit buffer.
+
+    std::vector<unsigned char> _out; //!< Inflated data.
+    std::size_t _pos; //!< Write position in _out.
+    std::size_t _rpos; //!< Read position in _out (for read()).
+
+    int _error; //!< Error code.
+    block_state _state; //!< Where we are in the deflate stream.
+    bool _final; //!< True if the current block is the last one.
+    std::size_t _stored; //!< Bytes remaining in the current stored block.
+    huffman _lit; //!< Literal / length code for the current block.
+    huffman _dist; //!< Distance code for the current block.
+};
+
+#endif
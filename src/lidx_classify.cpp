@@ -18,6 +18,7 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <libgen.h>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
 #include <algorithm>
 #include <iterator>
@@ -34,12 +35,48 @@ using namespace ealib;
 
 #include "evocadx.h"
 #include <evocadx/db/lidx.h>
+#include <evocadx/db/lidx_dedup.h>
+#include <evocadx/db/lidx_paged.h>
+#include <evocadx/db/epoch_permutation.h>
 
 
 /*! Singleton container for LIDX data.
+
+ Pixels are stored at 8b, all records in a single arena; lidx files of other
+ types (including legacy <int,int> archives) are converted as they are read.
+ If evocadx.cache_mb is non-zero, the training set is instead paged in from
+ disk as needed, keeping at most that many MB of records in memory (the file
+ must then be packed, see lidx_paged.h).
+
+ Records are never moved; they're visited in the order of an
+ epoch_permutation, which is reshuffled every update, or every
+ evocadx.epoch_updates updates to walk the whole training set; each update
+ then starts after the records read by the last, and runs whose examine_n x
+ epoch_updates doesn't cover the training set are rejected.  Paged records
+ are shuffled by block, and then within windows of as many blocks as fit in
+ the cache, so that each update's records come from blocks that stay cached
+ while the population is evaluated.  If evocadx.stratified is set, each
+ update instead evaluates a class-balanced sample of examine_n records, drawn
+ through an index of the training records by label (with no regard for
+ blocks, so paged samples are best kept small).
+
+ If evocadx.dedup is set, duplicate training records (e.g., the copies
+ written by lidxgen with fixed placement) are visited only once, and weighted
+ by their number of copies.  In memory, the duplicates are dropped; paged
+ records stay on disk, and only the first copy of each is visited.  Each
+ update then examines distinct records until their copies add up to
+ examine_n (see lidx::weighted_score), so it examines about examine_n / (mean
+ number of copies) records for the same score as examining every copy.
+
+ With both evocadx.stratified and evocadx.dedup set, stratified samples are
+ drawn from the distinct records and scored with unit weights: weighting them
+ by copies would let classes with more duplicates outweigh the others (and
+ stop scoring partway through the sample), undoing the balance.
  */
 struct data {
-    typedef lidx::lidx_db<int, int> db_type;
+    typedef lidx::arena_db<int, uint8_t> db_type;
+    typedef lidx::paged_db<int, uint8_t> paged_type;
+    typedef db_type::span_type span_type;
     static boost::shared_ptr<data> _inst;
     
     static data* instance() {
@@ -49,19 +86,100 @@ struct data {
         return _inst.get();
     }
     
-    data() : _initialized(false) {
+    data() : _examine_n(0), _sampled(false), _initialized(false) {
     }
     
     //! Load data.
-    void initialize(const std::string& train, const std::string& test) {
+    void initialize(const std::string& train, const std::string& test, std::size_t cache_mb, std::size_t epoch_updates, bool dedup, std::size_t examine_n) {
         if(!_initialized) {
-            lidx::read(train, training);
+            if(cache_mb > 0) {
+                paged.reset(new paged_type(train, cache_mb << 20));
+                if(dedup) {
+                    lidx::find_duplicates(*paged, unique, weights);
+                }
+            } else {
+                lidx::read(train, training);
+                if(dedup) {
+                    lidx::dedup(training, weights);
+                }
+            }
             lidx::read(test, testing);
+            
+            std::vector<int> labels(visits());
+            for(std::size_t k=0; k<labels.size(); ++k) {
+                labels[k] = paged ? paged->labels()[record(k)] : training.labels()[k];
+            }
+            if(paged) {
+                blocks.resize(visits());
+                for(std::size_t k=0; k<blocks.size(); ++k) {
+                    blocks[k] = record(k) / paged->block_records();
+                }
+            }
+            by_label.build(labels.begin(), labels.end());
+            sampler.reset(by_label);
+            order.reset(visits(), epoch_updates);
+            // each update's records weigh examine_n, of size() in all:
+            epoch_permutation::check_walk(size(), epoch_updates, examine_n);
+            _examine_n = examine_n;
             _initialized = true;
         }
     }
     
+    //! Visit a class-balanced sample of n training records next.
+    template <typename RNG>
+    void resample(std::size_t n, RNG& rng) {
+        epoch_permutation::index_list_type window;
+        sampler.sample(n, rng, window);
+        order.assign(window);
+        _sampled = true;
+    }
+    
+    //! Advance to the next update's order (by blocks, if paged), past the records read this update.
+    template <typename RNG>
+    void advance(RNG& rng) {
+        order.advance(rng, reads(order.current()), blocks, paged ? paged->capacity() : 0);
+    }
+    
+    //! Returns the number of records of v an update reads (see lidx_classify).
+    std::size_t reads(const epoch_permutation::view& v) const {
+        lidx::weighted_score s(_examine_n);
+        for(std::size_t i=0; (i < v.size()) && s.more(); ++i) {
+            s.add(weight(v[i]), false);
+        }
+        return s.examined();
+    }
+    
+    //! Returns the number of training records.
+    std::size_t size() const { return paged ? paged->size() : training.size(); }
+    
+    //! Returns the size of dimension n of the training records.
+    std::size_t dim(std::size_t n) const { return paged ? paged->dim(n) : training.dim(n); }
+    
+    //! Returns a view of training record i.
+    span_type operator[](std::size_t i) { return paged ? (*paged)[i] : training[i]; }
+    
+    //! Returns the number of distinct training records to visit.
+    std::size_t visits() const { return unique.empty() ? size() : unique.size(); }
+    
+    //! Returns the index of the k'th distinct training record.
+    std::size_t record(std::size_t k) const { return unique.empty() ? k : unique[k]; }
+    
+    //! Returns a view of the k'th distinct training record.
+    span_type visit(std::size_t k) { return (*this)[record(k)]; }
+    
+    //! Returns the weight (number of copies) of the k'th distinct training record; 1 in stratified samples.
+    double weight(std::size_t k) const { return (weights.empty() || _sampled) ? 1.0 : weights[k]; }
+    
     db_type training, testing;
+    boost::scoped_ptr<paged_type> paged; //!< Paged training records, if cache_mb > 0.
+    std::vector<std::size_t> unique; //!< Distinct paged training records, if dedup.
+    std::vector<std::size_t> weights; //!< Number of copies of each distinct training record, if dedup.
+    std::vector<std::size_t> blocks; //!< Block of each distinct paged training record.
+    epoch_permutation order; //!< Order in which distinct training records are visited.
+    lidx::label_index<int> by_label; //!< Index of training records by label.
+    lidx::stratified_sampler<int> sampler; //!< Sampler of class-balanced windows.
+    std::size_t _examine_n; //!< Weight of the records read each update.
+    bool _sampled; //!< True once a stratified window has been drawn.
     bool _initialized;
 };
 boost::shared_ptr<data> data::_inst; // define the instance pointer above
@@ -73,12 +191,20 @@ struct lidx_classify : fitness_function<unary_fitness<double>, constantS, stocha
     //! Calculate fitness of ind.
 	template <typename Individual, typename RNG, typename EA>
 	double operator()(Individual& ind, RNG& rng, EA& ea) {
-        typedef sequence_matrix<data::db_type::record_type::vector_type> matrix_type;
+        typedef sequence_matrix<data::span_type> matrix_type;
         typedef retina2_iterator<matrix_type> iterator_type;
         
         // lazy load of the mnist data (so we don't have to wait unless we
         // absolutely have to).
-        data::instance()->initialize(get<EVOCADX_TRAIN_FILE>(ea), get<EVOCADX_TEST_FILE>(ea));
+        // (stratified samples aren't walked in epochs):
+        data::instance()->initialize(get<EVOCADX_TRAIN_FILE>(ea), get<EVOCADX_TEST_FILE>(ea),
+                                     get<EVOCADX_CACHE_MB>(ea),
+                                     get<EVOCADX_STRATIFIED>(ea) ? 0 : get<EVOCADX_EPOCH_UPDATES>(ea),
+                                     get<EVOCADX_DEDUP>(ea), get<EVOCADX_EXAMINE_N>(ea));
+        if(get<EVOCADX_STRATIFIED>(ea) && !data::instance()->_sampled) {
+            data::instance()->resample(get<EVOCADX_EXAMINE_N>(ea), ea.rng());
+        }
+        epoch_permutation::view order = data::instance()->order.current();
         
         // get a markov network:
         typename EA::phenotype_type &N = ealib::phenotype(ind, ea);
@@ -89,18 +215,18 @@ struct lidx_classify : fitness_function<unary_fitness<double>, constantS, stocha
             return 0.0;
         }
         
-        double w=0.0; // accumulated fitness
-
-        // analyze the lidx records:
-        for(int i=0; i<get<EVOCADX_EXAMINE_N>(ea); ++i) {
+        // analyze the lidx records; each distinct record is examined once, and
+        // weighted by its number of copies, until they add up to examine_n:
+        lidx::weighted_score s(get<EVOCADX_EXAMINE_N>(ea));
+        for(std::size_t i=0; (i < order.size()) && s.more(); ++i) {
             N.reset(seed);
             N.clear();
             
             // build a matrix facade for the lix record we're looking at:
-            data::db_type::record_type& R=data::instance()->training[i];
-            matrix_type M(R.data,
-                          data::instance()->training.dim(0),
-                          data::instance()->training.dim(1));
+            data::span_type R=data::instance()->visit(order[i]);
+            matrix_type M(R,
+                          data::instance()->dim(0),
+                          data::instance()->dim(1));
             
             // now build a retina iterator over this matrix:
             iterator_type ci(M, get<EVOCADX_FOVEA_SIZE>(ea), get<EVOCADX_RETINA_SIZE>(ea));
@@ -115,12 +241,11 @@ struct lidx_classify : fitness_function<unary_fitness<double>, constantS, stocha
             std::vector<int> D;
             algorithm::range_pair2indices(N.begin_output()+4, N.end_output(), std::back_inserter(D));
 
-            if((D.size() == 1) && (D[0] == R.label)) {
-                w += 1.0;
-            }
+            s.add(data::instance()->weight(order[i]), (D.size() == 1) && (D[0] == R.label()));
         }
 
-        return w;
+        // scaled to examine_n records, as if every copy had been examined:
+        return s.score();
     }
 };
 
@@ -132,16 +257,22 @@ typedef mkv::markov_network_evolution
 , generational_models::moran_process<selection::proportionate< >, selection::rank< > >
 > ea_type;
 
-//! Randomly shuffles the list of images at the end of every update.
+/*! Advances the order in which images are visited at the end of every
+ update, or draws a new class-balanced window of them if evocadx.stratified
+ is set.
+ */
 template <typename EA>
 struct shuffle_data : end_of_update_event<EA> {
     shuffle_data(EA& ea) : end_of_update_event<EA>(ea) { }
     virtual ~shuffle_data() { }
     
     virtual void operator()(EA& ea) {
-        std::random_shuffle(data::instance()->training.records().begin(),
-                            data::instance()->training.records().end(),
-                            ea.rng());
+        if(get<EVOCADX_STRATIFIED>(ea)) {
+            data::instance()->resample(get<EVOCADX_EXAMINE_N>(ea), ea.rng());
+        } else {
+            data::instance()->advance(ea.rng());
+        }
+
     }
 };
 
@@ -166,6 +297,10 @@ public:
         add_option<EVOCADX_LABELS_N>(this);
         add_option<EVOCADX_FOVEA_SIZE>(this);
         add_option<EVOCADX_RETINA_SIZE>(this);
+        add_option<EVOCADX_CACHE_MB>(this);
+        add_option<EVOCADX_STRATIFIED>(this);
+        add_option<EVOCADX_EPOCH_UPDATES>(this);
+        add_option<EVOCADX_DEDUP>(this);
     }
     
     virtual void gather_tools() {
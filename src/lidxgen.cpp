@@ -19,7 +19,7 @@
  */
 #include <boost/lexical_cast.hpp>
 
-#include <evocadx/db/lidx.h>
+#include <evocadx/db/lidx_stream.h>
 #include <ea/rng.h>
 
 
@@ -89,10 +89,12 @@ int main(int argc, const char * argv[]) {
     
     int fix=boost::lexical_cast<int>(argv[5]);
     
-    typedef lidx::lidx_db<int, int> db_type;
-    db_type dst;
-    dst.dims().push_back(rows);
-    dst.dims().push_back(cols);
+    // records are written as they're generated:
+    typedef lidx::writer<int, lidx::bit> writer_type;
+    writer_type::dim_list_type dims;
+    dims.push_back(rows);
+    dims.push_back(cols);
+    writer_type dst(argv[2], dims);
 
     ealib::default_rng_type rng(42);
     
@@ -101,8 +103,6 @@ int main(int argc, const char * argv[]) {
         for(std::size_t i=0; i<10; ++i) {
             std::vector<int> f(rows*cols, 0);
 
-            db_type::record_type rec;
-            
             std::size_t sr=rng(rows-5);
             std::size_t sc=rng(cols-3);
             switch(fix) {
@@ -126,11 +126,9 @@ int main(int argc, const char * argv[]) {
 //            }
 //            std::cerr << std::endl;
             
-            rec.label = i;
-            rec.data.insert(rec.data.end(), f.begin(), f.end());
-            dst.records().push_back(rec);
+            dst.write(i, f);
         }
     }
     
-    lidx::write(argv[2], dst);
+    dst.close();
 }
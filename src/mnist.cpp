@@ -19,86 +19,68 @@
  */
 
 #include <arpa/inet.h>
-#include <boost/scoped_array.hpp>
 #include <fstream>
-#include <set>
 #include <stdexcept>
 #include <evocadx/db/mnist.h>
 
-/*! Load the image database.
- */
-void mnist::initialize(const std::string& lname, const std::string& iname) {
-    using namespace std;
-    
-    // Read in the labels:
-    //
-    ifstream ifs(lname.c_str(), ios::binary);
-    if(!ifs.good()) {
+namespace {
+    //! Read a big-endian 32b integer from in.
+    unsigned int read_u32(std::ifstream& in) {
+        unsigned int x=0;
+        in.read((char*)&x, sizeof(x));
+        return ntohl(x); // convert from file to host byte order
+    }
+}
+
+mnist_reader::mnist_reader(const std::string& lname, const std::string& iname)
+: _lname(lname), _iname(iname), _labels(lname.c_str(), std::ios::binary), _images(iname.c_str(), std::ios::binary), _next(0) {
+    if(!_labels.good()) {
         throw std::runtime_error("could not open: " + lname + " for reading");
     }
-    
-    // check that the magic number is right:
-    unsigned int magic=0;
-    ifs.read((char*)&magic, sizeof(magic));
-    magic = ntohl(magic); // convert from file to host byte order
-    assert(magic == 2049);
-    
-    // check that the file has more than 0 records:
-    unsigned int lrecords=0;
-    ifs.read((char*)&lrecords, sizeof(lrecords));
-    lrecords = ntohl(lrecords);
-    assert(lrecords > 0);
-    
-    // read in all the labels in one fell swoop:
-    boost::scoped_array<unsigned char> labels(new unsigned char[lrecords]);
-    ifs.read(reinterpret_cast<char*>(labels.get()), lrecords);
-    ifs.close();
-    
-    
-    // Read in the images:
-    //
-    ifs.open(iname.c_str(), ios::binary);
-    if(!ifs.good()) {
+    if(!_images.good()) {
         throw std::runtime_error("could not open: " + iname + " for reading");
     }
     
-    // check that the magic number is right:
-    magic=0;
-    ifs.read((char*)&magic, sizeof(magic));
-    magic = ntohl(magic); // convert from file to host byte order
-    assert(magic == 2051);
-    
-    // check that the file has more than 0 records:
-    unsigned int irecords=0;
-    ifs.read((char*)&irecords, sizeof(irecords));
-    irecords = ntohl(irecords);
-    assert(irecords > 0);
-    
-    // sanity; make sure that our labels & images have the same number of records
-    assert(irecords == lrecords);
+    // check the magic numbers, and that the files hold the same (non-zero)
+    // number of records:
+    if(read_u32(_labels) != 2049) {
+        throw std::runtime_error("mnist.cpp: " + lname + " is not an MNIST label file");
+    }
+    std::size_t lrecords = read_u32(_labels);
+    if(read_u32(_images) != 2051) {
+        throw std::runtime_error("mnist.cpp: " + iname + " is not an MNIST image file");
+    }
+    _n = read_u32(_images);
+    if((_n == 0) || (_n != lrecords)) {
+        throw std::runtime_error("mnist.cpp: label and image files don't match");
+    }
     
     // read in the size of the images:
-    unsigned int rows, cols;
-    ifs.read((char*)&rows, sizeof(rows));
-    rows = ntohl(rows);
-    ifs.read((char*)&cols, sizeof(cols));
-    cols = ntohl(cols);
-    
-    // read in the images, match them up with their labels, and figure out 
-    // how many labels we have (we need this to determine the number of outputs):
-    std::set<char> lset;
-    boost::scoped_array<unsigned char> img(new unsigned char[rows*cols]);
-    //    boost::scoped_array<unsigned char> bbimg(new unsigned char[rows*cols]);
-    
-    for(unsigned int i=0; i<irecords; ++i) {
-        lset.insert(labels[i]); // incrementally build up our label set...
-        ifs.read(reinterpret_cast<char*>(img.get()), rows*cols); // read the image
-        if(!ifs.good()) {
-            throw std::runtime_error("could not read from: " + lname);
-        }
-        
-        // now, build the labeled_image struct:
-        _idb.push_back(labeled_image(labels[i], img.get(), rows*cols));
+    _rows = read_u32(_images);
+    _cols = read_u32(_images);
+}
+
+bool mnist_reader::next(unsigned char& label, std::vector<unsigned char>& img) {
+    if(_next >= _n) {
+        return false;
+    }
+    img.resize(_rows*_cols);
+    _labels.read(reinterpret_cast<char*>(&label), 1);
+    _images.read(reinterpret_cast<char*>(&img[0]), img.size()); // read the image
+    if(!_labels.good() || !_images.good()) {
+        throw std::runtime_error("could not read from: " + _iname);
+    }
+    ++_next;
+    return true;
+}
+
+/*! Load the image database.
+ */
+void mnist::initialize(const std::string& lname, const std::string& iname) {
+    mnist_reader r(lname, iname);
+    unsigned char label;
+    std::vector<unsigned char> img;
+    while(r.next(label, img)) {
+        _idb.push_back(labeled_image(label, &img[0], img.size()));
     }
-    assert(_idb.size() == irecords);
 }
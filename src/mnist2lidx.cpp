@@ -25,7 +25,7 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 
-#include <evocadx/db/lidx.h>
+#include <evocadx/db/lidx_stream.h>
 #include <evocadx/db/mnist.h>
 
 using namespace std;
@@ -34,22 +34,21 @@ using namespace std;
 // 1==label file
 // 2==image file
 // 3==dst file
+//
+// Images are converted one at a time, so data sets of any size can be
+// converted in bounded memory.
 int main(int argc, const char * argv[]) {
-    mnist src;
-    src.initialize(argv[1], argv[2]);
+    mnist_reader src(argv[1], argv[2]);
     
-    typedef lidx::lidx_db<int, int> db_type;
-    db_type dst;
-    dst.dims().push_back(28);
-    dst.dims().push_back(28);
+    lidx::writer<int, uint8_t>::dim_list_type dims;
+    dims.push_back(src.rows());
+    dims.push_back(src.cols());
+    lidx::writer<int, uint8_t> dst(argv[3], dims);
     
-    for(std::size_t i=0; i<src.size(); ++i) {
-        mnist::labeled_image& img=src[i];
-        db_type::record_type rec;
-        rec.label = static_cast<int>(img.label);
-        rec.data.insert(rec.data.end(), img.img.begin(), img.img.end());
-        dst.records().push_back(rec);
+    unsigned char label;
+    std::vector<unsigned char> img;
+    while(src.next(label, img)) {
+        dst.write(static_cast<int>(label), img);
     }
-    
-    lidx::write(argv[3], dst);
+    dst.close();
 }
@@ -0,0 +1,88 @@
+/* pgm_writer.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <iostream>
+#include <evocadx/db/pgm_writer.h>
+
+pgm_writer::pgm_writer(std::size_t capacity)
+: _capacity(std::max(static_cast<std::size_t>(1), capacity)), _busy(false), _done(false) {
+    _thread.reset(new boost::thread(&pgm_writer::worker, this));
+}
+
+pgm_writer::~pgm_writer() {
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _done = true;
+    }
+    _cond.notify_all();
+    _thread->join();
+}
+
+void pgm_writer::write(const std::string& filename, png_ptr_type img) {
+    boost::mutex::scoped_lock lock(_mutex);
+    while(_queue.size() >= _capacity) {
+        _cond.wait(lock);
+    }
+    _queue.push_back(job_type(filename, img));
+    _cond.notify_all();
+}
+
+void pgm_writer::flush() {
+    boost::mutex::scoped_lock lock(_mutex);
+    while(!_queue.empty() || _busy) {
+        _cond.wait(lock);
+    }
+}
+
+pgm_writer::filename_vector_type pgm_writer::failures() {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _failures;
+}
+
+void pgm_writer::worker() {
+    for( ; ; ) {
+        job_type job;
+        {
+            boost::mutex::scoped_lock lock(_mutex);
+            while(_queue.empty() && !_done) {
+                _cond.wait(lock);
+            }
+            if(_queue.empty()) {
+                return;
+            }
+            job = _queue.front();
+            _queue.pop_front();
+            _busy = true;
+            _cond.notify_all();
+        }
+
+        // the image is released as soon as it's written:
+        bool ok = job.second->write_pgm(job.first);
+        job.second.reset();
+
+        boost::mutex::scoped_lock lock(_mutex);
+        if(!ok) {
+            std::cerr << "*** ERROR: failed to dump image to " << job.first << std::endl;
+            _failures.push_back(job.first);
+        }
+        _busy = false;
+        _cond.notify_all();
+    }
+}
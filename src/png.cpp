@@ -19,12 +19,17 @@
  */
 #include <boost/cstdint.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
 #include <limits>
 
 #include <evocadx/db/png.h>
+#include <evocadx/db/mapped_file.h>
+#include "inflate.h"
+#include "unfilter.h"
 
 /* ------Helper functions for constructor------*/
 // picopng needs this...
@@ -49,9 +54,11 @@ typedef std::size_t size_t;
  Information about the color type or palette colors are not provided. You need
  to know this information yourself to be able to use the data so this only
  works for trusted png files. Use Lodepng instead of picopng if you need this information.
+ inflate: inflate engine used to decompress the image data; TABLE_INFLATE uses
+ the table-driven inflater in inflate.cpp, PICOPNG_INFLATE the original one below.
  return: 0 if success, not 0 if some error occured.
  */
-int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32)
+int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width, unsigned long& image_height, const unsigned char* in_png, size_t in_size, bool convert_to_rgba32, png::inflate_type inflate)
 {
     // picopng version 20101224
     // Copyright (c) 2005-2010 Lode Vandevenne
@@ -78,6 +85,8 @@ int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width
     // with no color conversion at all. For anything more complex, another tiny library
     // is available: Lodepng (lodepng.c(pp)), which is a single source and header file.
     // Apologies for the compact code style, it's to make this tiny.
+    //
+    // Modified for EvoCADx: the inflate engine is selectable (see inflate.cpp).
     
     static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
     static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
@@ -305,7 +314,7 @@ int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width
             std::vector<unsigned char> palette;
         } info;
         int error;
-        void decode(std::vector<unsigned char>& out, const unsigned char* in, size_t size, bool convert_to_rgba32)
+        void decode(std::vector<unsigned char>& out, const unsigned char* in, size_t size, bool convert_to_rgba32, bool table_inflate)
         {
             error = 0;
             if(size == 0 || in == 0) { error = 48; return; } //the given data is empty
@@ -371,8 +380,16 @@ int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width
 
             unsigned long bpp = getBpp(info);
             std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
-            Zlib zlib; //decompress with the Zlib decompressor
-            error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
+            if(table_inflate)
+            {
+                inflater zlib(idat.empty() ? 0 : &idat[0], idat.size()); //decompress with the table-driven inflater
+                error = zlib.inflate(scanlines); if(error) return;
+            }
+            else
+            {
+                Zlib zlib; //decompress with the Zlib decompressor
+                error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
+            }
             size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
             out.resize(outlength); //time to fill the out buffer
             unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
@@ -435,44 +452,9 @@ int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width
 
         // ---------------------------------------------------------
         void unFilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length)
-        {
-            switch(filterType)
-            {
-                case 0: for(size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
-                case 1:
-                    for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-                    for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
-                    break;
-                case 2:
-                    if(precon) for(size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
-                    else       for(size_t i = 0; i < length; i++) recon[i] = scanline[i];
-                    break;
-                case 3:
-                    if(precon)
-                    {
-                        for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
-                        for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
-                    }
-                    else
-                    {
-                        for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-                        for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
-                    }
-                    break;
-                case 4:
-                    if(precon)
-                    {
-                        for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
-                        for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
-                    }
-                    else
-                    {
-                        for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
-                        for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paethPredictor(recon[i - bytewidth], 0, 0);
-                    }
-                    break;
-                default: error = 36; return; //error: unexisting filter type given
-            }
+        { // Modified for EvoCADx: uses the vectorized unfilter_scanline in unfilter.cpp.
+            int e = ::unfilter_scanline(recon, scanline, precon, bytewidth, filterType, length);
+            if(e) error = e;
         }
 
         // ---------------------------------------------------------
@@ -594,54 +576,493 @@ int decode_png(std::vector<unsigned char>& out_image, unsigned long& image_width
             return 0;
         }
 
-        // ---------------------------------------------------------
-        unsigned char paethPredictor(short a, short b, short c) //Paeth predicter, used by png filter type 4
-        {
-            short p = a + b - c, pa = p > a ? (p - a) : (a - p), pb = p > b ? (p - b) : (b - p), pc = p > c ? (p - c) : (c - p);
-            return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
-        }
     };
 
     // ---------------------------------------------------------
-    png decoder; decoder.decode(out_image, in_png, in_size, convert_to_rgba32);
+    png decoder; decoder.decode(out_image, in_png, in_size, convert_to_rgba32, inflate == ::png::TABLE_INFLATE);
     image_width = decoder.info.width; image_height = decoder.info.height;
     return decoder.error;
 }
 
-/* Helper function for opening .png file, originally included with picopng*/
-void load_file(std::vector<unsigned char>& buffer, const std::string& filename) //designed for loading files from hard disk in an std::vector
-{
-    std::ifstream file(filename.c_str(), std::ios::in|std::ios::binary|std::ios::ate);
-    
-    //get filesize
-    std::streamsize size = 0;
-    if(file.seekg(0, std::ios::end).good()) size = file.tellg();
-    if(file.seekg(0, std::ios::beg).good()) size -= file.tellg();
-    
-    //read contents of the file into the vector
-    if(size > 0)
-    {
-        buffer.resize((size_t)size);
-        file.read((char*)(&buffer[0]), size);
+/*! Reads the scanlines of a png one at a time, inflating only as much of the
+ image data as is needed for the next scanline.
+
+ Only non-interlaced 8b and 16b greyscale images (i.e., mammograms) are
+ supported; open() returns false for anything else, and the caller should
+ fall back to decode_png.
+ */
+class scanline_reader {
+public:
+    //! Constructor.
+    scanline_reader() : _width(0), _height(0), _bpp(0), _first(true) {
+    }
+
+    //! Parse the header and chunks of the png in in; returns false if the format isn't supported.
+    bool open(const unsigned char* in, std::size_t size) {
+        if(size < 29) { error(27); } // smaller than the header
+        if(in[0] != 137 || in[1] != 80 || in[2] != 78 || in[3] != 71 || in[4] != 13 || in[5] != 10 || in[6] != 26 || in[7] != 10) { error(28); }
+        if(in[12] != 'I' || in[13] != 'H' || in[14] != 'D' || in[15] != 'R') { error(29); }
+        _width = read32(&in[16]);
+        _height = read32(&in[20]);
+        unsigned int depth=in[24], color=in[25];
+        if(in[26] != 0) { error(32); }
+        if(in[27] != 0) { error(33); }
+        if((color != 0) || ((depth != 8) && (depth != 16)) || (in[28] != 0)) {
+            return false;
+        }
+        _bpp = depth / 8;
+
+        // hand the IDAT chunks to the inflater, in place:
+        bool iend=false;
+        for(std::size_t pos=33; !iend; ) {
+            if((pos + 8) >= size) { error(30); }
+            std::size_t length = read32(&in[pos]);
+            pos += 4;
+            if(length > 2147483647) { error(63); }
+            if((pos + length) >= size) { error(35); }
+            const unsigned char* type = &in[pos];
+            pos += 4;
+            if(type[0] == 'I' && type[1] == 'D' && type[2] == 'A' && type[3] == 'T') {
+                _zlib.add_input(&in[pos], length);
+            } else if(type[0] == 'I' && type[1] == 'E' && type[2] == 'N' && type[3] == 'D') {
+                iend = true;
+            } else if(!(type[0] & 32) && !(type[0] == 'P' && type[1] == 'L' && type[2] == 'T' && type[3] == 'E')) {
+                error(69); // unknown critical chunk
+            }
+            pos += length + 4; // data and crc
+        }
+
+        _line.resize(1 + _width*_bpp);
+        _cur.resize(_width*_bpp);
+        _prev.resize(_width*_bpp);
+        return true;
+    }
+
+    //! Returns the width of the image.
+    unsigned long width() const { return _width; }
+
+    //! Returns the height of the image.
+    unsigned long height() const { return _height; }
+
+    //! Returns the number of bytes per pixel.
+    unsigned int bpp() const { return _bpp; }
+
+    //! Unfilter the next scanline into pixels.
+    void next(uint16_t* pixels) {
+        int e = _zlib.read(&_line[0], _line.size());
+        if(e) { error(e); }
+        e = unfilter_scanline(&_cur[0], &_line[1], _first ? 0 : &_prev[0], _bpp, _line[0], _cur.size());
+        if(e) { error(e); }
+        _first = false;
+
+        if(_bpp == 2) {
+            for(std::size_t i=0; i<_width; ++i) {
+                pixels[i] = (_cur[2*i] << 8) | _cur[2*i+1];
+            }
+        } else {
+            std::copy(_cur.begin(), _cur.end(), pixels);
+        }
+        _cur.swap(_prev);
+    }
+
+protected:
+    //! Throw a decode error.
+    void error(int e) {
+        throw std::runtime_error("png.cpp: decode error " + boost::lexical_cast<std::string>(e));
+    }
+
+    //! Read a 32b big-endian integer.
+    static unsigned long read32(const unsigned char* b) {
+        return (static_cast<unsigned long>(b[0]) << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+    }
+
+    unsigned long _width; //!< Width of the image.
+    unsigned long _height; //!< Height of the image.
+    unsigned int _bpp; //!< Bytes per pixel.
+    bool _first; //!< True until the first scanline has been read.
+    inflater _zlib; //!< Inflater for the IDAT chunks.
+    std::vector<unsigned char> _line; //!< Filter type + filtered scanline.
+    std::vector<unsigned char> _cur; //!< Current (unfiltered) scanline.
+    std::vector<unsigned char> _prev; //!< Previous (unfiltered) scanline.
+};
+
+/*! Row-at-a-time downscaling (see png::downscale_type).
+
+ Each output pixel is the filtered average of a dfact x dfact window of input
+ pixels.  Output rows' windows never overlap, so input rows can be pushed one
+ at a time in order and only a single row of accumulators is needed.  A
+ downscaler can also be restricted to a band of output rows, so that bands
+ can be computed concurrently (see downscale_bands).
+
+ In REFERENCE_DOWNSCALE mode, accumulation order matches the original
+ per-pixel loops exactly (including truncating the accumulator to an int
+ after every tap).  SEPARABLE_DOWNSCALE applies the same triangle filter as
+ a row pass followed by a column pass over each row's partial sums, in
+ floating point, and BOX_DOWNSCALE sums windows with integer adds only; the
+ inner loops of both are simple enough for the compiler to vectorize.
+ */
+class row_downscaler {
+public:
+    //! Constructor.
+    row_downscaler(unsigned long width, unsigned long height, std::size_t dfact, png::downscale_type type=png::REFERENCE_DOWNSCALE)
+    : _dfact(dfact), _type(type), _k(0), orig_min(99999999), orig_max(-1), new_min(99999999), new_max(-1) {
+        _nx = width / dfact;
+        _ny = height / dfact;
+        _last = _ny;
+        int stridex = width / _nx;
+        int stridey = height / _ny;
+        int startx = stridex / 2;
+        int starty = stridey / 2;
+
+        // Construct a tringular approximation of the sinc filter using
+        // poor-man's convolution.
+        float halfp = (float)(dfact+2) / 2.0;
+        float slope = 1.0/halfp;
+        _f1.resize(dfact);
+        for (int x = 0; x < (int)dfact; x++) {
+            if ((x+1) <= halfp) _f1[x] = slope * (x+1);
+            else _f1[x] = slope * (halfp - (x+1) + halfp);
+        }
+        if(_type == png::REFERENCE_DOWNSCALE) {
+            _filt.resize(dfact*dfact);
+            for (int y = 0; y < (int)dfact; y++) {
+                for (int x = 0; x < (int)dfact; x++) {
+                    _filt[(y*dfact)+x] = _f1[x] * _f1[y];
+                }
+            }
+        }
+
+        // windows, clipped to the image:
+        window(_nx, startx, stridex, width, _xs, _xe);
+        window(_ny, starty, stridey, height, _ys, _ye);
+        _acc.resize(_nx);
+        _facc.resize(_nx);
+        _uacc.resize(_nx);
+        // contiguous spans of columns covered by the windows; a single span
+        // when the windows tile the row, which lets the column pass vectorize:
+        for(std::size_t i=0; i<_nx; ++i) {
+            if(!_se.empty() && (_se.back() == _xs[i])) {
+                _se.back() = _xe[i];
+            } else {
+                _ss.push_back(_xs[i]);
+                _se.push_back(_xe[i]);
+            }
+        }
+        if(_type == png::SEPARABLE_DOWNSCALE) {
+            _fcol.resize(width, 0.0f);
+        } else if(_type == png::BOX_DOWNSCALE) {
+            _ucol.resize(width, 0);
+        }
+    }
+
+    //! Returns the width of the output image.
+    unsigned long width() const { return _nx; }
+
+    //! Returns the height of the output image.
+    unsigned long height() const { return _ny; }
+
+    //! Restrict this downscaler to output rows [first, last).
+    void rows(std::size_t first, std::size_t last) {
+        _k = first;
+        _last = std::min(last, static_cast<std::size_t>(_ny));
+    }
+
+    //! Returns the first input row needed by this downscaler.
+    std::size_t first_input_row() const { return done() ? 0 : _ys[_k]; }
+
+    //! Returns the index of the next output row.
+    std::size_t row() const { return _k; }
+
+    //! Returns true when all output rows have been produced.
+    bool done() const { return _k >= _last; }
+
+    /*! Push input row y; returns true (and fills out with the output row) if
+     y completes an output row.
+     */
+    bool push(std::size_t y, const uint16_t* row, uint16_t* out) {
+        if(done() || ((int)y < _ys[_k])) {
+            return false;
+        }
+        std::size_t fy = y - _ys[_k];
+        switch(_type) {
+            case png::SEPARABLE_DOWNSCALE: push_separable(row, _f1[fy]); break;
+            case png::BOX_DOWNSCALE: push_box(row); break;
+            default: push_reference(row, &_filt[fy * _dfact]); break;
+        }
+        if((int)(y+1) < _ye[_k]) {
+            return false;
+        }
+
+        if(_type == png::SEPARABLE_DOWNSCALE) {
+            finish_separable();
+        } else if(_type == png::BOX_DOWNSCALE) {
+            finish_box();
+        }
+        for(std::size_t i=0; i<_nx; ++i) {
+            int pixcnt = (_xe[i] - _xs[i]) * (_ye[_k] - _ys[_k]);
+            switch(_type) {
+                case png::SEPARABLE_DOWNSCALE: out[i] = roundf(_facc[i]/(float)pixcnt); _facc[i] = 0.0f; break;
+                case png::BOX_DOWNSCALE: out[i] = (_uacc[i] + pixcnt/2) / pixcnt; _uacc[i] = 0; break;
+                default: out[i] = roundf((float)_acc[i]/(float)pixcnt); _acc[i] = 0; break;
+            }
+            if (out[i] < new_min) new_min = out[i];
+            if (out[i] > new_max) new_max = out[i];
+        }
+        ++_k;
+        return true;
+    }
+
+    //! Merge the pixel ranges seen by another downscaler (e.g., for another band) into this one.
+    void merge(const row_downscaler& o) {
+        orig_min = std::min(orig_min, o.orig_min);
+        orig_max = std::max(orig_max, o.orig_max);
+        new_min = std::min(new_min, o.new_min);
+        new_max = std::max(new_max, o.new_max);
+    }
+
+    /*! Averaging tends to compress the histogram, so stretch it back out;
+     valid once all rows have been pushed.
+     */
+    uint16_t stretch(uint16_t p) const {
+        float hfact = (float)(orig_max - orig_min) / (float)(new_max - new_min + 1.0);
+        return ((p - new_min) * hfact) + orig_min;
+    }
+
+protected:
+    //! Calculate the clipped [start,end) of n windows.
+    void window(unsigned long n, int start, int stride, unsigned long limit, std::vector<int>& s, std::vector<int>& e) {
+        s.resize(n);
+        e.resize(n);
+        for(unsigned long i=0; i<n; ++i) {
+            s[i] = start + i*stride - (_dfact/2);
+            e[i] = s[i] + _dfact;
+            if (s[i] < 0) s[i] = 0;
+            if (e[i] > (int)limit) e[i] = limit;
+        }
+    }
+
+    //! Track the range of the input pixels in [first, last).
+    void range(const uint16_t* first, const uint16_t* last) {
+        uint16_t lo=std::numeric_limits<uint16_t>::max(), hi=0;
+        for( ; first != last; ++first) {
+            lo = std::min(lo, *first);
+            hi = std::max(hi, *first);
+        }
+        if (lo < orig_min) orig_min = lo;
+        if (hi > orig_max) orig_max = hi;
+    }
+
+    //! Accumulate row with the 2D filter weights f, one tap at a time.
+    void push_reference(const uint16_t* row, const float* f) {
+        for(std::size_t i=0; i<_nx; ++i) {
+            int pixsum = _acc[i];
+            for(int wx=_xs[i]; wx<_xe[i]; ++wx) {
+                if (row[wx] < orig_min) orig_min = row[wx];
+                if (row[wx] > orig_max) orig_max = row[wx];
+                pixsum += row[wx] * f[wx - _xs[i]];
+            }
+            _acc[i] = pixsum;
+        }
+    }
+
+    //! Column pass: accumulate row, weighted by fy, into the column sums.
+    void push_separable(const uint16_t* row, float fy) {
+        float* c = &_fcol[0];
+        for(std::size_t i=0; i<_ss.size(); ++i) {
+            range(row + _ss[i], row + _se[i]);
+            for(int x=_ss[i]; x<_se[i]; ++x) {
+                c[x] += fy * row[x];
+            }
+        }
+    }
+
+    //! Row pass: filter the column sums of each window into _facc, and reset them.
+    void finish_separable() {
+        for(std::size_t i=0; i<_nx; ++i) {
+            float h=0.0f;
+            for(int x=_xs[i]; x<_xe[i]; ++x) {
+                h += _f1[x - _xs[i]] * _fcol[x];
+            }
+            _facc[i] = h;
+        }
+        std::fill(_fcol.begin(), _fcol.end(), 0.0f);
+    }
+
+    //! Column pass: accumulate row into the (unweighted) column sums.
+    void push_box(const uint16_t* row) {
+        uint32_t* c = &_ucol[0];
+        for(std::size_t i=0; i<_ss.size(); ++i) {
+            range(row + _ss[i], row + _se[i]);
+            for(int x=_ss[i]; x<_se[i]; ++x) {
+                c[x] += row[x];
+            }
+        }
+    }
+
+    //! Row pass: sum the column sums of each window into _uacc, and reset them.
+    void finish_box() {
+        for(std::size_t i=0; i<_nx; ++i) {
+            uint32_t h=0;
+            for(int x=_xs[i]; x<_xe[i]; ++x) {
+                h += _ucol[x];
+            }
+            _uacc[i] = h;
+        }
+        std::fill(_ucol.begin(), _ucol.end(), 0);
+    }
+
+    std::size_t _dfact; //!< Downscale factor.
+    png::downscale_type _type; //!< Filter.
+    unsigned long _nx; //!< Output width.
+    unsigned long _ny; //!< Output height.
+    unsigned long _k; //!< Next output row.
+    unsigned long _last; //!< Output row after the last one to be produced.
+    std::vector<float> _f1; //!< 1D filter weights.
+    std::vector<float> _filt; //!< 2D filter weights (reference mode).
+    std::vector<int> _xs, _xe, _ys, _ye; //!< Window bounds.
+    std::vector<int> _acc; //!< Accumulators for the current output row (reference mode).
+    std::vector<float> _facc; //!< Accumulators for the current output row (separable mode).
+    std::vector<uint32_t> _uacc; //!< Accumulators for the current output row (box mode).
+    std::vector<int> _ss, _se; //!< Contiguous spans of columns covered by the windows.
+    std::vector<float> _fcol; //!< Weighted column sums for the current output row (separable mode).
+    std::vector<uint32_t> _ucol; //!< Column sums for the current output row (box mode).
+
+public:
+    int orig_min; //!< Smallest input pixel seen.
+    int orig_max; //!< Largest input pixel seen.
+    int new_min; //!< Smallest output pixel.
+    int new_max; //!< Largest output pixel.
+};
+
+/*! Downscale the width x height image in into out (resized to fit), by
+ splitting the output rows into nthreads bands that are computed
+ concurrently, and then stretching the result; returns the output size in
+ nx and ny.
+ */
+static void downscale_bands(const png::pixel_vector_type& in, unsigned long width, unsigned long height,
+                            std::size_t dfact, png::downscale_type type, unsigned int nthreads,
+                            png::pixel_vector_type& out, unsigned long& nx, unsigned long& ny) {
+    std::vector<row_downscaler> bands(std::max(1u, nthreads), row_downscaler(width, height, dfact, type));
+    nx = bands[0].width();
+    ny = bands[0].height();
+    out.resize(nx*ny);
+    std::size_t per = (ny + bands.size() - 1) / bands.size();
+    for(std::size_t b=0; b<bands.size(); ++b) {
+        bands[b].rows(b*per, (b+1)*per);
+    }
+
+    struct band {
+        static void run(row_downscaler* ds, const png::pixel_vector_type* in, unsigned long width, png::pixel_vector_type* out) {
+            for(std::size_t y=ds->first_input_row(); !ds->done(); ++y) {
+                uint16_t* o = &(*out)[ds->row() * ds->width()];
+                ds->push(y, &(*in)[y*width], o);
+            }
+        }
+    };
+    if(bands.size() == 1) {
+        band::run(&bands[0], &in, width, &out);
+    } else {
+        boost::thread_group workers;
+        for(std::size_t b=0; b<bands.size(); ++b) {
+            workers.add_thread(new boost::thread(&band::run, &bands[b], &in, width, &out));
+        }
+        workers.join_all();
+    }
+
+    for(std::size_t b=1; b<bands.size(); ++b) {
+        bands[0].merge(bands[b]);
+    }
+    for(std::size_t i=0; i<out.size(); ++i) {
+        out[i] = bands[0].stretch(out[i]);
     }
-    else buffer.clear();
-    file.close();
 }
 
+/*! Accumulates the sums needed for the intensity-weighted centroid.
+ */
+struct centroid_accumulator {
+    //! Constructor.
+    centroid_accumulator(unsigned long width)
+    : _width(width), x(0), y(0), pixcnt(0) {
+    }
+
+    //! Accumulate pixel i, which has value p.
+    void operator()(png::value_type p, std::size_t i) {
+        float pv = p;
+        x += static_cast<double>(pv)/65535.0 * (i%_width);
+        y += static_cast<double>(pv)/65535.0 * (i/_width);
+        pixcnt++;
+    }
+
+    //! Returns the centroid.
+    png::centroid_type centroid() const {
+        //_centroid = std::make_pair(x/_pixels.size(), y/_pixels.size());
+        return std::make_pair(round(x/pixcnt), round(y/pixcnt));
+    }
+
+    unsigned long _width;
+    double x, y;
+    unsigned int pixcnt;
+};
+
 /* Constructor for png class. Opens and loads specified file and stores pixel
  values, width, and height in new png object. Based on main() function from
  picopng. File must be a 16-bit greyscale png image.
  */
-png::png(const std::string& filename, bool weighted, value_type threshold,unsigned int downscale_fact) : _threshold(threshold), _centroid(0.0, 0.0) {
+png::png(const std::string& filename, bool weighted, value_type threshold,unsigned int downscale_fact) {
+    options opts;
+    opts.weighted = weighted;
+    opts.threshold = threshold;
+    opts.downscale_fact = downscale_fact;
+    load(filename, opts);
+}
+
+/* Constructor for png class; as above, with load options.
+ */
+png::png(const std::string& filename, const options& opts) {
+    load(filename, opts);
+    if(opts.crop) {
+        crop();
+    }
+    if(opts.integral) {
+        _integral.build(*this, _width, _height);
+    }
+    for(const png* p=this; (levels() < opts.pyramid_levels) && ((p->_width > 1) || (p->_height > 1)); p=_pyramid.back().get()) {
+        _pyramid.push_back(boost::shared_ptr<png>(new png(p->halve())));
+    }
+    layout(opts.layout);
+    for(std::size_t k=0; k<_pyramid.size(); ++k) {
+        _pyramid[k]->layout(opts.layout);
+    }
+}
+
+png::png() : _bpp(0), _width(0), _height(0), _threshold(0), _layout(ROW_MAJOR_LAYOUT), _tiles(0),
+_full_width(0), _full_height(0), _origin(0, 0), _centroid(0.0, 0.0) {
+}
+
+/* Opens and loads the specified file, and then downscales, thresholds, and
+ calculates the centroid according to opts.
+ */
+void png::load(const std::string& filename, const options& opts) {
+    bool weighted = opts.weighted;
+    _threshold = opts.threshold;
+    _centroid = centroid_type(0.0, 0.0);
     _bpp = 0;
-    std::vector<unsigned char> buffer;
-    load_file(buffer, filename);
-    if(buffer.empty()) {
-        throw std::runtime_error("png.cpp: could not load data from " + filename);
+    _layout = ROW_MAJOR_LAYOUT;
+    _tiles = 0;
+
+    // the png is decoded straight from the mapped file; the mapping is released on return:
+    mapped_file file(filename);
+
+    _origin = origin_type(0, 0);
+    if(opts.streaming && stream(file.data(), file.size(), opts)) {
+        _full_width = _width;
+        _full_height = _height;
+        return;
     }
+
     std::vector<unsigned char> pixels8b;
     
-    int error = decode_png(pixels8b, _width, _height, &buffer[0], (unsigned long)buffer.size(), false);
+    int error = decode_png(pixels8b, _width, _height, file.data(), file.size(), false, opts.inflate);
     if (error) {
         throw std::runtime_error("png.cpp: decode error " + boost::lexical_cast<std::string>(error));
     }
@@ -666,65 +1087,119 @@ png::png(const std::string& filename, bool weighted, value_type threshold,unsign
     
     assert(_pixels.size() == (_width*_height));
 
-    downscale(downscale_fact,true);
-
-    // If the threshold was not specified then calculate the
-    // threshold based on a histogram analysis heuristic.
-    if ((_threshold <= 0)&&(!weighted)) { 
-      int totcnt = 0;
-      histogram_vector_type histo(65536,0.0);
-      for (std::size_t i=0; i<_pixels.size(); i++) {
-        int idx = _pixels[i];
-        histo[idx] += 1.0;
-        totcnt++;
-      }
+    downscale(opts.downscale_fact, opts.downscale, opts.threads);
 
-      for (std::size_t i=0; i < histo.size(); i++) {
-        histo[i] = histo[i] / totcnt;
-      }
- 
-      // Find threshold
-      int threshpos = 0;
-      double sum = 0.0;
-      int minpart = histo.size() * 0.15;
-      for (int i = (int)histo.size()-1; i >= minpart; i--) {
-        sum += histo[i];
-        threshpos = i;
-        if (sum > 0.4) break;
-      }
+    // calculate the centroid and threshold the pixels:
+    if(weighted) {
+        centroid_accumulator ca(_width);
+        for(std::size_t i=0; i<_pixels.size(); i++) {
+            ca(_pixels[i], i);
+        }
+        _centroid = ca.centroid();
+    } else {
+        // a single pass over the pixels gives both the threshold (if it
+        // wasn't specified) and the centroid:
+        histogram h;
+        h.add(&_pixels[0], _width, _height, opts.threads);
+        threshold(h, opts);
+    }
+    _full_width = _width;
+    _full_height = _height;
+}
 
-      _threshold = threshpos; 
+/* Streaming form of load: scanlines are decoded one at a time and pushed
+ through downscaling and into the histogram (or, if weighted, the centroid) as
+ they arrive, so only the output image and a few rows are ever held in memory.
+ Besides pixel counts, the histogram keeps the sums of the positions of the
+ pixels at each value, so once all rows are in, threshold() can pick the
+ threshold and compute the centroid from the histogram alone, and then
+ threshold the output in a single pass (the same whether or not the threshold
+ was specified).
+ Returns false if the image format isn't supported by scanline_reader.
+ */
+bool png::stream(const unsigned char* data, std::size_t size, const options& opts) {
+    scanline_reader reader;
+    if(!reader.open(data, size)) {
+        return false;
     }
+    _width = reader.width();
+    _height = reader.height();
+    _bpp = reader.bpp();
 
-    // std::cout << filename << std::endl; 
-    // std::cout << "Threshold: " << _threshold << " " << threshpos << " " << sum << std::endl;
+    // rows are added to the histogram (or weighted centroid) as soon as
+    // they're final, while they're still in cache:
+    bool weighted = opts.weighted;
+    histogram h;
+    if(opts.downscale_fact > 1) {
+        row_downscaler ds(_width, _height, opts.downscale_fact, opts.downscale);
+        _pixels.resize(ds.width() * ds.height());
+        pixel_vector_type row(_width);
+        for(std::size_t y=0, k=0; !ds.done(); ++y) {
+            reader.next(&row[0]);
+            if(ds.push(y, &row[0], &_pixels[k*ds.width()])) {
+                ++k;
+            }
+        }
+        _width = ds.width();
+        _height = ds.height();
 
-    // calculate the centroid and threshold the pixels:
-    double x = 0;
-    double y = 0;
-    unsigned int pixcnt = 0;
-    for(std::size_t i=0; i<_pixels.size(); i++) {
-        float pv = _pixels[i];
-
-        if (weighted) {
-          x += static_cast<double>(pv)/65535.0 * (i%_width);
-          y += static_cast<double>(pv)/65535.0 * (i/_width);
-          pixcnt++;
-        } else {
-          if (pv < _threshold) { 
-            // ||(_pixels[i] >= 65534)) {
-            _pixels[i] = 0;
-          } else {
-            _pixels[i] = std::numeric_limits<value_type>::max();
-            x += i%_width;
-            y += i/_width;
-            pixcnt++;
-          }
+        // stretching needs the range of all output pixels, so it takes a
+        // second pass over the (downscaled) output:
+        centroid_accumulator ca(_width);
+        for(std::size_t y=0; y<_height; ++y) {
+            value_type* row = &_pixels[y*_width];
+            for(std::size_t j=0; j<_width; ++j) {
+                row[j] = ds.stretch(row[j]);
+            }
+            if(weighted) {
+                for(std::size_t j=0; j<_width; ++j) {
+                    ca(row[j], y*_width + j);
+                }
+            } else {
+                h.add_row(row, _width, y);
+            }
         }
+        _centroid = ca.centroid();
+    } else {
+        _pixels.resize(_width * _height);
+        centroid_accumulator ca(_width);
+        for(std::size_t y=0; y<_height; ++y) {
+            value_type* row = &_pixels[y*_width];
+            reader.next(row);
+            if(weighted) {
+                for(std::size_t j=0; j<_width; ++j) {
+                    ca(row[j], y*_width + j);
+                }
+            } else {
+                h.add_row(row, _width, y);
+            }
+        }
+        _centroid = ca.centroid();
     }
 
-    //_centroid = std::make_pair(x/_pixels.size(), y/_pixels.size());
-    _centroid = std::make_pair(round(x/pixcnt), round(y/pixcnt));
+    if(!weighted) {
+        threshold(h, opts);
+    }
+    return true;
+}
+
+/* Calculates the threshold (unless it was specified) and the centroid from
+ the histogram of the pixels, and then thresholds them.
+ */
+void png::threshold(const histogram& h, const options& opts) {
+    if(_threshold <= 0) {
+        switch(opts.thresholding) {
+            case OTSU_THRESHOLD: _threshold = otsu_threshold(h); break;
+            default: _threshold = tail_threshold(h); break;
+        }
+    }
+    _centroid = h.centroid(_threshold);
+
+    const value_type t=_threshold;
+    value_type* p=&_pixels[0];
+    for(std::size_t i=0; i<_pixels.size(); ++i) {
+        p[i] = (p[i] < t) ? 0 : std::numeric_limits<value_type>::max();
+    }
 }
 
 unsigned long png::width() const {
@@ -737,7 +1212,7 @@ unsigned long png::height() const {
 
 //! Returns the size of this image, in pixels.
 unsigned long png::size() const {
-    return _pixels.size();
+    return _width * _height;
 }
 
 unsigned long png::size1() const {
@@ -754,19 +1229,107 @@ png::centroid_type& png::get_centroid() {
     return _centroid;
 }
 
+const png::centroid_type& png::get_centroid() const {
+    return _centroid;
+}
+
 png::value_type& png::operator[](std::size_t n) {
-    assert(n < _pixels.size());
-    return _pixels[n];
+    assert(n < size());
+    return (_layout == ROW_MAJOR_LAYOUT) ? _pixels[n] : _pixels[offset(n / _width, n % _width)];
 }
 
 const png::value_type& png::operator[](std::size_t n) const {
-    assert(n < _pixels.size());
-    return _pixels[n];
+    assert(n < size());
+    return (_layout == ROW_MAJOR_LAYOUT) ? _pixels[n] : _pixels[offset(n / _width, n % _width)];
+}
+
+/* Reorders the pixels into layout l; tiled layouts are padded with 0s to a
+ whole number of tiles.
+ */
+void png::layout(layout_type l) {
+    if(l == _layout) {
+        return;
+    }
+    pixel_vector_type rm(size());
+    for(std::size_t i=0; i<_height; ++i) {
+        for(std::size_t j=0; j<_width; ++j) {
+            rm[i*_width + j] = _pixels[offset(i, j)];
+        }
+    }
+
+    _layout = l;
+    if(_layout == ROW_MAJOR_LAYOUT) {
+        _tiles = 0;
+        _pixels.swap(rm);
+        return;
+    }
+    std::size_t t = (_layout == TILED_LAYOUT) ? 8 : 16;
+    _tiles = (_width + t - 1) / t;
+    _pixels.assign(_tiles * ((_height + t - 1) / t) * t * t, 0);
+    for(std::size_t i=0; i<_height; ++i) {
+        for(std::size_t j=0; j<_width; ++j) {
+            _pixels[offset(i, j)] = rm[i*_width + j];
+        }
+    }
+}
+
+void png::crop() {
+    // bounding box [x0,x1) x [y0,y1) of the non-zero pixels:
+    std::size_t x0=_width, x1=0, y0=_height, y1=0;
+    for(std::size_t y=0; y<_height; ++y) {
+        for(std::size_t x=0; x<_width; ++x) {
+            if((*this)(y, x)) {
+                x0 = std::min(x0, x);
+                x1 = std::max(x1, x+1);
+                y0 = std::min(y0, y);
+                y1 = y+1;
+            }
+        }
+    }
+    if((x0 >= x1) || ((x1-x0) == _width && (y1-y0) == _height)) {
+        return;
+    }
+
+    pixel_vector_type newpix((x1-x0) * (y1-y0));
+    for(std::size_t y=y0; y<y1; ++y) {
+        for(std::size_t x=x0; x<x1; ++x) {
+            newpix[(y-y0)*(x1-x0) + (x-x0)] = (*this)(y, x);
+        }
+    }
+    layout_type l=_layout;
+    _layout = ROW_MAJOR_LAYOUT;
+    _tiles = 0;
+    _pixels.swap(newpix);
+    _width = x1-x0;
+    _height = y1-y0;
+    _origin = origin_type(_origin.first + x0, _origin.second + y0);
+    _centroid = centroid_type(_centroid.first - x0, _centroid.second - y0);
+    layout(l);
 }
 
 void png::downscale(std::size_t dfact,bool use_filter) {
+    downscale(dfact, use_filter ? REFERENCE_DOWNSCALE : SUBSAMPLE_DOWNSCALE);
+}
+
+void png::downscale(std::size_t dfact, downscale_type type, unsigned int nthreads) {
     if (dfact <= 1) return;
 
+    // downscaling works on row-major pixels:
+    if (_layout != ROW_MAJOR_LAYOUT) {
+      layout_type l = _layout;
+      layout(ROW_MAJOR_LAYOUT);
+      downscale(dfact, type, nthreads);
+      layout(l);
+      return;
+    }
+
+    if (type != SUBSAMPLE_DOWNSCALE) {
+      pixel_vector_type newpix;
+      downscale_bands(_pixels, _width, _height, dfact, type, nthreads, newpix, _width, _height);
+      _pixels.swap(newpix);
+      return;
+    }
+
     int nx = _width / dfact;
     int ny = _height / dfact;
     int stridex = _width / nx;
@@ -775,85 +1338,43 @@ void png::downscale(std::size_t dfact,bool use_filter) {
     int starty = stridey / 2; 
     int endx = stridex * (nx-1) + startx;
     int endy = stridey * (ny-1) + starty;
-    std::vector<float> filt(dfact*dfact);
-
-    // Construct a tringular approximation of the sinc filter using
-    // poor-man's convolution.
-    if (use_filter) {
-      float halfp = (float)(dfact+2) / 2.0; 
-      float slope = 1.0/halfp; 
-      for (int y = 0; y < (int)dfact; y++) {
-        for (int x = 0; x < (int)dfact; x++) {
-          if ((x+1) <= halfp) filt[(y*dfact)+x] = slope * (x+1);
-          else filt[(y*dfact)+x] = slope * (halfp - (x+1) + halfp);
-          if ((y+1) <= halfp) filt[(y*dfact)+x] *= slope * (y+1);
-          else filt[(y*dfact)+x] *= slope * (halfp - (y+1) + halfp);
-        }
-      }
-    }
 
     pixel_vector_type newpix(nx*ny);
-    newpix.reserve(nx*ny);
-
-    int orig_min = 99999999;
-    int orig_max = -1;
-    int new_min = 99999999;
-    int new_max = -1;
     int newxy = 0;
     for (int y = starty; y <= endy; y+=stridey) {
       for (int x = startx; x <= endx; x+=stridex) {
-         if (use_filter) {
-           int xs = x - (dfact/2);
-           int ys = y - (dfact/2);
-           int xe = xs + dfact;
-           int ye = ys + dfact;
-           if (xs < 0) xs = 0;
-           if (ys < 0) ys = 0;
-           if (xe > (int)_width) xe = _width;
-           if (ye > (int)_height) ye = _height;
-  
-           int pixcnt = 0; 
-           int pixsum = 0;
-           for (int wy = ys; wy < ye; wy++) {
-             for (int wx = xs; wx < xe; wx++) {
-               int xy = (wy * _width) + wx;
-               if (_pixels[xy] < orig_min) orig_min = _pixels[xy];
-               if (_pixels[xy] > orig_max) orig_max = _pixels[xy];
-               float fval = filt[((wy-ys)*dfact)+(wx-xs)];
-               pixsum += _pixels[xy] * fval;           
-               pixcnt++;
-             }
-           } 
-  
-           newpix[newxy] = roundf((float)pixsum/(float)pixcnt); 
-           if (newpix[newxy] < new_min) new_min = newpix[newxy];
-           if (newpix[newxy] > new_max) new_max = newpix[newxy];
-         } else {
-           newpix[newxy] = _pixels[(y * _width)+x];
-         }
-
+         newpix[newxy] = _pixels[(y * _width)+x];
          newxy++;
       }
-   }
-
-   // Averaging tends to compress the histogram so stretch it back out
-   // and copy the pixels back.
-   _pixels.clear();
-   _pixels.reserve(newpix.size());
-   _pixels.resize(newpix.size());
-   if (use_filter) {
-     float hfact = (float)(orig_max - orig_min) / (float)(new_max - new_min + 1.0);
-     for (int i = 0; i < (int)newpix.size(); i++) {
-       _pixels[i] = ((newpix[i] - new_min) * hfact) + orig_min;  
-     }
-   } else {
-     for (int i = 0; i < (int)newpix.size(); i++) {
-       _pixels[i] = newpix[i];
-     }
-   }
-
-   _width = nx;
-   _height = ny;
+    }
+
+    _pixels.swap(newpix);
+    _width = nx;
+    _height = ny;
+}
+
+png png::halve() const {
+    png h;
+    h._bpp = _bpp;
+    h._threshold = _threshold;
+    h._width = (_width + 1) / 2;
+    h._height = (_height + 1) / 2;
+    h._centroid = std::make_pair(_centroid.first / 2.0, _centroid.second / 2.0);
+    h._full_width = (_full_width + 1) / 2;
+    h._full_height = (_full_height + 1) / 2;
+    h._origin = origin_type(_origin.first / 2, _origin.second / 2);
+    h._pixels.resize(h._width * h._height);
+    for(std::size_t y=0; y<h._height; ++y) {
+        std::size_t y0=2*y, y1=std::min(2*y+1, static_cast<std::size_t>(_height-1));
+        for(std::size_t x=0; x<h._width; ++x) {
+            std::size_t x0=2*x, x1=std::min(2*x+1, static_cast<std::size_t>(_width-1));
+            // blocks at odd edges are clamped, i.e., edge pixels are counted twice:
+            uint32_t s = _pixels[offset(y0, x0)] + _pixels[offset(y0, x1)]
+            + _pixels[offset(y1, x0)] + _pixels[offset(y1, x1)];
+            h._pixels[y*h._width + x] = (s + 2) / 4;
+        }
+    }
+    return h;
 }
 
 /* Takes ints representing x and y coordinates of a pixel and returns
@@ -865,42 +1386,51 @@ double png::distance_to_centroid(std::size_t x, std::size_t y) {
     return sqrt(pow((x - _centroid.first), 2) + pow((y - _centroid.second), 2));
 }
 
-/* Write the image as a text pgm file to the specified file 
+/* Write the image as a pgm file to the specified file.
 */
-bool png::write_pgm(const std::string& outfilename) {
+bool png::write_pgm(const std::string& outfilename, bool binary) const {
   // Compute the pgm max value
   unsigned long maxval = pow(2,_bpp*8) - 1;
-  unsigned int crosssiz = 10;
-  unsigned int cx = _centroid.first; 
-  unsigned int cy = _centroid.second; 
+  int crosssiz = 10;
+  int cx = _centroid.first; 
+  int cy = _centroid.second; 
   
-  std::fstream fout;
-  fout.open(outfilename.c_str(),std::fstream::out|std::fstream::trunc);
+  std::ofstream fout(outfilename.c_str(), std::ios::binary|std::ios::trunc);
+  if (!fout.is_open()) {
+    return false;
+  }
 
   // Write out the pgm with a cross indicating the centroid.
   // Note that the cross will not be added to the input image.
-  if (fout.is_open()) {
-    fout << "P2" << std::endl << "# centroid(" << _centroid.first << "," << _centroid.second << ") threshold(" << _threshold << ")" << std::endl << _width << " " << _height << std::endl << maxval << std::endl;
-
-    for (unsigned int i = 0; i < _pixels.size(); i++) {
-       unsigned int tx = i % _width;
-       unsigned int ty = i / _width;
-       if ((tx == cx)&&((ty > cy-crosssiz)&&(ty < cy+crosssiz))) {
-         if (_pixels[i] < maxval) fout << maxval << std::endl;
-         else fout << 0 << std::endl;
-       } else if ((ty == cy)&&((tx > cx-crosssiz)&&(tx < cx+crosssiz))) {
-         if (_pixels[i] < maxval) fout << maxval << std::endl;
-         else fout << 0 << std::endl;
-       } else {
-         fout << _pixels[i] << std::endl;
-       }
-    }
-
-    fout.close();
-    return true;
-  } 
+  fout << (binary ? "P5" : "P2") << "\n# centroid(" << _centroid.first << "," << _centroid.second << ") threshold(" << _threshold << ")\n" << _width << " " << _height << "\n" << maxval << "\n";
+
+  // binary rows are written a row at a time; values above maxval (e.g.,
+  // thresholded 8b images) are clamped:
+  std::vector<unsigned char> row(_width * ((maxval > 255) ? 2 : 1));
+  for (int ty = 0; ty < (int)_height; ty++) {
+    for (int tx = 0; tx < (int)_width; tx++) {
+      unsigned long p = (*this)(ty, tx);
+      if (((tx == cx)&&((ty > cy-crosssiz)&&(ty < cy+crosssiz)))
+          || ((ty == cy)&&((tx > cx-crosssiz)&&(tx < cx+crosssiz)))) {
+        p = (p < maxval) ? maxval : 0;
+      }
+      if (!binary) {
+        fout << p << '\n';
+      } else if (maxval > 255) {
+        p = std::min(p, maxval);
+        row[2*tx] = p >> 8;
+        row[2*tx+1] = p & 0xff;
+      } else {
+        row[tx] = std::min(p, maxval);
+      }
+    }
+    if (binary) {
+      fout.write(reinterpret_cast<const char*>(&row[0]), row.size());
+    }
+  }
 
-  return false;
+  fout.close();
+  return !fout.fail();
 }
 
 /* Return the bytes per pixel.
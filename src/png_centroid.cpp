@@ -23,7 +23,6 @@
 #include <iterator>
 #include <vector>
 #include <ea/mkv/markov_network_evolution.h>
-#include <ea/data_structures/sequence_matrix.h>
 #include <ea/iterators/camera.h>
 #include <ea/generational_models/moran_process.h>
 #include <ea/selection/rank.h>
@@ -34,9 +33,30 @@ using namespace ealib;
 
 #include "evocadx.h"
 #include <evocadx/db/png.h>
+#include <evocadx/db/png_loader.h>
+#include <evocadx/db/pgm_writer.h>
+#include <evocadx/db/binary_image.h>
+#include <evocadx/db/image_view.h>
+#include <evocadx/db/epoch_permutation.h>
+#include <evocadx/iterators/binary_camera.h>
+#include <evocadx/iterators/pyramid_camera.h>
 
-typedef boost::shared_ptr<png> png_ptr_type;
-typedef std::vector<png_ptr_type> image_vector_type;
+typedef boost::shared_ptr<binary_image> image_ptr_type;
+
+/*! A training case: an image, seen in one of its orientations (see
+ image_view).  Cases of the same image share it, so extra orientations
+ don't take any more memory.
+ */
+struct image_case {
+    //! Constructor.
+    image_case(image_ptr_type i=image_ptr_type(), unsigned int o=0) : image(i), orientation(o) {
+    }
+
+    image_ptr_type image; //!< Image.
+    unsigned int orientation; //!< Orientation; 0 is the image as loaded.
+};
+
+typedef std::vector<image_case> image_vector_type;
 
 
 /*! Image centroid fitness function for Markov networks.
@@ -48,37 +68,93 @@ struct centroid_fitness : fitness_function<unary_fitness<double>, constantS, sto
     void initialize(RNG& rng, EA& ea) {
         filename_vector_type filenames = find_files(get<EVOCADX_DATADIR>(ea), get<EVOCADX_FILE_REGEX>(ea));
         std::random_shuffle(filenames.begin(), filenames.end(), ea.rng());
-        int count=0;
-        for(filename_vector_type::iterator i=filenames.begin(); i!=filenames.end() && (count < get<EVOCADX_IMAGES_N>(ea)); ++i, ++count) {
-            value_type threshold = get<EVOCADX_PIXEL_THRESHOLD>(ea);
-            unsigned int downscalefact = get<EVOCADX_IMAGE_DOWNSCALE_FACTOR>(ea);
-            png_ptr_type p(new png(*i, false, threshold, downscalefact)); // not weighted, threshold == 0 (implies calculate the threshold); this turns the image into black & white.
-            _images.push_back(p);
-
-            std::string imgdir = get<EVOCADX_DUMP_IMAGES_DIR>(ea);
-            if (imgdir.length() > 0) {
-              std::string wrkstr = (*i);
-              std::string outfn = imgdir;
-              if (outfn[outfn.length()-1] != '/') outfn += "/";
-              outfn = outfn + basename((char*)(wrkstr.c_str()));
-              int pos = outfn.rfind(".png");
-              if (pos < outfn.length()) {
-                outfn.replace(pos,4,".pgm");
-              }
-
-              if (!p->write_pgm(outfn)) {
-                std::cerr << "*** ERROR: failed to dump image to " << outfn << std::endl;
+        if(filenames.size() > static_cast<std::size_t>(get<EVOCADX_IMAGES_N>(ea))) {
+            filenames.resize(get<EVOCADX_IMAGES_N>(ea));
+        }
+
+        png::options opts;
+        opts.threshold = get<EVOCADX_PIXEL_THRESHOLD>(ea); // threshold == 0 implies calculate the threshold; this turns the image into black & white.
+        opts.thresholding = get<EVOCADX_OTSU_THRESHOLD>(ea) ? png::OTSU_THRESHOLD : png::TAIL_THRESHOLD;
+        opts.downscale_fact = get<EVOCADX_IMAGE_DOWNSCALE_FACTOR>(ea);
+        opts.streaming = true;
+        opts.pyramid_levels = get<EVOCADX_PYRAMID_LEVELS>(ea);
+        opts.crop = get<EVOCADX_CROP>(ea); // fewer pixels and camera updates per image
+
+        // decode and preprocess in parallel; images stay in shuffled filename
+        // order.  thresholded images are packed into binary_images as soon as
+        // each batch is loaded, so that only a batch of 16b images is held:
+        png_loader loader(opts, get<EVOCADX_LOADER_THREADS>(ea));
+        std::size_t batch = 4 * loader.threads();
+        double total=0.0;
+        std::size_t bytes=0;
+        for(std::size_t b=0; b<filenames.size(); b+=batch) {
+            filename_vector_type names(filenames.begin()+b, filenames.begin()+std::min(filenames.size(), b+batch));
+            png_loader::image_vector_type pngs = loader.load(names);
+            for(std::size_t k=0; k<names.size(); ++k) {
+                std::cout << "loaded " << names[k] << " (" << pngs[k]->width() << "x" << pngs[k]->height()
+                << ") in " << loader.times()[k] << "s" << std::endl;
+                total += loader.times()[k];
+                dump_image(names[k], pngs[k], ea);
+                image_ptr_type img(new binary_image(*pngs[k]));
+                if(get<EVOCADX_OCCUPANCY_INDEX>(ea)) {
+                    // lets the binary and pyramid cameras skip empty background:
+                    img->build_index();
+                }
+                // one case per orientation, e.g., 2 to add mirror images:
+                for(unsigned int o=0; o<std::max(1u, get<EVOCADX_ORIENTATIONS>(ea)); ++o) {
+                    _images.push_back(image_case(img, o));
+                }
+                bytes += img->bytes();
+                pngs[k].reset();
+            }
+        }
+        if(_dumper) {
+            // as when images were dumped inline, a failed dump ends the run:
+            _dumper->flush();
+            pgm_writer::filename_vector_type failed = _dumper->failures();
+            if(!failed.empty()) {
+                std::cerr << "*** ERROR: failed to dump " << failed.size() << " image(s), e.g. to " << failed.front() << std::endl;
                 exit(-1);
-              }
-              //std::cout << outfn << std::endl;
             }
         }
+        _order.reset(_images.size(), get<EVOCADX_EPOCH_UPDATES>(ea));
+        epoch_permutation::check_walk(_images.size(), get<EVOCADX_EPOCH_UPDATES>(ea), get<EVOCADX_EXAMINE_N>(ea));
+        std::cout << "loaded " << _images.size() << " image cases with " << loader.threads() << " threads ("
+        << total << "s total load time, " << bytes << " bytes of pixel data)" << std::endl;
+    }
+
+    /*! Dump p, loaded from filename, as a pgm if EVOCADX_DUMP_IMAGES_DIR is set.
+
+     Images are written by a background thread, so that dumping doesn't hold
+     up loading; initialize() waits for them once all images are loaded, and
+     exits if any couldn't be written.
+     */
+    template <typename EA>
+    void dump_image(const std::string& filename, const png_loader::png_ptr_type& p, EA& ea) {
+        std::string imgdir = get<EVOCADX_DUMP_IMAGES_DIR>(ea);
+        if (imgdir.length() > 0) {
+          std::string wrkstr = filename;
+          std::string outfn = imgdir;
+          if (outfn[outfn.length()-1] != '/') outfn += "/";
+          outfn = outfn + basename((char*)(wrkstr.c_str()));
+          int pos = outfn.rfind(".png");
+          if (pos < outfn.length()) {
+            outfn.replace(pos,4,".pgm");
+          }
+
+          if (!_dumper) {
+            _dumper.reset(new pgm_writer());
+          }
+          _dumper->write(outfn, p);
+        }
     }
     
 	template <typename Individual, typename RNG, typename EA>
 	double operator()(Individual& ind, RNG& rng, EA& ea) {
-        typedef sequence_matrix<png> matrix_type;
-        typedef retina2_iterator<matrix_type> iterator_type;
+        // images and views are matrices themselves, so the camera reads pixels
+        // by (row, column) rather than through sequence_matrix's flat index:
+        typedef retina2_iterator<binary_image> iterator_type;
+        typedef image_view<binary_image> view_type;
 
         // get the phenotype (markov network):
         typename EA::phenotype_type &N = ealib::phenotype(ind, ea);
@@ -90,34 +166,78 @@ struct centroid_fitness : fitness_function<unary_fitness<double>, constantS, sto
         }
         
         double w=0.0; // accumulated fitness
+        epoch_permutation::view order = _order.current();
         
         // and analyze images...
         for(int i=0; i<get<EVOCADX_EXAMINE_N>(ea); ++i) {
             N.reset(seed);
             N.clear();
             
-            matrix_type M(*_images[i]);
-            iterator_type ci(M, get<EVOCADX_FOVEA_SIZE>(ea), get<EVOCADX_RETINA_SIZE>(ea));
-            
-            // move camera to ~middle of the image:
-            ci.position(M.size1()/2, M.size2()/2);
-            
-            int updates = std::max(_images[i]->width(), _images[i]->height());
-            
-            for(int j=0; j<updates; ++j) {
-                N.update(ci);
-                ci.move(algorithm::bits2ternary(N.begin_output()), algorithm::bits2ternary(N.begin_output()+2));
+            const image_case& c = _images[order[i]];
+            const binary_image& img = *c.image;
+            int updates = std::max(img.width(), img.height());
+            std::size_t x, y; // final camera position
+
+            if(c.orientation != 0) {
+                // other orientations are read through a view of the image:
+                view_type v(img, c.orientation);
+                retina2_iterator<view_type> ci(v, get<EVOCADX_FOVEA_SIZE>(ea), get<EVOCADX_RETINA_SIZE>(ea));
+                ci.position(v.size1()/2, v.size2()/2);
+                for(int j=0; j<updates; ++j) {
+                    N.update(ci);
+                    ci.move(algorithm::bits2ternary(N.begin_output()), algorithm::bits2ternary(N.begin_output()+2));
+                }
+                x = ci._j;
+                y = ci._i;
+            } else if(img.levels() > 1) {
+                // coarse-to-fine: enough updates to cross the coarsest level,
+                // plus a fovea's worth of moves to refine at each level:
+                pyramid_camera ci(img, get<EVOCADX_FOVEA_SIZE>(ea), get<EVOCADX_RETINA_SIZE>(ea));
+                ci.position(img.size1()/2, img.size2()/2);
+                updates = (updates >> (img.levels()-1)) + img.levels()*get<EVOCADX_FOVEA_SIZE>(ea);
+                for(int j=0; j<updates; ++j) {
+                    N.update(ci.begin());
+                    ci.move(algorithm::bits2ternary(N.begin_output()), algorithm::bits2ternary(N.begin_output()+2));
+                    ci.zoom(algorithm::bits2ternary(N.begin_output()+4));
+                }
+                x = ci._j;
+                y = ci._i;
+            } else if(get<EVOCADX_BINARY_CAMERA>(ea)) {
+                binary_camera ci(img, get<EVOCADX_FOVEA_SIZE>(ea), get<EVOCADX_RETINA_SIZE>(ea));
+                ci.position(img.size1()/2, img.size2()/2);
+                for(int j=0; j<updates; ++j) {
+                    N.update(ci.begin());
+                    ci.move(algorithm::bits2ternary(N.begin_output()), algorithm::bits2ternary(N.begin_output()+2));
+                }
+                x = ci._j;
+                y = ci._i;
+            } else {
+                iterator_type ci(*c.image, get<EVOCADX_FOVEA_SIZE>(ea), get<EVOCADX_RETINA_SIZE>(ea));
+                
+                // move camera to ~middle of the image:
+                ci.position(img.size1()/2, img.size2()/2);
+                
+                for(int j=0; j<updates; ++j) {
+                    N.update(ci);
+                    ci.move(algorithm::bits2ternary(N.begin_output()), algorithm::bits2ternary(N.begin_output()+2));
+                }
+                x = ci._j;
+                y = ci._i;
             }
-            double d = _images[i]->distance_to_centroid(ci._j, ci._i);
-            // normalize d by the length of the diagonal:
-            d /= sqrt(_images[i]->width()*_images[i]->width() + _images[i]->height()*_images[i]->height());
+            // the final position is in the case's orientation:
+            double d = view_type(img, c.orientation).distance_to_centroid(x, y);
+            // normalize d by the length of the diagonal (of the original
+            // image, if it was cropped):
+            d /= sqrt(img.full_width()*img.full_width() + img.full_height()*img.full_height());
             w += d;
         }
         
         return 1.0 / (w + 1.0);
     }
     
-    image_vector_type _images; //!< Vector of images loaded from disk.
+    image_vector_type _images; //!< Vector of image cases loaded from disk.
+    epoch_permutation _order; //!< Order in which image cases are visited.
+    boost::shared_ptr<pgm_writer> _dumper; //!< Background writer for dumped images.
 };
 
 // Evolutionary algorithm definition.
@@ -152,6 +272,14 @@ public:
         add_option<EVOCADX_RETINA_SIZE>(this);
         add_option<EVOCADX_PIXEL_THRESHOLD>(this);
         add_option<EVOCADX_IMAGE_DOWNSCALE_FACTOR>(this);
+        add_option<EVOCADX_LOADER_THREADS>(this);
+        add_option<EVOCADX_BINARY_CAMERA>(this);
+        add_option<EVOCADX_PYRAMID_LEVELS>(this);
+        add_option<EVOCADX_OTSU_THRESHOLD>(this);
+        add_option<EVOCADX_OCCUPANCY_INDEX>(this);
+        add_option<EVOCADX_CROP>(this);
+        add_option<EVOCADX_ORIENTATIONS>(this);
+        add_option<EVOCADX_EPOCH_UPDATES>(this);
     }
     
     virtual void gather_tools() {
@@ -165,7 +293,9 @@ public:
     
     virtual void before_initialization(EA& ea) {
         put<mkv::MKV_INPUT_N>(8*get<EVOCADX_RETINA_SIZE>(ea) + get<EVOCADX_FOVEA_SIZE>(ea)*get<EVOCADX_FOVEA_SIZE>(ea), ea);
-        put<mkv::MKV_OUTPUT_N>(4, ea);
+        // 2 outputs each for moving up/down and left/right, and 2 more for
+        // zooming when images have a mip pyramid:
+        put<mkv::MKV_OUTPUT_N>((get<EVOCADX_PYRAMID_LEVELS>(ea) > 1) ? 6 : 4, ea);
     }
 };
 LIBEA_CMDLINE_INSTANCE(ea_type, cli);
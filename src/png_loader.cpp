@@ -0,0 +1,89 @@
+/* png_loader.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 Emily L. Dolson, David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <evocadx/db/png_loader.h>
+
+png_loader::png_loader(const png::options& opts, unsigned int nthreads)
+: _opts(opts), _nthreads(nthreads), _filenames(0), _next(0) {
+    if(_nthreads == 0) {
+        _nthreads = std::max(1u, boost::thread::hardware_concurrency());
+    }
+}
+
+png_loader::image_vector_type png_loader::load(const filename_vector_type& filenames) {
+    _filenames = &filenames;
+    _next = 0;
+    _error.clear();
+    _images.assign(filenames.size(), png_ptr_type());
+    _times.assign(filenames.size(), 0.0);
+
+    // no point in starting more threads than there are images, and a
+    // single thread might as well be this one:
+    unsigned int n = std::min(static_cast<std::size_t>(_nthreads), filenames.size());
+    if(n <= 1) {
+        worker();
+    } else {
+        boost::thread_group workers;
+        for(unsigned int i=0; i<n; ++i) {
+            workers.add_thread(new boost::thread(&png_loader::worker, this));
+        }
+        workers.join_all();
+    }
+
+    _filenames = 0;
+    if(!_error.empty()) {
+        _images.clear();
+        throw std::runtime_error(_error);
+    }
+
+    image_vector_type images;
+    images.swap(_images);
+    return images;
+}
+
+void png_loader::worker() {
+    using namespace boost::posix_time;
+    for( ; ; ) {
+        std::size_t i;
+        {
+            boost::mutex::scoped_lock lock(_mutex);
+            if(!_error.empty() || (_next >= _filenames->size())) {
+                return;
+            }
+            i = _next++;
+        }
+
+        // each worker writes only to its own elements of _images and _times:
+        ptime start = microsec_clock::universal_time();
+        try {
+            _images[i].reset(new png((*_filenames)[i], _opts));
+        } catch(std::exception& e) {
+            boost::mutex::scoped_lock lock(_mutex);
+            if(_error.empty()) {
+                _error = "png_loader.cpp: could not load " + (*_filenames)[i] + ": " + e.what();
+            }
+            return;
+        }
+        _times[i] = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    }
+}
@@ -0,0 +1,313 @@
+/* unfilter.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+#include "unfilter.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define UNFILTER_X86
+#include <immintrin.h>
+#define UNFILTER_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Paeth predictor, as in picopng.
+ */
+static unsigned char paeth_predictor(short a, short b, short c) {
+    short p = a + b - c, pa = p > a ? (p - a) : (a - p), pb = p > b ? (p - b) : (b - p), pc = p > c ? (p - c) : (c - p);
+    return (unsigned char)((pa <= pb && pa <= pc) ? a : pb <= pc ? b : c);
+}
+
+int unfilter_scanline_scalar(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, size_t bytewidth, unsigned long filterType, size_t length) {
+    switch(filterType) {
+        case 0: for(size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
+        case 1:
+            for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
+            for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
+            break;
+        case 2:
+            if(precon) for(size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
+            else       for(size_t i = 0; i < length; i++) recon[i] = scanline[i];
+            break;
+        case 3:
+            if(precon) {
+                for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
+                for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) / 2);
+            } else {
+                for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
+                for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth] / 2;
+            }
+            break;
+        case 4:
+            if(precon) {
+                for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + paeth_predictor(0, precon[i], 0);
+                for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paeth_predictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]);
+            } else {
+                for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
+                for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + paeth_predictor(recon[i - bytewidth], 0, 0);
+            }
+            break;
+        default: return 36; // invalid filter type
+    }
+    return 0;
+}
+
+namespace {
+
+    /* Scalar kernels, with the stride known at compile time.  Each starts at
+     byte i, so that they can also finish off the tail of a vectorized kernel.
+     */
+
+    //! Sub: recon[i] = scanline[i] + recon[i-BW].
+    template <std::size_t BW>
+    void sub_scalar(unsigned char* recon, const unsigned char* scanline, std::size_t i, std::size_t length) {
+        for( ; i < std::min(BW, length); ++i) {
+            recon[i] = scanline[i];
+        }
+        for( ; i < length; ++i) {
+            recon[i] = scanline[i] + recon[i - BW];
+        }
+    }
+
+    //! Up: recon[i] = scanline[i] + precon[i].
+    void up_scalar(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, std::size_t i, std::size_t length) {
+        for( ; i < length; ++i) {
+            recon[i] = scanline[i] + precon[i];
+        }
+    }
+
+    //! Average: recon[i] = scanline[i] + (recon[i-BW] + precon[i]) / 2.
+    template <std::size_t BW>
+    void avg(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, std::size_t length) {
+        std::size_t i=0;
+        if(precon) {
+            for( ; i < std::min(BW, length); ++i) {
+                recon[i] = scanline[i] + (precon[i] >> 1);
+            }
+            for( ; i < length; ++i) {
+                recon[i] = scanline[i] + ((recon[i - BW] + precon[i]) >> 1);
+            }
+        } else {
+            for( ; i < std::min(BW, length); ++i) {
+                recon[i] = scanline[i];
+            }
+            for( ; i < length; ++i) {
+                recon[i] = scanline[i] + (recon[i - BW] >> 1);
+            }
+        }
+    }
+
+    //! Branch-light Paeth predictor; p-a == b-c, p-b == a-c, and p-c == a+b-2c.
+    inline unsigned char paeth_fast(int a, int b, int c) {
+        int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2*c);
+        int bc = (pb <= pc) ? b : c;
+        return static_cast<unsigned char>(((pa <= pb) && (pa <= pc)) ? a : bc);
+    }
+
+    /*! Paeth: recon[i] = scanline[i] + paeth_fast(recon[i-BW], precon[i], precon[i-BW]).
+     On the first scanline this reduces to Sub, and for the first pixel of
+     every other scanline to Up.
+     */
+    template <std::size_t BW>
+    void paeth(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, std::size_t length) {
+        if(!precon) {
+            sub_scalar<BW>(recon, scanline, 0, length);
+            return;
+        }
+        std::size_t i=0;
+        for( ; i < std::min(BW, length); ++i) {
+            recon[i] = scanline[i] + precon[i];
+        }
+        for( ; i < length; ++i) {
+            recon[i] = scanline[i] + paeth_fast(recon[i - BW], precon[i], precon[i - BW]);
+        }
+    }
+
+#ifdef UNFILTER_X86
+    /* SSE2 kernels.
+
+     Sub is a prefix sum with a stride of BW bytes: each 16-byte block is
+     summed in-register with log2(16/BW) shift-and-add steps, and then offset
+     by the last pixel of the previous block (the carry).
+     */
+
+    //! Broadcast the last BW bytes of x across a vector.
+    template <std::size_t BW>
+    UNFILTER_TARGET("sse2") __m128i last_pixel_sse2(__m128i x) {
+        __m128i t = _mm_shufflehi_epi16(x, 0xff); // bytes 14,15 in the upper 4 words
+        t = _mm_unpackhi_epi64(t, t); // ...and in all 8
+        if(BW == 1) {
+            t = _mm_srli_epi16(t, 8);
+            t = _mm_or_si128(t, _mm_slli_epi16(t, 8));
+        }
+        return t;
+    }
+
+    template <std::size_t BW>
+    UNFILTER_TARGET("sse2") void sub_sse2(unsigned char* recon, const unsigned char* scanline, std::size_t length) {
+        __m128i carry = _mm_setzero_si128();
+        std::size_t i=0;
+        for( ; (i + 16) <= length; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanline + i));
+            if(BW == 1) {
+                x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+            }
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi8(x, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(recon + i), x);
+            carry = last_pixel_sse2<BW>(x);
+        }
+        sub_scalar<BW>(recon, scanline, i, length);
+    }
+
+    UNFILTER_TARGET("sse2") void up_sse2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, std::size_t length) {
+        std::size_t i=0;
+        for( ; (i + 16) <= length; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(scanline + i));
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(precon + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(recon + i), _mm_add_epi8(x, p));
+        }
+        up_scalar(recon, scanline, precon, i, length);
+    }
+
+    /* AVX2 kernels.
+
+     Byte shifts only operate within each 128b lane, so the Sub prefix sum is
+     computed per lane, and the last pixel of the low lane is then carried
+     into the high lane.
+     */
+
+    //! Shuffle indices that broadcast the last BW bytes of each lane within that lane.
+    template <std::size_t BW>
+    UNFILTER_TARGET("avx2") __m256i last_pixel_index_avx2() {
+        return (BW == 1) ? _mm256_set1_epi8(15) : _mm256_set1_epi16(0x0f0e);
+    }
+
+    template <std::size_t BW>
+    UNFILTER_TARGET("avx2") void sub_avx2(unsigned char* recon, const unsigned char* scanline, std::size_t length) {
+        const __m256i last = last_pixel_index_avx2<BW>();
+        __m256i carry = _mm256_setzero_si256();
+        std::size_t i=0;
+        for( ; (i + 32) <= length; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scanline + i));
+            if(BW == 1) {
+                x = _mm256_add_epi8(x, _mm256_slli_si256(x, 1));
+            }
+            x = _mm256_add_epi8(x, _mm256_slli_si256(x, 2));
+            x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+            x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+            // low lane's last pixel into the high lane:
+            __m256i t = _mm256_shuffle_epi8(x, last);
+            x = _mm256_add_epi8(x, _mm256_permute2x128_si256(t, t, 0x08));
+            x = _mm256_add_epi8(x, carry);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(recon + i), x);
+            // high lane's last pixel is the next carry:
+            t = _mm256_shuffle_epi8(x, last);
+            carry = _mm256_permute2x128_si256(t, t, 0x11);
+        }
+        sub_scalar<BW>(recon, scanline, i, length);
+    }
+
+    UNFILTER_TARGET("avx2") void up_avx2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon, std::size_t length) {
+        std::size_t i=0;
+        for( ; (i + 32) <= length; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scanline + i));
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(precon + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(recon + i), _mm256_add_epi8(x, p));
+        }
+        up_scalar(recon, scanline, precon, i, length);
+    }
+#endif
+
+    //! Unfilter a scanline with a bytewidth of BW.
+    template <std::size_t BW>
+    int unfilter(unfilter_isa isa, unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                 unsigned long filterType, std::size_t length) {
+        switch(filterType) {
+            case 0:
+                std::memcpy(recon, scanline, length);
+                break;
+            case 1:
+                switch(isa) {
+#ifdef UNFILTER_X86
+                    case UNFILTER_AVX2: sub_avx2<BW>(recon, scanline, length); break;
+                    case UNFILTER_SSE2: sub_sse2<BW>(recon, scanline, length); break;
+#endif
+                    default: sub_scalar<BW>(recon, scanline, 0, length); break;
+                }
+                break;
+            case 2:
+                if(!precon) {
+                    std::memcpy(recon, scanline, length);
+                    break;
+                }
+                switch(isa) {
+#ifdef UNFILTER_X86
+                    case UNFILTER_AVX2: up_avx2(recon, scanline, precon, length); break;
+                    case UNFILTER_SSE2: up_sse2(recon, scanline, precon, length); break;
+#endif
+                    default: up_scalar(recon, scanline, precon, 0, length); break;
+                }
+                break;
+            case 3:
+                avg<BW>(recon, scanline, precon, length);
+                break;
+            case 4:
+                paeth<BW>(recon, scanline, precon, length);
+                break;
+            default: return 36; // invalid filter type
+        }
+        return 0;
+    }
+
+    //! Instruction set used by unfilter_scanline, detected once at startup.
+    const unfilter_isa best_isa = unfilter_best_isa();
+
+} // namespace
+
+unfilter_isa unfilter_best_isa() {
+#ifdef UNFILTER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return UNFILTER_AVX2;
+    }
+    if(__builtin_cpu_supports("sse2")) {
+        return UNFILTER_SSE2;
+    }
+#endif
+    return UNFILTER_SCALAR;
+}
+
+int unfilter_scanline(unfilter_isa isa, unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                      std::size_t bytewidth, unsigned long filterType, std::size_t length) {
+    switch(bytewidth) {
+        case 1: return unfilter<1>(isa, recon, scanline, precon, filterType, length);
+        case 2: return unfilter<2>(isa, recon, scanline, precon, filterType, length);
+        default: return unfilter_scanline_scalar(recon, scanline, precon, bytewidth, filterType, length);
+    }
+}
+
+int unfilter_scanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                      std::size_t bytewidth, unsigned long filterType, std::size_t length) {
+    return unfilter_scanline(best_isa, recon, scanline, precon, bytewidth, filterType, length);
+}
@@ -0,0 +1,53 @@
+/* unfilter.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _UNFILTER_H_
+#define _UNFILTER_H_
+
+#include <cstddef>
+
+/*! Instruction sets that png scanline unfiltering can use.
+ */
+enum unfilter_isa { UNFILTER_SCALAR, UNFILTER_SSE2, UNFILTER_AVX2 };
+
+//! Returns the best instruction set supported by this CPU.
+unfilter_isa unfilter_best_isa();
+
+/*! Unfilter one png scanline of length bytes (excluding the filter type byte)
+ into recon, given the previous (already unfiltered) scanline precon, or 0 for
+ the first scanline; returns 0 on success or 36 if the filter type is invalid.
+
+ Scanlines with a bytewidth of 1 or 2 (8b and 16b greyscale) are unfiltered
+ with vectorized Sub and Up kernels and stride-specialized Average and Paeth
+ loops, using the best instruction set available; everything else uses
+ unfilter_scanline_scalar.  The result is always identical to the scalar
+ reference.
+ */
+int unfilter_scanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                      std::size_t bytewidth, unsigned long filterType, std::size_t length);
+
+//! As above, but use the given instruction set (which must be supported by this CPU).
+int unfilter_scanline(unfilter_isa isa, unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                      std::size_t bytewidth, unsigned long filterType, std::size_t length);
+
+//! Scalar reference implementation, as in picopng's unFilterScanline.
+int unfilter_scanline_scalar(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             std::size_t bytewidth, unsigned long filterType, std::size_t length);
+
+#endif
@@ -0,0 +1,140 @@
+/* bench_gather.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <evocadx/db/png.h>
+#include "png_writer.h"
+
+//! Reads pixel (i,j) the way sequence_matrix does, as element i*width+j.
+struct by_index {
+    static png::value_type get(const png& img, long i, long j) { return img[i*img.width() + j]; }
+};
+
+//! Reads pixel (i,j) with the 2D accessor.
+struct by_position {
+    static png::value_type get(const png& img, long i, long j) { return img(i, j); }
+};
+
+/*! Returns the sum of the fovea^2 + 8*retina pixels a camera at (i,j) reads;
+ pixels outside of the image read as 0.
+ */
+template <typename Accessor>
+unsigned long gather(const png& img, long i, long j, long fovea, std::size_t retina) {
+    const long h=fovea/2, rows=img.height(), cols=img.width();
+    unsigned long s=0;
+    for(long r=i-h; r<i-h+fovea; ++r) {
+        for(long c=j-h; c<j-h+fovea; ++c) {
+            if((r >= 0) && (r < rows) && (c >= 0) && (c < cols)) {
+                s += Accessor::get(img, r, c);
+            }
+        }
+    }
+    static const int di[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+    static const int dj[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    for(std::size_t k=1; k<=retina; ++k) {
+        long d = h + (1L << k);
+        for(int n=0; n<8; ++n) {
+            long r=i + di[n]*d, c=j + dj[n]*d;
+            if((r >= 0) && (r < rows) && (c >= 0) && (c < cols)) {
+                s += Accessor::get(img, r, c);
+            }
+        }
+    }
+    return s;
+}
+
+/*! Returns the time per camera update (in ns) of a random walk of n steps
+ over img; like the camera in png_centroid, each step moves by -1, 0, or +1
+ in each dimension.
+ */
+template <typename Accessor>
+double walk(const png& img, long fovea, std::size_t retina, int n, unsigned long& check) {
+    using namespace boost::posix_time;
+    boost::random::mt19937 rng(1);
+    boost::random::uniform_int_distribution<> step(-1, 1);
+    long i=img.height()/2, j=img.width()/2;
+    ptime start = microsec_clock::universal_time();
+    for(int k=0; k<n; ++k) {
+        check += gather<Accessor>(img, i, j, fovea, retina);
+        i = std::max(0L, std::min(static_cast<long>(img.height())-1, i + step(rng)));
+        j = std::max(0L, std::min(static_cast<long>(img.width())-1, j + step(rng)));
+    }
+    return (microsec_clock::universal_time() - start).total_microseconds() * 1e3 / n;
+}
+
+/* Camera gather benchmark for the png pixel layouts.
+
+ Usage: bench-gather [steps [file.png]]
+
+ A camera takes a random walk of steps (default 200000) updates over an
+ image (a generated 1914x2294 16b image, unless a file is given), reading
+ its fovea and retina at each step, for a range of fovea sizes and for each
+ pixel layout.  Images are thresholded, as in png_centroid.  Each layout is
+ timed both through operator[] (which is how sequence_matrix, and so
+ retina2_iterator, reads pixels) and through operator()(i,j).
+ */
+int main(int argc, const char* argv[]) {
+    int steps = (argc > 1) ? boost::lexical_cast<int>(argv[1]) : 200000;
+    std::string fname = (argc > 2) ? argv[2] : "bench_gather.png";
+    if(argc <= 2) {
+        png_writer::write_file(fname, png_writer::encode(png_writer::generate(1914, 2294), 1914, 2294));
+    }
+
+    const char* names[3] = {"row-major", "tiled", "morton"};
+    std::vector<png> images;
+    for(int l=png::ROW_MAJOR_LAYOUT; l<=png::MORTON_LAYOUT; ++l) {
+        png::options opts;
+        opts.layout = static_cast<png::layout_type>(l);
+        images.push_back(png(fname, opts));
+    }
+    if(argc <= 2) {
+        std::remove(fname.c_str());
+    }
+
+    // ns per camera update, reading pixels by index (as sequence_matrix
+    // does) and by (row, column):
+    std::cout << std::setw(8) << "fovea";
+    for(int l=0; l<3; ++l) {
+        std::cout << std::setw(16) << (std::string(names[l]) + "[n]") << std::setw(16) << (std::string(names[l]) + "(i,j)");
+    }
+    std::cout << std::endl;
+
+    const long foveas[5] = {4, 8, 10, 16, 32};
+    for(int f=0; f<5; ++f) {
+        std::cout << std::setw(8) << foveas[f];
+        unsigned long check[6] = {0, 0, 0, 0, 0, 0};
+        for(int l=0; l<3; ++l) {
+            double a = walk<by_index>(images[l], foveas[f], 2, steps, check[2*l]);
+            double b = walk<by_position>(images[l], foveas[f], 2, steps, check[2*l+1]);
+            std::cout << std::fixed << std::setprecision(1) << std::setw(16) << a << std::setw(16) << b;
+        }
+        std::cout << ((std::count(check, check+6, check[0]) == 6) ? "" : "   (mismatch!)") << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/* bench_inflate.cpp
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iomanip>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <evocadx/db/png.h>
+#include "png_writer.h"
+
+//! A named, encoded png.
+struct bench_image {
+    std::string name;
+    png_writer::byte_vector_type data;
+};
+
+//! Returns the decode throughput of engine on img, in MB/s of compressed input.
+double throughput(const bench_image& img, png::inflate_type engine, int reps) {
+    using namespace boost::posix_time;
+    std::vector<unsigned char> out;
+    unsigned long w, h;
+    ptime start = microsec_clock::universal_time();
+    for(int i=0; i<reps; ++i) {
+        if(decode_png(out, w, h, &img.data[0], img.data.size(), false, engine)) {
+            throw std::runtime_error("bench_inflate.cpp: could not decode " + img.name);
+        }
+    }
+    double secs = (microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    return (static_cast<double>(img.data.size()) * reps / 1e6) / secs;
+}
+
+/* Decode throughput benchmark for the png inflate engines.
+
+ Usage: bench-inflate [reps [file.png ...]]
+
+ Each image is decoded reps times (default 5) with each engine; in addition to
+ any files given on the command line, a set of generated 8- and 16-bit
+ greyscale images is used.
+ */
+int main(int argc, const char* argv[]) {
+    int reps = (argc > 1) ? boost::lexical_cast<int>(argv[1]) : 5;
+
+    std::vector<bench_image> images;
+    const unsigned long sizes[3][2] = { {256, 80}, {957, 1147}, {1914, 2294} };
+    for(unsigned int depth=8; depth<=16; depth+=8) {
+        for(int i=0; i<3; ++i) {
+            bench_image b;
+            b.name = "gen-" + boost::lexical_cast<std::string>(sizes[i][0]) + "x"
+            + boost::lexical_cast<std::string>(sizes[i][1]) + "-"
+            + boost::lexical_cast<std::string>(depth) + "b";
+            b.data = png_writer::encode(png_writer::generate(sizes[i][0], sizes[i][1], depth), sizes[i][0], sizes[i][1], depth);
+            images.push_back(b);
+        }
+    }
+    for(int i=2; i<argc; ++i) {
+        bench_image b;
+        b.name = argv[i];
+        std::ifstream in(argv[i], std::ios::binary);
+        b.data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        images.push_back(b);
+    }
+
+    std::cout << std::left << std::setw(24) << "image" << std::right
+    << std::setw(12) << "bytes" << std::setw(12) << "picopng" << std::setw(12) << "table" << std::setw(10) << "speedup" << std::endl;
+    for(std::size_t i=0; i<images.size(); ++i) {
+        double p = throughput(images[i], png::PICOPNG_INFLATE, reps);
+        double t = throughput(images[i], png::TABLE_INFLATE, reps);
+        std::cout << std::left << std::setw(24) << images[i].name << std::right
+        << std::setw(12) << images[i].data.size()
+        << std::fixed << std::setprecision(1)
+        << std::setw(12) << p << std::setw(12) << t << std::setw(10) << (t/p) << std::endl;
+    }
+    return 0;
+}
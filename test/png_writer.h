@@ -0,0 +1,178 @@
+/* png_writer.h
+ *
+ * This file is part of EvoCADx.
+ *
+ * Copyright 2014 David B. Knoester.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _PNG_WRITER_H_
+#define _PNG_WRITER_H_
+
+#include <boost/crc.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/* Helpers for generating greyscale png test images, so that tests and
+ benchmarks don't depend on the (large, private) mammogram data sets.
+ */
+namespace png_writer {
+
+    typedef std::vector<unsigned char> byte_vector_type;
+    typedef std::vector<uint16_t> pixel_vector_type;
+
+    //! Append a 32b big-endian integer.
+    inline void put32(byte_vector_type& v, uint32_t x) {
+        v.push_back((x >> 24) & 0xff);
+        v.push_back((x >> 16) & 0xff);
+        v.push_back((x >> 8) & 0xff);
+        v.push_back(x & 0xff);
+    }
+
+    //! Append a chunk of type t with the given data.
+    inline void put_chunk(byte_vector_type& v, const char* t, const byte_vector_type& data) {
+        put32(v, data.size());
+        std::size_t start=v.size();
+        v.insert(v.end(), t, t+4);
+        v.insert(v.end(), data.begin(), data.end());
+        boost::crc_32_type crc;
+        crc.process_bytes(&v[start], v.size()-start);
+        put32(v, crc.checksum());
+    }
+
+    //! Paeth predictor, as defined by the png specification.
+    inline int paeth(int a, int b, int c) {
+        int p=a+b-c, pa=std::abs(p-a), pb=std::abs(p-b), pc=std::abs(p-c);
+        return ((pa <= pb) && (pa <= pc)) ? a : ((pb <= pc) ? b : c);
+    }
+
+    /*! Encode pixels as a greyscale png with the given bit depth (8 or 16).
+
+     If filter is in [0,4] every scanline uses that filter type; otherwise the
+     filter type cycles through all five, row by row.
+     */
+    inline byte_vector_type encode(const pixel_vector_type& pixels, unsigned long width, unsigned long height,
+                                   unsigned int depth=16, int filter=-1, int level=6) {
+        const std::size_t bw=depth/8, linelength=width*bw;
+
+        // raw (unfiltered) big-endian scanlines:
+        byte_vector_type raw(linelength*height);
+        for(std::size_t i=0; i<pixels.size(); ++i) {
+            if(depth == 16) {
+                raw[2*i] = pixels[i] >> 8;
+                raw[2*i+1] = pixels[i] & 0xff;
+            } else {
+                raw[i] = pixels[i] & 0xff;
+            }
+        }
+
+        // filtered scanlines, each preceded by its filter type:
+        byte_vector_type filtered;
+        filtered.reserve((linelength+1)*height);
+        for(std::size_t y=0; y<height; ++y) {
+            int ft = ((filter >= 0) && (filter <= 4)) ? filter : static_cast<int>(y % 5);
+            filtered.push_back(ft);
+            const unsigned char* cur=&raw[y*linelength];
+            const unsigned char* prev=(y > 0) ? &raw[(y-1)*linelength] : 0;
+            for(std::size_t i=0; i<linelength; ++i) {
+                int a = (i >= bw) ? cur[i-bw] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = (prev && (i >= bw)) ? prev[i-bw] : 0;
+                int p=0;
+                switch(ft) {
+                    case 1: p = a; break;
+                    case 2: p = b; break;
+                    case 3: p = (a + b) / 2; break;
+                    case 4: p = paeth(a, b, c); break;
+                }
+                filtered.push_back(static_cast<unsigned char>(cur[i] - p));
+            }
+        }
+
+        // zlib-compress the filtered data:
+        std::string z;
+        {
+            namespace bio = boost::iostreams;
+            bio::filtering_stream<bio::output> out;
+            out.push(bio::zlib_compressor(bio::zlib_params(level)));
+            out.push(bio::back_inserter(z));
+            out.write(reinterpret_cast<const char*>(&filtered[0]), filtered.size());
+        }
+        byte_vector_type idat(z.begin(), z.end());
+
+        const unsigned char sig[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        byte_vector_type png(sig, sig+8);
+
+        byte_vector_type ihdr;
+        put32(ihdr, width);
+        put32(ihdr, height);
+        ihdr.push_back(depth);
+        ihdr.push_back(0); // greyscale
+        ihdr.push_back(0); // deflate
+        ihdr.push_back(0); // adaptive filtering
+        ihdr.push_back(0); // no interlace
+        put_chunk(png, "IHDR", ihdr);
+
+        // split the image data across several IDAT chunks, as real encoders do:
+        const std::size_t chunk=65536;
+        for(std::size_t i=0; i<idat.size(); i+=chunk) {
+            byte_vector_type part(idat.begin()+i, idat.begin()+std::min(idat.size(), i+chunk));
+            put_chunk(png, "IDAT", part);
+        }
+        put_chunk(png, "IEND", byte_vector_type());
+        return png;
+    }
+
+    /*! Generate a mammogram-like greyscale image: a bright, noisy elliptical
+     blob of "tissue" against a dark background, at the given bit depth.
+     */
+    inline pixel_vector_type generate(unsigned long width, unsigned long height, unsigned int depth=16, unsigned int seed=42) {
+        boost::random::mt19937 rng(seed);
+        boost::random::normal_distribution<double> noise(0.0, 0.02);
+        const double maxval = (depth == 16) ? 65535.0 : 255.0;
+        pixel_vector_type pixels(width*height);
+        double cx=0.3*width, cy=0.5*height, rx=0.6*width, ry=0.45*height;
+        for(std::size_t y=0; y<height; ++y) {
+            for(std::size_t x=0; x<width; ++x) {
+                double dx=(x-cx)/rx, dy=(y-cy)/ry;
+                double r=std::sqrt(dx*dx + dy*dy);
+                double v=0.0;
+                if(r < 1.0) {
+                    v = 0.3 + 0.5*(1.0-r) + noise(rng);
+                    v = std::max(0.0, std::min(1.0, v));
+                }
+                pixels[y*width+x] = static_cast<uint16_t>(v*maxval);
+            }
+        }
+        return pixels;
+    }
+
+    //! Write bytes to filename.
+    inline void write_file(const std::string& filename, const byte_vector_type& data) {
+        std::ofstream out(filename.c_str(), std::ios::binary|std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&data[0]), data.size());
+    }
+
+} // png_writer
+
+#endif
@@ -0,0 +1,287 @@
+/* test_binary_image.cpp
+ * 
+ * This file is part of EvoCADx.
+ * 
+ * Copyright 2014 David B. Knoester.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BOOST_TEST_DYN_LINK
+#define BOOST_TEST_DYN_LINK
+#endif
+#define BOOST_TEST_MAIN
+#include "test.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include <evocadx/db/png.h>
+#include <evocadx/db/binary_image.h>
+#include <evocadx/db/image_view.h>
+#include <evocadx/iterators/binary_camera.h>
+#include <evocadx/iterators/pyramid_camera.h>
+#include "png_writer.h"
+
+//! Returns true if pixel (i,j) of img is set, with pixels outside of the image unset.
+bool naive_test(const png& img, long i, long j) {
+    if((i < 0) || (j < 0) || (i >= static_cast<long>(img.height())) || (j >= static_cast<long>(img.width()))) {
+        return false;
+    }
+    return img[i*img.width() + j] > 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_binary_image) {
+    const char* fname="test_binary_image.png";
+    const unsigned long w=203, h=97;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png img(fname, png::options());
+    std::remove(fname);
+    binary_image b(img);
+
+    BOOST_CHECK_EQUAL(b.width(), w);
+    BOOST_CHECK_EQUAL(b.height(), h);
+    BOOST_CHECK_EQUAL(b.size1(), h);
+    BOOST_CHECK_EQUAL(b.size2(), w);
+    BOOST_CHECK_EQUAL(b.bytes(), h*4*8u); // 4 words per row
+    BOOST_CHECK_EQUAL(b.get_centroid().first, img.get_centroid().first);
+    BOOST_CHECK_EQUAL(b.distance_to_centroid(10, 20), img.distance_to_centroid(10, 20));
+
+    std::size_t count=0;
+    for(std::size_t i=0; i<img.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(b[i], img[i]); // thresholded pngs only contain 0 and max
+        BOOST_REQUIRE_EQUAL(b(i / w, i % w), img[i]); // as read by retina2_iterator<binary_image>
+        count += (img[i] > 0);
+    }
+    BOOST_CHECK_EQUAL(b.count(), count);
+    BOOST_CHECK(count > 0);
+
+    // word-level reads, including off the edges of the image:
+    boost::random::mt19937 rng(42);
+    boost::random::uniform_int_distribution<> row(-5, h+5), col(-70, w+70), len(0, 64);
+    for(int t=0; t<2000; ++t) {
+        long i=row(rng), j=col(rng);
+        unsigned int n=len(rng);
+        binary_image::word_type bits = b.row_bits(i, j, n);
+        for(unsigned int k=0; k<64; ++k) {
+            bool expected = (k < n) && naive_test(img, i, j+k);
+            BOOST_REQUIRE_EQUAL(((bits >> k) & 1) == 1, expected);
+        }
+    }
+
+    // set and clear:
+    binary_image c(w, h);
+    BOOST_CHECK_EQUAL(c.count(), 0u);
+    c.set(5, 130);
+    BOOST_CHECK(c.test(5, 130));
+    BOOST_CHECK_EQUAL(c[5*w + 130], binary_image::max_value());
+    c.set(5, 130, false);
+    BOOST_CHECK_EQUAL(c.count(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(test_binary_camera) {
+    const char* fname="test_binary_camera.png";
+    const unsigned long w=150, h=120;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png img(fname, png::options());
+    std::remove(fname);
+    binary_image b(img);
+
+    const std::size_t fovea=7, retina=3;
+    binary_camera ci(b, fovea, retina);
+    BOOST_CHECK_EQUAL(ci.size(), fovea*fovea + 8*retina);
+
+    const long di[8] = {-1, -1, 0, 1, 1, 1, 0, -1};
+    const long dj[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+    const long positions[4][2] = { {0, 0}, {60, 75}, {119, 149}, {3, 146} };
+    for(int p=0; p<4; ++p) {
+        ci.position(positions[p][0], positions[p][1]);
+        long i=ci._i, j=ci._j, half=fovea/2;
+        binary_camera::iterator in=ci.begin();
+        for(long r=0; r<static_cast<long>(fovea); ++r) {
+            for(long c=0; c<static_cast<long>(fovea); ++c, ++in) {
+                BOOST_REQUIRE_EQUAL(*in, naive_test(img, i-half+r, j-half+c));
+            }
+        }
+        for(long r=1; r<=static_cast<long>(retina); ++r) {
+            long d = half + (1L << r);
+            for(int k=0; k<8; ++k, ++in) {
+                BOOST_REQUIRE_EQUAL(*in, naive_test(img, i+di[k]*d, j+dj[k]*d));
+            }
+        }
+        BOOST_CHECK(in == ci.end());
+    }
+
+    // moves are clamped to the image:
+    ci.position(0, 0);
+    ci.move(-1, -1);
+    BOOST_CHECK_EQUAL(ci._i, 0u);
+    BOOST_CHECK_EQUAL(ci._j, 0u);
+    ci.position(500, 500);
+    BOOST_CHECK_EQUAL(ci._i, h-1);
+    BOOST_CHECK_EQUAL(ci._j, w-1);
+}
+
+BOOST_AUTO_TEST_CASE(test_pyramid_camera) {
+    const char* fname="test_pyramid_camera.png";
+    const unsigned long w=150, h=120;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png::options opts;
+    opts.pyramid_levels = 3;
+    png img(fname, opts);
+    std::remove(fname);
+    binary_image b(img);
+
+    // a coarse pixel is set iff any pixel under it is set:
+    BOOST_REQUIRE_EQUAL(b.levels(), 3u);
+    for(std::size_t k=1; k<b.levels(); ++k) {
+        const binary_image& f=b.level(k-1);
+        const binary_image& c=b.level(k);
+        BOOST_CHECK_EQUAL(c.width(), (f.width()+1)/2);
+        for(std::size_t i=0; i<c.height(); ++i) {
+            for(std::size_t j=0; j<c.width(); ++j) {
+                bool any = (f.row_bits(2*i, 2*j, 2) | f.row_bits(2*i+1, 2*j, 2)) != 0;
+                BOOST_REQUIRE_EQUAL(c.test(i, j), any);
+            }
+        }
+    }
+
+    const std::size_t fovea=5, retina=2;
+    pyramid_camera ci(b, fovea, retina);
+    BOOST_CHECK_EQUAL(ci.level(), 2u);
+    ci.position(60, 75);
+    ci.move(1, -1); // one step at level 2 is 4 pixels
+    BOOST_CHECK_EQUAL(ci._i, 64u);
+    BOOST_CHECK_EQUAL(ci._j, 71u);
+
+    binary_camera::input_vector_type expected(ci.size());
+    binary_camera::gather(b.level(2), 64 >> 2, 71 >> 2, fovea, retina, expected.begin());
+    BOOST_CHECK(std::equal(ci.begin(), ci.end(), expected.begin()));
+
+    ci.zoom(-1); // already at the coarsest level
+    BOOST_CHECK_EQUAL(ci.level(), 2u);
+    ci.zoom(1);
+    ci.zoom(1);
+    ci.zoom(1); // already at full resolution
+    BOOST_CHECK_EQUAL(ci.level(), 0u);
+    binary_camera full(b, fovea, retina);
+    full.position(64, 71);
+    BOOST_CHECK(std::equal(ci.begin(), ci.end(), full.begin()));
+    ci.move(-1, 1);
+    BOOST_CHECK_EQUAL(ci._i, 63u);
+    BOOST_CHECK_EQUAL(ci._j, 72u);
+}
+
+BOOST_AUTO_TEST_CASE(test_occupancy_index) {
+    const char* fname="test_occupancy_index.png";
+    const unsigned long w=211, h=133;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png img(fname, png::options());
+    std::remove(fname);
+
+    // a thresholded image, and a sparse one with a few scattered pixels:
+    boost::random::mt19937 rng(11);
+    boost::random::uniform_int_distribution<> row(-10, h+10), col(-10, w+10);
+    binary_image images[2] = { binary_image(img), binary_image(w, h) };
+    for(int t=0; t<6; ++t) {
+        images[1].set((row(rng) + 10) % h, (col(rng) + 10) % w);
+    }
+
+    for(int n=0; n<2; ++n) {
+        binary_image& a=images[n];
+        binary_image b(a);
+        b.build_index();
+        BOOST_CHECK(!a.indexed());
+        BOOST_CHECK(b.indexed());
+
+        // reduce() ors each 2x2 block:
+        binary_image r=a.reduce();
+        BOOST_REQUIRE_EQUAL(r.width(), (w+1)/2);
+        BOOST_REQUIRE_EQUAL(r.height(), (h+1)/2);
+        for(std::size_t i=0; i<r.height(); ++i) {
+            for(std::size_t j=0; j<r.width(); ++j) {
+                bool any = (a.row_bits(2*i, 2*j, 2) | a.row_bits(2*i+1, 2*j, 2)) != 0;
+                BOOST_REQUIRE_EQUAL(r.test(i, j), any);
+            }
+        }
+
+        // emptiness queries, with and without the index, match brute force:
+        for(int t=0; t<2000; ++t) {
+            long i0=row(rng), j0=col(rng), i1=i0 + row(rng)/4, j1=j0 + col(rng)/4;
+            bool empty=true;
+            for(long i=std::max(i0, 0L); i<std::min(i1, static_cast<long>(h)); ++i) {
+                for(long j=std::max(j0, 0L); j<std::min(j1, static_cast<long>(w)); ++j) {
+                    empty = empty && !a.test(i, j);
+                }
+            }
+            BOOST_REQUIRE_EQUAL(a.empty(i0, j0, i1, j1), empty);
+            BOOST_REQUIRE_EQUAL(b.empty(i0, j0, i1, j1), empty);
+        }
+
+        // cameras read the same inputs with and without the index:
+        binary_camera ca(a, 8, 3), cb(b, 8, 3);
+        for(int t=0; t<500; ++t) {
+            long i=row(rng), j=col(rng);
+            ca.position(i, j);
+            cb.position(i, j);
+            BOOST_REQUIRE(std::equal(ca.begin(), ca.end(), cb.begin()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_image_view) {
+    const char* fname="test_image_view.png";
+    const unsigned long w=61, h=37;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png img(fname, png::options());
+    std::remove(fname);
+    binary_image b(img);
+
+    typedef image_view<png> view_type;
+    std::vector<std::vector<png::value_type> > seen;
+    for(unsigned int o=0; o<view_type::orientations; ++o) {
+        view_type v(img, o);
+        image_view<binary_image> bv(b, o);
+        bool t = (o & view_type::TRANSPOSE);
+        BOOST_REQUIRE_EQUAL(v.size1(), t ? w : h);
+        BOOST_REQUIRE_EQUAL(v.size2(), t ? h : w);
+        BOOST_CHECK_EQUAL(v.size(), img.size());
+
+        // pixel (i,j) of the view, transposed, flipped, and mirrored back:
+        std::vector<png::value_type> pixels(v.size());
+        for(std::size_t i=0; i<v.size1(); ++i) {
+            for(std::size_t j=0; j<v.size2(); ++j) {
+                std::size_t r = (o & view_type::FLIP_V) ? v.size1()-1-i : i;
+                std::size_t c = (o & view_type::FLIP_H) ? v.size2()-1-j : j;
+                png::value_type expected = t ? img(c, r) : img(r, c);
+                BOOST_REQUIRE_EQUAL(v[i*v.size2() + j], expected);
+                BOOST_REQUIRE_EQUAL(bv(i, j), expected);
+                pixels[i*v.size2() + j] = expected;
+            }
+        }
+        BOOST_CHECK(std::find(seen.begin(), seen.end(), pixels) == seen.end());
+        seen.push_back(pixels);
+
+        // the centroid moves with the pixels:
+        double x = t ? img.get_centroid().second : img.get_centroid().first;
+        double y = t ? img.get_centroid().first : img.get_centroid().second;
+        x = (o & view_type::FLIP_H) ? (v.size2()-1-x) : x;
+        y = (o & view_type::FLIP_V) ? (v.size1()-1-y) : y;
+        BOOST_CHECK_EQUAL(v.get_centroid().first, x);
+        BOOST_CHECK_EQUAL(v.get_centroid().second, y);
+        BOOST_CHECK_EQUAL(bv.get_centroid().first, x);
+        BOOST_CHECK_CLOSE(v.distance_to_centroid(3, 4), std::sqrt((3-x)*(3-x) + (4-y)*(4-y)), 1e-9);
+    }
+}
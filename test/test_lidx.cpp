@@ -0,0 +1,873 @@
+/* test_lidx.cpp
+ * 
+ * This file is part of EvoCADx.
+ * 
+ * Copyright 2014 David B. Knoester.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BOOST_TEST_DYN_LINK
+#define BOOST_TEST_DYN_LINK
+#endif
+#define BOOST_TEST_MAIN
+#include "test.h"
+#include <evocadx/db/epoch_permutation.h>
+#include <evocadx/db/lidx.h>
+#include <evocadx/db/lidx_dedup.h>
+#include <evocadx/db/lidx_paged.h>
+#include <evocadx/db/lidx_stream.h>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <vector>
+
+typedef lidx::lidx_db<int, int, lidx::binaryS> binary_db_type;
+typedef lidx::lidx_db<int, int, lidx::xmlS> xml_db_type;
+typedef lidx::lidx_db<int, int, lidx::packedS> packed_db_type;
+
+//! Fill db with n small records.
+template <typename DB>
+void fill_db(DB& db, std::size_t n) {
+    db.dims().push_back(3);
+    db.dims().push_back(4);
+    for(std::size_t i=0; i<n; ++i) {
+        typename DB::record_type r;
+        r.label = i % 10;
+        for(std::size_t j=0; j<12; ++j) {
+            r.data.push_back((i*31 + j*7) % 256);
+        }
+        db.records().push_back(r);
+    }
+}
+
+//! Returns the bit_vector of the non-zero elements of v.
+bit_vector legacy_bits(const std::vector<int>& v) {
+    bit_vector b;
+    b.assign(v.begin(), v.end());
+    return b;
+}
+
+//! Write db to fname, read it back, and check that it is unchanged.
+template <typename DB>
+void check_roundtrip(const std::string& fname) {
+    DB a, b;
+    fill_db(a, 50);
+    lidx::write(fname, a);
+    lidx::read(fname, b);
+    BOOST_CHECK(a.dims() == b.dims());
+    BOOST_REQUIRE_EQUAL(a.records().size(), b.records().size());
+    for(std::size_t i=0; i<a.records().size(); ++i) {
+        BOOST_CHECK_EQUAL(a[i].label, b[i].label);
+        BOOST_CHECK(a[i].data == b[i].data);
+    }
+    std::remove(fname.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_roundtrip) {
+    check_roundtrip<binary_db_type>("test_lidx.lidx");
+    check_roundtrip<binary_db_type>("test_lidx.lidx.gz");
+    check_roundtrip<xml_db_type>("test_lidx.xml");
+    check_roundtrip<xml_db_type>("test_lidx.xml.gz");
+    check_roundtrip<packed_db_type>("test_lidx.plidx");
+    check_roundtrip<packed_db_type>("test_lidx.plidx.gz");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_packed) {
+    packed_db_type a;
+    fill_db(a, 50);
+    lidx::write("test_lidx_packed.lidx", a);
+    lidx::write("test_lidx_packed.lidx.gz", a);
+    
+    // formats are detected by content, so any database can read any file:
+    xml_db_type b;
+    lidx::read("test_lidx_packed.lidx", b);
+    BOOST_CHECK(a.dims() == b.dims());
+    BOOST_REQUIRE_EQUAL(b.records().size(), 50u);
+    BOOST_CHECK_EQUAL(b[17].label, a[17].label);
+    BOOST_CHECK(b[17].data == a[17].data);
+    
+    binary_db_type legacy;
+    fill_db(legacy, 5);
+    lidx::write("test_lidx_legacy.lidx", legacy);
+    packed_db_type c;
+    lidx::read("test_lidx_legacy.lidx", c);
+    BOOST_REQUIRE_EQUAL(c.records().size(), 5u);
+    BOOST_CHECK(c[4].data == legacy[4].data);
+    
+    // and packed elements are converted to the database's types:
+    lidx::lidx_db<uint8_t, double> d;
+    lidx::read("test_lidx_packed.lidx.gz", d);
+    BOOST_REQUIRE_EQUAL(d.records().size(), 50u);
+    BOOST_CHECK_EQUAL(d[17].label, 7);
+    BOOST_CHECK_EQUAL(d[17].data[11], static_cast<double>(a[17].data[11]));
+    
+    // packed files can be used in place, without reading them:
+    lidx::packed_file f("test_lidx_packed.lidx");
+    BOOST_CHECK_EQUAL(f.size(), 50u);
+    BOOST_CHECK_EQUAL(f.ndims(), 2u);
+    BOOST_CHECK_EQUAL(f.dim(0), 3u);
+    BOOST_CHECK_EQUAL(f.dim(1), 4u);
+    BOOST_CHECK_EQUAL(f.record_size(), 12u);
+    BOOST_CHECK_EQUAL(f.labels<int>()[17], a[17].label);
+    BOOST_CHECK(std::equal(a[17].data.begin(), a[17].data.end(), f.data<int>(17)));
+    BOOST_CHECK_THROW(f.data<uint8_t>(0), std::runtime_error);
+    
+    // truncated files are rejected:
+    {
+        std::ifstream in("test_lidx_packed.lidx", std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream out("test_lidx_truncated.lidx", std::ios::binary|std::ios::trunc);
+        out.write(&bytes[0], bytes.size() - 1);
+    }
+    BOOST_CHECK_THROW(lidx::read("test_lidx_truncated.lidx", b), std::runtime_error);
+    BOOST_CHECK_THROW(lidx::packed_file("test_lidx_truncated.lidx"), std::runtime_error);
+    
+    std::remove("test_lidx_packed.lidx");
+    std::remove("test_lidx_packed.lidx.gz");
+    std::remove("test_lidx_legacy.lidx");
+    std::remove("test_lidx_truncated.lidx");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_missing) {
+    binary_db_type db;
+    BOOST_CHECK_THROW(lidx::read("test_lidx_missing.lidx", db), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_out_of_range) {
+    // values that don't fit the database's element type aren't truncated:
+    binary_db_type legacy;
+    fill_db(legacy, 5);
+    legacy[3].data[2] = 300;
+    lidx::write("test_lidx_range.lidx", legacy);
+    lidx::arena_db<int, uint8_t> a;
+    BOOST_CHECK_THROW(lidx::read("test_lidx_range.lidx", a), std::runtime_error);
+    lidx::lidx_db<int, uint8_t, lidx::packedS> b;
+    BOOST_CHECK_THROW(lidx::read("test_lidx_range.lidx", b), std::runtime_error);
+    
+    // nor in packed files:
+    lidx::lidx_db<int, int32_t, lidx::packedS> wide;
+    fill_db(wide, 5);
+    wide[1].data[0] = -1;
+    lidx::write("test_lidx_range.lidx", wide);
+    BOOST_CHECK_THROW(lidx::read("test_lidx_range.lidx", a), std::runtime_error);
+    
+    // but values that fit are converted:
+    wide[1].data[0] = 255;
+    lidx::write("test_lidx_range.lidx", wide);
+    lidx::read("test_lidx_range.lidx", a);
+    BOOST_CHECK_EQUAL(a[1][0], 255);
+    BOOST_CHECK_EQUAL(a[4][5], wide[4].data[5]);
+    std::remove("test_lidx_range.lidx");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_record_view) {
+    binary_db_type db;
+    fill_db(db, 5);
+    BOOST_CHECK(db.integrals().empty());
+    db.build_integral();
+    BOOST_REQUIRE_EQUAL(db.integrals().size(), 5u);
+    binary_db_type::view_type v = db.view(3);
+    BOOST_CHECK_EQUAL(v.size1(), 3u);
+    BOOST_CHECK_EQUAL(v.size2(), 4u);
+    BOOST_CHECK_EQUAL(v.label(), 3);
+    BOOST_CHECK_EQUAL(v[5], db[3].data[5]);
+
+    // row 1, columns 1..2:
+    integral_image::sum_type s = db[3].data[5] + db[3].data[6];
+    BOOST_CHECK_EQUAL(v.integral().sum(1, 1, 2, 3), s);
+    BOOST_CHECK_EQUAL(v.integral().area(-1, -1, 10, 10), 12u);
+    BOOST_CHECK(&v.integral() == &db.integrals()[3]);
+
+    // views of records without a table build their own integral image:
+    binary_db_type::record_type r = db[1];
+    lidx::record_view<binary_db_type::record_type> u(r, 3, 4);
+    BOOST_CHECK_EQUAL(u.integral().sum(0, 0, 3, 4), db.integrals()[1].sum(0, 0, 3, 4));
+
+    // arena records are viewed through spans, once the table has been built:
+    lidx::arena_db<int, int> a;
+    a.dims() = db.dims();
+    for(std::size_t i=0; i<db.size(); ++i) {
+        a.push_back(db[i].label, db[i].data);
+    }
+    BOOST_CHECK(!a[3].has_integral());
+    BOOST_CHECK_THROW(a[3].integral(), std::runtime_error);
+    a.build_integral();
+    BOOST_REQUIRE(a[3].has_integral());
+    BOOST_CHECK_EQUAL(a[3].integral().sum(1, 1, 2, 3), s);
+    BOOST_CHECK_EQUAL(a[3].integral().sum(0, 0, 3, 4), db.integrals()[3].sum(0, 0, 3, 4));
+
+    // and the table is dropped when records are reordered:
+    std::vector<std::size_t> order(1, 3);
+    a.permute(order);
+    BOOST_CHECK(a.integrals().empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_bit_vector) {
+    bit_vector v(11);
+    BOOST_CHECK_EQUAL(v.size(), 11u);
+    BOOST_CHECK_EQUAL(v.nbytes(), 2u);
+    v[3] = 1;
+    v[10] = 7;
+    BOOST_CHECK_EQUAL(v[3], 1);
+    BOOST_CHECK_EQUAL(v[10], 1);
+    BOOST_CHECK_EQUAL(v[4], 0);
+    BOOST_CHECK_EQUAL(v.bytes()[0], 0x08);
+    BOOST_CHECK_EQUAL(v.bytes()[1], 0x04);
+    v[3] = 0;
+    BOOST_CHECK_EQUAL(v.bytes()[0], 0x00);
+    
+    // shrinking clears the unused bits, so equal vectors have equal bytes:
+    v.resize(10);
+    BOOST_CHECK_EQUAL(v.bytes()[1], 0x00);
+    int x[10] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    bit_vector u;
+    u.assign(x, x+10);
+    BOOST_CHECK(u == v);
+    v.resize(12, 1);
+    BOOST_CHECK_EQUAL(v[11], 1);
+    BOOST_CHECK(u != v);
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_compact) {
+    typedef lidx::lidx_db<int, uint8_t, lidx::packedS> u8_db_type;
+    typedef lidx::lidx_db<int, lidx::bit, lidx::packedS> bit_db_type;
+    
+    // legacy <int,int> archives are converted as they're read:
+    xml_db_type legacy;
+    fill_db(legacy, 20);
+    for(std::size_t i=0; i<20; ++i) {
+        for(std::size_t j=0; j<12; ++j) {
+            legacy[i].data[j] *= (legacy[i].data[j] % 3 != 0);
+        }
+    }
+    lidx::write("test_lidx_compact.xml", legacy);
+    u8_db_type a;
+    lidx::read("test_lidx_compact.xml", a);
+    BOOST_REQUIRE_EQUAL(a.records().size(), 20u);
+    BOOST_CHECK_EQUAL(a[13].label, legacy[13].label);
+    BOOST_CHECK(std::equal(a[13].data.begin(), a[13].data.end(), legacy[13].data.begin()));
+    
+    // 8b data is stored at 8b:
+    lidx::write("test_lidx_compact.lidx", a);
+    lidx::packed_file f("test_lidx_compact.lidx");
+    BOOST_CHECK_EQUAL(f.header().data_type, lidx::DT_UINT8);
+    BOOST_CHECK_EQUAL(f.record_bytes(), 12u);
+    BOOST_CHECK_EQUAL(f.data<uint8_t>(13)[5], legacy[13].data[5]);
+    
+    // and 0/1 data at 1 bit per element, in memory and on disk:
+    bit_db_type b;
+    lidx::read("test_lidx_compact.xml", b);
+    BOOST_CHECK_EQUAL(b[13].data.nbytes(), 2u);
+    for(std::size_t j=0; j<12; ++j) {
+        BOOST_CHECK_EQUAL(b[13].data[j], legacy[13].data[j] != 0);
+    }
+    lidx::write("test_lidx_compact.lidx", b);
+    lidx::packed_file g("test_lidx_compact.lidx");
+    BOOST_CHECK_EQUAL(g.header().data_type, lidx::DT_BIT);
+    BOOST_CHECK_EQUAL(g.record_bytes(), 2u);
+    
+    bit_db_type c;
+    lidx::read("test_lidx_compact.lidx", c);
+    BOOST_REQUIRE_EQUAL(c.records().size(), 20u);
+    for(std::size_t i=0; i<20; ++i) {
+        BOOST_CHECK_EQUAL(c[i].label, b[i].label);
+        BOOST_CHECK(c[i].data == b[i].data);
+    }
+    
+    // bits are unpacked for databases of other types:
+    binary_db_type d;
+    lidx::read("test_lidx_compact.lidx", d);
+    for(std::size_t j=0; j<12; ++j) {
+        BOOST_CHECK_EQUAL(d[13].data[j], legacy[13].data[j] != 0);
+    }
+    
+    // and compact records can be viewed like any other:
+    lidx::record_view<bit_db_type::record_type> v(c[13], 3, 4);
+    BOOST_CHECK_EQUAL(v[1], d[13].data[1]);
+    BOOST_CHECK_EQUAL(v.integral().sum(0, 0, 3, 4), std::count(d[13].data.begin(), d[13].data.end(), 1));
+    
+    std::remove("test_lidx_compact.xml");
+    std::remove("test_lidx_compact.lidx");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_arena) {
+    typedef lidx::arena_db<int, uint8_t> arena_type;
+    typedef lidx::arena_db<int, lidx::bit> bit_arena_type;
+    
+    xml_db_type legacy;
+    fill_db(legacy, 30);
+    for(std::size_t i=0; i<30; ++i) {
+        for(std::size_t j=0; j<12; ++j) {
+            legacy[i].data[j] *= (legacy[i].data[j] % 3 != 0);
+        }
+    }
+    lidx::write("test_lidx_arena.xml", legacy);
+    
+    // legacy archives are converted into the arena:
+    arena_type a;
+    lidx::read("test_lidx_arena.xml", a);
+    BOOST_REQUIRE_EQUAL(a.size(), 30u);
+    BOOST_CHECK_EQUAL(a.record_size(), 12u);
+    BOOST_CHECK_EQUAL(a.data().size(), 30u*12u);
+    arena_type::span_type s = a[7];
+    BOOST_CHECK_EQUAL(s.label(), legacy[7].label);
+    BOOST_CHECK_EQUAL(s.size(), 12u);
+    for(std::size_t j=0; j<12; ++j) {
+        BOOST_CHECK_EQUAL(s[j], legacy[7].data[j]);
+    }
+    // records are adjacent in the arena:
+    BOOST_CHECK_EQUAL(&a[8][0] - &a[7][0], 12);
+    
+    // packed files are read in one piece, and in either layout:
+    lidx::write("test_lidx_arena.lidx", a);
+    lidx::write("test_lidx_arena.lidx.gz", a);
+    arena_type b, c;
+    lidx::read("test_lidx_arena.lidx", b);
+    lidx::read("test_lidx_arena.lidx.gz", c);
+    BOOST_CHECK(b.labels() == a.labels());
+    BOOST_CHECK(b.data() == a.data());
+    BOOST_CHECK(c.labels() == a.labels());
+    BOOST_CHECK(c.data() == a.data());
+    
+    packed_db_type d;
+    lidx::read("test_lidx_arena.lidx", d);
+    BOOST_CHECK(std::equal(d[7].data.begin(), d[7].data.end(), legacy[7].data.begin()));
+    
+    // bit arenas pad each record to a byte:
+    bit_arena_type e;
+    lidx::read("test_lidx_arena.lidx", e);
+    BOOST_CHECK_EQUAL(e.stride(), 16u);
+    BOOST_CHECK_EQUAL(e.data().nbytes(), 60u);
+    for(std::size_t j=0; j<12; ++j) {
+        BOOST_CHECK_EQUAL(e[7][j], legacy[7].data[j] != 0);
+    }
+    lidx::write("test_lidx_arena.lidx", e);
+    bit_arena_type f;
+    lidx::read("test_lidx_arena.lidx", f);
+    BOOST_CHECK(f.data() == e.data());
+    lidx::lidx_db<int, lidx::bit, lidx::packedS> g;
+    lidx::read("test_lidx_arena.lidx", g);
+    BOOST_CHECK(g[7].data == legacy_bits(legacy[7].data));
+    
+    // records can be added and reordered:
+    std::vector<std::size_t> order;
+    for(std::size_t i=0; i<30; ++i) {
+        order.push_back(29 - i);
+    }
+    a.push_back(42, legacy[3].data);
+    BOOST_CHECK_EQUAL(a.size(), 31u);
+    BOOST_CHECK_EQUAL(a[30].label(), 42);
+    BOOST_CHECK_EQUAL(a[30][5], legacy[3].data[5]);
+    a.resize(30);
+    a.permute(order);
+    BOOST_CHECK_EQUAL(a[0].label(), legacy[29].label);
+    BOOST_CHECK_EQUAL(a[29][4], legacy[0].data[4]);
+    e.permute(order);
+    BOOST_CHECK_EQUAL(e[22][4], legacy[7].data[4] != 0);
+    
+    std::remove("test_lidx_arena.xml");
+    std::remove("test_lidx_arena.lidx");
+    std::remove("test_lidx_arena.lidx.gz");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_stream) {
+    binary_db_type a;
+    fill_db(a, 25);
+    
+    // write through the output iterator, and one record at a time:
+    {
+        lidx::writer<int, uint8_t> w("test_lidx_stream.lidx", a.dims());
+        std::copy(a.records().begin(), a.records().begin()+20, w.begin());
+        for(std::size_t i=20; i<25; ++i) {
+            w.write(a[i].label, a[i].data);
+        }
+        BOOST_CHECK_EQUAL(w.size(), 25u);
+        w.close();
+    }
+    {
+        lidx::writer<int, lidx::bit> w("test_lidx_stream.lidx.gz", a.dims());
+        std::copy(a.records().begin(), a.records().end(), w.begin());
+        BOOST_CHECK_THROW(w.write(1, std::vector<int>(3)), std::runtime_error);
+    }
+    std::ifstream spool("test_lidx_stream.lidx.spool");
+    BOOST_CHECK(!spool.is_open());
+    
+    // streamed files are ordinary packed files:
+    packed_db_type b;
+    lidx::read("test_lidx_stream.lidx", b);
+    BOOST_REQUIRE_EQUAL(b.records().size(), 25u);
+    for(std::size_t i=0; i<25; ++i) {
+        BOOST_CHECK_EQUAL(b[i].label, a[i].label);
+        BOOST_CHECK(b[i].data == a[i].data);
+    }
+    lidx::lidx_db<int, lidx::bit, lidx::packedS> c;
+    lidx::read("test_lidx_stream.lidx.gz", c);
+    BOOST_REQUIRE_EQUAL(c.records().size(), 25u);
+    BOOST_CHECK(c[0].data == legacy_bits(a[0].data));
+    
+    // and files of every format can be read back one record at a time:
+    lidx::write("test_lidx_stream.xml.gz", a);
+    const char* fnames[3] = {"test_lidx_stream.lidx", "test_lidx_stream.lidx.gz", "test_lidx_stream.xml.gz"};
+    for(int f=0; f<3; ++f) {
+        lidx::reader<int, int> r(fnames[f]);
+        BOOST_CHECK(r.dims() == a.dims());
+        BOOST_CHECK_EQUAL(r.size(), 25u);
+        std::size_t n=0;
+        for(lidx::reader<int, int>::iterator i=r.begin(); i!=r.end(); ++i, ++n) {
+            BOOST_CHECK_EQUAL(i->label, a[n].label);
+            if(f == 1) {
+                bit_vector bits = legacy_bits(a[n].data);
+                for(std::size_t j=0; j<bits.size(); ++j) {
+                    BOOST_CHECK_EQUAL(i->data[j], bits[j]);
+                }
+            } else {
+                BOOST_CHECK(i->data == a[n].data);
+            }
+        }
+        BOOST_CHECK_EQUAL(n, 25u);
+        lidx::reader<int, int>::record_type rec;
+        BOOST_CHECK(!r.next(rec));
+    }
+    
+    std::remove("test_lidx_stream.lidx");
+    std::remove("test_lidx_stream.lidx.gz");
+    std::remove("test_lidx_stream.xml.gz");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_block_gzip) {
+    namespace bio = boost::iostreams;
+    std::string data;
+    for(std::size_t i=0; i<100000; ++i) {
+        data.push_back(static_cast<char>((i*i >> 5) % 7));
+    }
+    
+    // small blocks, several at a time:
+    std::vector<char> z;
+    {
+        bio::filtering_ostream out;
+        out.push(block_gzip::compressor(4096, 3));
+        out.push(bio::back_inserter(z));
+        out.write(data.data(), data.size());
+    }
+    BOOST_CHECK(block_gzip::match(reinterpret_cast<const unsigned char*>(&z[0]), z.size()));
+    
+    // with an index at the end, so ranges can be read without decompressing every block:
+    const unsigned char* zp = reinterpret_cast<const unsigned char*>(&z[0]);
+    block_gzip::index idx;
+    BOOST_REQUIRE(idx.load(zp, z.size()));
+    BOOST_CHECK(idx.stored());
+    BOOST_CHECK_EQUAL(idx.size(), 25u);
+    BOOST_CHECK_EQUAL(idx.uncompressed_size(), data.size());
+    std::string range(10000, 0);
+    idx.read(zp, 4000, range.size(), &range[0], 2);
+    BOOST_CHECK(range == data.substr(4000, 10000));
+    idx.read(zp, data.size() - 5, 5, &range[0]);
+    BOOST_CHECK(range.substr(0, 5) == data.substr(data.size() - 5));
+    BOOST_CHECK_THROW(idx.read(zp, data.size() - 5, 6, &range[0]), std::runtime_error);
+    
+    // files without the index are walked instead:
+    std::vector<char> unindexed(z.begin(), z.begin() + idx[24].coffset + idx[24].csize);
+    std::vector<char> eof;
+    block_gzip::detail::deflate_member(0, 0, 6, eof);
+    unindexed.insert(unindexed.end(), eof.begin(), eof.end());
+    block_gzip::index walked;
+    BOOST_REQUIRE(walked.load(reinterpret_cast<const unsigned char*>(&unindexed[0]), unindexed.size()));
+    BOOST_CHECK(!walked.stored());
+    BOOST_CHECK_EQUAL(walked.size(), 25u);
+    BOOST_CHECK_EQUAL(walked[24].coffset, idx[24].coffset);
+    BOOST_CHECK_EQUAL(walked.uncompressed_size(), data.size());
+    BOOST_CHECK(!walked.load(reinterpret_cast<const unsigned char*>(data.data()), data.size()));
+    
+    // which can be read in parallel, or by an ordinary gzip decompressor:
+    for(int k=0; k<2; ++k) {
+        bio::filtering_istream in;
+        if(k == 0) {
+            in.push(block_gzip::decompressor(4));
+        } else {
+            in.push(bio::gzip_decompressor());
+        }
+        in.push(bio::array_source(&z[0], z.size()));
+        std::string back((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        BOOST_CHECK(back == data);
+    }
+    
+    // corrupt blocks are detected:
+    z[block_gzip::header_size + 10] ^= 0x55;
+    bio::filtering_istream in;
+    in.push(block_gzip::decompressor(2));
+    in.push(bio::array_source(&z[0], z.size()));
+    in.exceptions(std::ios::badbit);
+    BOOST_CHECK_THROW(std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>()), std::exception);
+    
+    // lidx writes block gzipped files, and reads those and ordinary gzipped files:
+    packed_db_type a, b, c;
+    fill_db(a, 40);
+    lidx::write("test_lidx_block.lidx.gz", a);
+    {
+        mapped_file f("test_lidx_block.lidx.gz");
+        BOOST_CHECK(block_gzip::match(f.data(), f.size()));
+    }
+    lidx::read("test_lidx_block.lidx.gz", b);
+    BOOST_REQUIRE_EQUAL(b.records().size(), 40u);
+    BOOST_CHECK(b[39].data == a[39].data);
+    {
+        std::ofstream ofs("test_lidx_plain.lidx.gz", std::ios::binary);
+        bio::filtering_ostream out;
+        out.push(bio::gzip_compressor());
+        out.push(ofs);
+        lidx::detail::write_packed(out, a);
+    }
+    lidx::read("test_lidx_plain.lidx.gz", c);
+    BOOST_REQUIRE_EQUAL(c.records().size(), 40u);
+    BOOST_CHECK(c[39].data == a[39].data);
+    lidx::reader<int, int> r("test_lidx_plain.lidx.gz");
+    BOOST_CHECK_EQUAL(r.size(), 40u);
+    
+    std::remove("test_lidx_block.lidx.gz");
+    std::remove("test_lidx_plain.lidx.gz");
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_range) {
+    packed_db_type a;
+    xml_db_type x;
+    fill_db(a, 200);
+    fill_db(x, 200);
+    lidx::write("test_lidx_range.lidx", a);
+    lidx::write("test_lidx_range.lidx.gz", a);
+    lidx::write("test_lidx_range.xml", x);
+    
+    // packed files (gzipped or not) read only the range; archives are trimmed to it:
+    const char* fnames[] = {"test_lidx_range.lidx", "test_lidx_range.lidx.gz", "test_lidx_range.xml"};
+    for(int k=0; k<3; ++k) {
+        packed_db_type b;
+        lidx::read_range(fnames[k], 50, 75, b);
+        BOOST_CHECK(b.dims() == a.dims());
+        BOOST_REQUIRE_EQUAL(b.records().size(), 25u);
+        for(std::size_t i=0; i<25; ++i) {
+            BOOST_CHECK_EQUAL(b[i].label, a[50 + i].label);
+            BOOST_CHECK(b[i].data == a[50 + i].data);
+        }
+        
+        lidx::arena_db<int, uint8_t> c;
+        lidx::read_range(fnames[k], 190, 200, c);
+        BOOST_REQUIRE_EQUAL(c.size(), 10u);
+        BOOST_CHECK_EQUAL(c[9].label(), a[199].label);
+        BOOST_CHECK_EQUAL(c[9][11], a[199].data[11]);
+        
+        packed_db_type empty;
+        lidx::read_range(fnames[k], 10, 10, empty);
+        BOOST_CHECK_EQUAL(empty.records().size(), 0u);
+        BOOST_CHECK_THROW(lidx::read_range(fnames[k], 150, 201, empty), std::runtime_error);
+    }
+    
+    for(int k=0; k<3; ++k) {
+        std::remove(fnames[k]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_paged) {
+    typedef lidx::paged_db<int, uint8_t> paged_type;
+    packed_db_type a;
+    fill_db(a, 100);
+    lidx::write("test_lidx_paged.lidx", a);
+    lidx::write("test_lidx_paged.lidx.gz", a);
+    
+    const char* fnames[] = {"test_lidx_paged.lidx", "test_lidx_paged.lidx.gz"};
+    for(int k=0; k<2; ++k) {
+        // 16 bytes per record, 4 records per block, 3 blocks in the cache:
+        paged_type p(fnames[k], 3*64, 64);
+        BOOST_CHECK_EQUAL(p.size(), 100u);
+        BOOST_CHECK(p.dims() == a.dims());
+        BOOST_CHECK_EQUAL(p.block_records(), 4u);
+        BOOST_CHECK_EQUAL(p.labels()[57], a[57].label);
+        BOOST_CHECK_EQUAL(p.cached(), 0u);
+        
+        for(std::size_t i=0; i<100; ++i) {
+            paged_type::span_type s = p[i];
+            BOOST_CHECK_EQUAL(s.label(), a[i].label);
+            BOOST_CHECK_EQUAL(s[11], a[i].data[11]);
+        }
+        BOOST_CHECK_EQUAL(p.misses(), 25u);
+        BOOST_CHECK_EQUAL(p.hits(), 75u);
+        BOOST_CHECK_EQUAL(p.cached(), 3u);
+        
+        // blocks 22-24 are cached; touching 22 and 24 leaves 23 least recently used:
+        p.reset_counters();
+        p[89]; p[99]; p[90];
+        BOOST_CHECK_EQUAL(p.hits(), 3u);
+        p[0];
+        BOOST_CHECK_EQUAL(p.misses(), 1u);
+        p[99]; p[91];
+        BOOST_CHECK_EQUAL(p.misses(), 1u);
+        p[95];
+        BOOST_CHECK_EQUAL(p.misses(), 2u);
+        
+        p.budget(0);
+        BOOST_CHECK_EQUAL(p.cached(), 1u);
+    }
+    
+    // archives can't be paged:
+    xml_db_type x;
+    fill_db(x, 10);
+    lidx::write("test_lidx_paged.xml", x);
+    BOOST_CHECK_THROW(paged_type("test_lidx_paged.xml"), std::runtime_error);
+    
+    std::remove("test_lidx_paged.lidx");
+    std::remove("test_lidx_paged.lidx.gz");
+    std::remove("test_lidx_paged.xml");
+}
+
+//! Deterministic stand-in for an ealib rng: returns a random integer in [0, n).
+struct test_rng {
+    test_rng() : x(12345) { }
+    std::size_t operator()(std::size_t n) {
+        x = x * 1103515245u + 12345u;
+        return (x >> 8) % n;
+    }
+    unsigned int x;
+};
+
+BOOST_AUTO_TEST_CASE(test_lidx_sampling) {
+    // 3 classes, badly imbalanced: 80 records of 0, 15 of 1, 5 of 2:
+    packed_db_type a;
+    fill_db(a, 100);
+    for(std::size_t i=0; i<100; ++i) {
+        a[i].label = (i < 80) ? 0 : ((i < 95) ? 1 : 2);
+    }
+    a.build_label_index();
+    const packed_db_type::label_index_type& idx = a.by_label();
+    BOOST_CHECK_EQUAL(idx.size(), 3u);
+    BOOST_CHECK_EQUAL(idx.records(), 100u);
+    BOOST_CHECK_EQUAL(idx[0].size(), 80u);
+    BOOST_CHECK_EQUAL(idx[2].size(), 5u);
+    BOOST_CHECK_EQUAL(idx[2][0], 95u);
+    BOOST_CHECK(idx[7].empty());
+    
+    lidx::stratified_sampler<int> sampler(idx);
+    test_rng rng;
+    std::vector<std::size_t> s;
+    std::vector<std::size_t> drawn(100, 0);
+    for(int k=0; k<5; ++k) {
+        sampler.sample(10, rng, s);
+        BOOST_REQUIRE_EQUAL(s.size(), 10u);
+        std::size_t counts[3] = {0, 0, 0};
+        for(std::size_t i=0; i<s.size(); ++i) {
+            ++counts[a[s[i]].label];
+            ++drawn[s[i]];
+        }
+        // each class gets 3 or 4 of the 10:
+        for(int c=0; c<3; ++c) {
+            BOOST_CHECK(counts[c] == 3 || counts[c] == 4);
+        }
+    }
+    // every record of class 1 and 2 has been drawn, since classes are drawn without replacement:
+    for(std::size_t i=80; i<100; ++i) {
+        BOOST_CHECK(drawn[i] > 0);
+    }
+    
+    // records weren't moved:
+    packed_db_type b;
+    fill_db(b, 100);
+    BOOST_CHECK(a[96].data == b[96].data);
+}
+
+BOOST_AUTO_TEST_CASE(test_epoch_permutation) {
+    test_rng rng;
+    
+    // reshuffled every update; views taken earlier are unaffected:
+    epoch_permutation p(10);
+    epoch_permutation::view v = p.current();
+    BOOST_REQUIRE_EQUAL(v.size(), 10u);
+    BOOST_CHECK_EQUAL(v[3], 3u);
+    p.advance(rng, 3);
+    epoch_permutation::view w = p.current();
+    BOOST_CHECK_EQUAL(v[3], 3u);
+    std::vector<std::size_t> seen(10, 0);
+    for(std::size_t i=0; i<10; ++i) {
+        ++seen[w[i]];
+    }
+    BOOST_CHECK(std::count(seen.begin(), seen.end(), 1) == 10);
+    BOOST_CHECK_EQUAL(p.epoch(), 1u);
+    
+    // in epochs of 4 updates, the first 3 of each view walk all 10 records:
+    epoch_permutation q(10, 4);
+    for(int e=0; e<3; ++e) {
+        seen.assign(10, 0);
+        for(int u=0; u<4; ++u) {
+            epoch_permutation::view x = q.current();
+            for(std::size_t i=0; i<3; ++i) {
+                ++seen[x[i]];
+            }
+            q.advance(rng, 3);
+        }
+        // 12 reads of 10 records; the last view wraps around to the first 2:
+        BOOST_CHECK(std::count(seen.begin(), seen.end(), 0) == 0);
+        BOOST_CHECK_EQUAL(std::accumulate(seen.begin(), seen.end(), 0u), 12u);
+    }
+    BOOST_CHECK_EQUAL(q.epoch(), 3u);
+    
+    // views start after the records actually read, however many that is:
+    epoch_permutation e(10, 3);
+    epoch_permutation::view e0 = e.current();
+    e.advance(rng, 2);
+    BOOST_CHECK_EQUAL(e.current()[0], e0[2]);
+    e.advance(rng, 5);
+    BOOST_CHECK_EQUAL(e.current()[0], e0[7]);
+    BOOST_CHECK_EQUAL(e.current()[3], e0[0]); // wraps around
+    
+    // and runs that would skip records are rejected:
+    BOOST_CHECK_THROW(epoch_permutation::check_walk(10, 4, 2), std::invalid_argument);
+    epoch_permutation::check_walk(10, 4, 3);
+    epoch_permutation::check_walk(10, 0, 1); // reshuffled every update
+    
+    // by blocks: 100 records in blocks of 10, 3 of which fit in memory, so
+    // each run of 30 records in the order comes from 3 whole blocks:
+    std::vector<std::size_t> block(100);
+    for(std::size_t i=0; i<100; ++i) {
+        block[i] = i / 10;
+    }
+    epoch_permutation b(100);
+    b.advance(rng, 30, block, 3);
+    epoch_permutation::view y = b.current();
+    seen.assign(100, 0);
+    for(std::size_t i=0; i<100; i+=30) {
+        std::vector<std::size_t> blocks;
+        for(std::size_t j=i; j<std::min<std::size_t>(i+30, 100); ++j) {
+            ++seen[y[j]];
+            blocks.push_back(block[y[j]]);
+        }
+        std::sort(blocks.begin(), blocks.end());
+        blocks.erase(std::unique(blocks.begin(), blocks.end()), blocks.end());
+        BOOST_CHECK_EQUAL(blocks.size(), (i < 90) ? 3u : 1u);
+    }
+    BOOST_CHECK(std::count(seen.begin(), seen.end(), 1) == 100);
+    
+    // arbitrary orders (e.g., stratified samples) can be swapped in:
+    std::vector<std::size_t> s(2, 7);
+    s[1] = 4;
+    q.assign(s);
+    BOOST_CHECK_EQUAL(q.current().size(), 2u);
+    BOOST_CHECK_EQUAL(q.current()[1], 4u);
+    
+    // copies advance independently:
+    epoch_permutation r(q);
+    r.reset(5);
+    BOOST_CHECK_EQUAL(q.current().size(), 2u);
+    BOOST_CHECK_EQUAL(r.current().size(), 5u);
+}
+
+BOOST_AUTO_TEST_CASE(test_lidx_dedup) {
+    // 3 copies of 20 records, one of which differs from another only by label:
+    packed_db_type a;
+    fill_db(a, 20);
+    a[7].data = a[3].data;
+    for(std::size_t r=0; r<2; ++r) {
+        for(std::size_t i=0; i<20; ++i) {
+            a.records().push_back(a[i]);
+        }
+    }
+    
+    std::vector<std::size_t> unique, counts;
+    BOOST_CHECK_EQUAL(lidx::find_duplicates(a, unique, counts), 20u);
+    BOOST_REQUIRE_EQUAL(unique.size(), 20u);
+    BOOST_CHECK_EQUAL(unique[19], 19u);
+    BOOST_CHECK(std::count(counts.begin(), counts.end(), 3u) == 20);
+    BOOST_CHECK_EQUAL(a.size(), 60u);
+    
+    // in memory, duplicates are dropped:
+    lidx::write("test_lidx_dedup.lidx", a);
+    lidx::arena_db<int, uint8_t> b;
+    lidx::read("test_lidx_dedup.lidx", b);
+    a[45].data[2] += 1; // no longer a copy of record 5
+    BOOST_CHECK_EQUAL(lidx::dedup(a, counts), 21u);
+    BOOST_CHECK_EQUAL(a.size(), 21u);
+    BOOST_CHECK_EQUAL(counts[5], 2u);
+    BOOST_CHECK_EQUAL(counts[20], 1u);
+    BOOST_CHECK_EQUAL(a[20].label, 5);
+    BOOST_CHECK_EQUAL(lidx::dedup(b, counts), 20u);
+    BOOST_CHECK_EQUAL(b.size(), 20u);
+    BOOST_CHECK_EQUAL(b[7].label(), 7);
+    BOOST_CHECK_EQUAL(b[7][0], a[3].data[0]);
+    
+    // paged records are only indexed, even with a single block cached:
+    lidx::paged_db<int, uint8_t> p("test_lidx_dedup.lidx", 0, 64);
+    BOOST_CHECK_EQUAL(lidx::find_duplicates(p, unique, counts), 20u);
+    BOOST_CHECK_EQUAL(unique[12], 12u);
+    BOOST_CHECK_EQUAL(counts[12], 3u);
+    BOOST_CHECK_EQUAL(p.size(), 60u);
+    
+    // weighted scores of distinct records are those of every copy; here,
+    // records are "classified correctly" if their first element is even:
+    lidx::arena_db<int, uint8_t> c;
+    lidx::read("test_lidx_dedup.lidx", c);
+    for(std::size_t n=30; n<=60; n+=30) {
+        // the first n/3 distinct records, and all of their copies:
+        lidx::weighted_score all(n), distinct(n);
+        for(std::size_t i=0; (i < c.size()) && all.more(); ++i) {
+            const std::size_t k=(i % 3)*20 + i/3; // copies of each record in turn
+            all.add(1.0, c[k][0] % 2 == 0);
+        }
+        for(std::size_t i=0; (i < b.size()) && distinct.more(); ++i) {
+            distinct.add(counts[i], b[i][0] % 2 == 0);
+        }
+        BOOST_CHECK_EQUAL(all.examined(), n);
+        BOOST_CHECK_EQUAL(distinct.examined(), n/3);
+        BOOST_CHECK_EQUAL(distinct.total(), all.total());
+        BOOST_CHECK_EQUAL(distinct.score(), all.score());
+        BOOST_CHECK(all.score() > 0.0);
+    }
+    
+    std::remove("test_lidx_dedup.lidx");
+    
+    // stratified samples of distinct records are scored with unit weights, so
+    // that a class with more duplicates (here, class 0) doesn't outweigh the
+    // others, and the whole sample is scored:
+    packed_db_type d;
+    fill_db(d, 20);
+    for(std::size_t r=0; r<4; ++r) {
+        d.records().push_back(d[0]);
+        d.records().push_back(d[10]);
+    }
+    BOOST_CHECK_EQUAL(lidx::dedup(d, counts), 20u);
+    BOOST_CHECK_EQUAL(counts[0], 5u);
+    std::vector<int> labels;
+    for(std::size_t i=0; i<d.size(); ++i) {
+        labels.push_back(d[i].label);
+    }
+    lidx::label_index<int> idx;
+    idx.build(labels.begin(), labels.end());
+    lidx::stratified_sampler<int> sampler(idx);
+    test_rng rng;
+    for(int t=0; t<5; ++t) {
+        std::vector<std::size_t> window;
+        sampler.sample(10, rng, window);
+        lidx::weighted_score unit(10), copies(10);
+        std::vector<double> by_label(10, 0.0);
+        for(std::size_t i=0; (i < window.size()) && unit.more(); ++i) {
+            unit.add(1.0, d[window[i]].label == 0);
+            by_label[d[window[i]].label] += 1.0;
+        }
+        for(std::size_t i=0; (i < window.size()) && copies.more(); ++i) {
+            copies.add(counts[window[i]], d[window[i]].label == 0);
+        }
+        BOOST_CHECK_EQUAL(unit.examined(), 10u);
+        BOOST_CHECK(std::count(by_label.begin(), by_label.end(), 1.0) == 10);
+        BOOST_CHECK_EQUAL(unit.score(), 1.0); // one record of class 0 in 10
+        BOOST_CHECK(copies.score() > unit.score()); // class 0 would outweigh the others
+    }
+}
@@ -23,6 +23,14 @@
 #define BOOST_TEST_MAIN
 #include "test.h"
 #include <evocadx/db/png.h>
+#include <evocadx/db/png_loader.h>
+#include <evocadx/db/pgm_writer.h>
+#include <evocadx/db/binary_image.h>
+#include "png_writer.h"
+#include <boost/lexical_cast.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <cstdio>
 
 BOOST_AUTO_TEST_CASE(test_png1) {
     png image = png("/mnt/research/evocadx/testdata/test1.png", true, 1000);
@@ -53,3 +61,407 @@ BOOST_AUTO_TEST_CASE(test_png3) {
     BOOST_CHECK_EQUAL(image[image.width()*image.height() - 1], std::numeric_limits<png::value_type>::max());
     BOOST_CHECK_CLOSE(image.distance_to_centroid(1480,1100), 1718.696, 0.01);
 }
+
+BOOST_AUTO_TEST_CASE(test_png_inflate) {
+    // both inflate engines must produce the same pixels, for stored (level 0),
+    // fixed, and dynamic huffman blocks:
+    const unsigned long w=301, h=127;
+    for(unsigned int depth=8; depth<=16; depth+=8) {
+        png_writer::pixel_vector_type pixels = png_writer::generate(w, h, depth);
+        for(int level=0; level<=9; level+=3) {
+            png_writer::byte_vector_type data = png_writer::encode(pixels, w, h, depth, -1, level);
+            std::vector<unsigned char> a, b;
+            unsigned long aw, ah, bw, bh;
+            BOOST_CHECK_EQUAL(decode_png(a, aw, ah, &data[0], data.size(), false, png::PICOPNG_INFLATE), 0);
+            BOOST_CHECK_EQUAL(decode_png(b, bw, bh, &data[0], data.size(), false, png::TABLE_INFLATE), 0);
+            BOOST_CHECK_EQUAL(aw, w);
+            BOOST_CHECK_EQUAL(bh, h);
+            BOOST_CHECK_EQUAL(a.size(), w*h*depth/8);
+            BOOST_CHECK(a == b);
+            BOOST_CHECK_EQUAL(b[(w*h-1)*depth/8], (depth == 16) ? (pixels.back() >> 8) : pixels.back());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_png_stream) {
+    // streaming and buffered loads must agree exactly:
+    const char* fname="test_png_stream.png";
+    for(unsigned int depth=8; depth<=16; depth+=8) {
+        png_writer::write_file(fname, png_writer::encode(png_writer::generate(257, 203, depth), 257, 203, depth));
+        for(unsigned int dfact=0; dfact<=4; ++dfact) {
+            png::options opts;
+            opts.downscale_fact = dfact;
+            opts.threshold = (depth == 8) ? 100 : 0; // the heuristic only works for 16b images
+            png a(fname, opts);
+            opts.streaming = true;
+            png b(fname, opts);
+            BOOST_CHECK_EQUAL(a.width(), b.width());
+            BOOST_CHECK_EQUAL(a.height(), b.height());
+            BOOST_CHECK_EQUAL(a.get_bpp(), b.get_bpp());
+            BOOST_CHECK_EQUAL(a.get_centroid().first, b.get_centroid().first);
+            BOOST_CHECK_EQUAL(a.get_centroid().second, b.get_centroid().second);
+            for(std::size_t i=0; i<a.size(); ++i) {
+                BOOST_REQUIRE_EQUAL(a[i], b[i]);
+            }
+        }
+    }
+    std::remove(fname);
+}
+
+BOOST_AUTO_TEST_CASE(test_png_loader) {
+    // parallel loads must return images in filename order, identical to serial loads:
+    png_loader::filename_vector_type filenames;
+    for(unsigned int i=0; i<7; ++i) {
+        std::string fname = "test_png_loader" + boost::lexical_cast<std::string>(i) + ".png";
+        png_writer::write_file(fname, png_writer::encode(png_writer::generate(97+i, 61+2*i, 16, i), 97+i, 61+2*i));
+        filenames.push_back(fname);
+    }
+    png::options opts;
+    opts.streaming = true;
+    png_loader serial(opts, 1), parallel(opts, 3);
+    png_loader::image_vector_type a=serial.load(filenames), b=parallel.load(filenames);
+    BOOST_CHECK_EQUAL(parallel.threads(), 3u);
+    BOOST_REQUIRE_EQUAL(b.size(), filenames.size());
+    BOOST_REQUIRE_EQUAL(parallel.times().size(), filenames.size());
+    for(std::size_t i=0; i<filenames.size(); ++i) {
+        BOOST_CHECK_EQUAL(b[i]->width(), 97+i);
+        BOOST_CHECK_EQUAL(b[i]->height(), 61+2*i);
+        BOOST_CHECK_EQUAL(a[i]->get_centroid().first, b[i]->get_centroid().first);
+        BOOST_CHECK_EQUAL(a[i]->get_centroid().second, b[i]->get_centroid().second);
+        BOOST_CHECK(parallel.times()[i] >= 0.0);
+    }
+
+    // a missing file is reported after the workers finish:
+    filenames.push_back("test_png_loader_missing.png");
+    BOOST_CHECK_THROW(parallel.load(filenames), std::runtime_error);
+    for(std::size_t i=0; i+1<filenames.size(); ++i) {
+        std::remove(filenames[i].c_str());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_png_integral) {
+    // rectangle queries on the integral image must match brute force:
+    const char* fname="test_png_integral.png";
+    const unsigned long w=131, h=77;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png::options opts;
+    opts.weighted = true; // keep the grey levels
+    png a(fname, opts);
+    BOOST_CHECK(a.integral().empty());
+    opts.integral = true;
+    png b(fname, opts);
+    std::remove(fname);
+    const integral_image& I = b.integral();
+    BOOST_REQUIRE(!I.empty());
+
+    boost::random::mt19937 rng(7);
+    boost::random::uniform_int_distribution<> row(-10, h+10), col(-10, w+10);
+    for(int t=0; t<300; ++t) {
+        long i0=row(rng), i1=row(rng), j0=col(rng), j1=col(rng);
+        integral_image::sum_type sum=0;
+        integral_image::count_type count=0;
+        std::size_t area=0;
+        for(long i=std::max(i0, 0L); i<std::min(i1, static_cast<long>(h)); ++i) {
+            for(long j=std::max(j0, 0L); j<std::min(j1, static_cast<long>(w)); ++j) {
+                sum += b[i*w + j];
+                count += (b[i*w + j] != 0);
+                ++area;
+            }
+        }
+        BOOST_REQUIRE_EQUAL(I.sum(i0, j0, i1, j1), sum);
+        BOOST_REQUIRE_EQUAL(I.count(i0, j0, i1, j1), count);
+        BOOST_REQUIRE_EQUAL(I.area(i0, j0, i1, j1), area);
+        if(area) {
+            BOOST_CHECK_CLOSE(I.mean(i0, j0, i1, j1), static_cast<double>(sum)/area, 1e-9);
+            BOOST_CHECK_CLOSE(I.occupancy(i0, j0, i1, j1), static_cast<double>(count)/area, 1e-9);
+        } else {
+            BOOST_CHECK_EQUAL(I.mean(i0, j0, i1, j1), 0.0);
+        }
+    }
+    BOOST_CHECK_EQUAL(I.sum(0, 0, h, w), I.sum(-5, -5, h+5, w+5));
+}
+
+BOOST_AUTO_TEST_CASE(test_png_pyramid) {
+    const char* fname="test_png_pyramid.png";
+    const unsigned long w=101, h=60;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png::options opts;
+    opts.weighted = true; // keep the grey levels
+    opts.pyramid_levels = 4;
+    png a(fname, opts);
+    opts.pyramid_levels = 20; // more than there can be
+    png b(fname, opts);
+    std::remove(fname);
+
+    BOOST_REQUIRE_EQUAL(a.levels(), 4u);
+    BOOST_CHECK_EQUAL(&a.level(0), &a);
+    const unsigned long widths[4] = {101, 51, 26, 13}, heights[4] = {60, 30, 15, 8};
+    for(std::size_t k=0; k<a.levels(); ++k) {
+        BOOST_CHECK_EQUAL(a.level(k).width(), widths[k]);
+        BOOST_CHECK_EQUAL(a.level(k).height(), heights[k]);
+        BOOST_CHECK_EQUAL(a.level(k).get_centroid().first, a.get_centroid().first / (1 << k));
+    }
+    BOOST_CHECK_EQUAL(b.level(b.levels()-1).width(), 1u);
+    BOOST_CHECK_EQUAL(b.level(b.levels()-1).height(), 1u);
+
+    // each pixel is the rounded mean of its 2x2 block, clamped at the edges:
+    const png& p=a.level(1);
+    const png& q=a.level(2);
+    for(std::size_t y=0; y<q.height(); ++y) {
+        for(std::size_t x=0; x<q.width(); ++x) {
+            std::size_t x1=std::min(2*x+1, p.width()-1), y1=std::min(2*y+1, p.height()-1);
+            unsigned int s = p[2*y*p.width() + 2*x] + p[2*y*p.width() + x1] + p[y1*p.width() + 2*x] + p[y1*p.width() + x1];
+            BOOST_REQUIRE_EQUAL(q[y*q.width() + x], (s+2)/4);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(test_png_downscale) {
+    const char* fname="test_png_downscale.png";
+    const unsigned long w=203, h=157;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    for(unsigned int dfact=2; dfact<=5; ++dfact) {
+        png::options opts;
+        opts.weighted = true; // keep the grey levels
+        opts.downscale_fact = dfact;
+        png ref(fname, opts);
+        for(int t=png::SEPARABLE_DOWNSCALE; t<=png::BOX_DOWNSCALE; ++t) {
+            opts.downscale = static_cast<png::downscale_type>(t);
+            opts.threads = 1;
+            png a(fname, opts);
+            opts.threads = 3;
+            png b(fname, opts);
+            opts.streaming = true;
+            png c(fname, opts);
+            opts.streaming = false;
+            BOOST_REQUIRE_EQUAL(a.width(), ref.width());
+            BOOST_REQUIRE_EQUAL(a.height(), ref.height());
+            for(std::size_t i=0; i<a.size(); ++i) {
+                // bands and streaming must not change the result:
+                BOOST_REQUIRE_EQUAL(a[i], b[i]);
+                BOOST_REQUIRE_EQUAL(a[i], c[i]);
+                // separable is the reference filter, up to float rounding:
+                if(t == png::SEPARABLE_DOWNSCALE) {
+                    BOOST_REQUIRE_LE(std::abs(static_cast<int>(a[i]) - static_cast<int>(ref[i])), 4);
+                }
+            }
+        }
+    }
+    std::remove(fname);
+}
+
+BOOST_AUTO_TEST_CASE(test_png_histogram) {
+    const std::size_t w=173, h=91;
+    png_writer::pixel_vector_type pixels = png_writer::generate(w, h);
+    histogram a, b;
+    a.add(&pixels[0], w, h);
+    b.add(&pixels[0], w, h, 4);
+    BOOST_CHECK_EQUAL(a.total(), w*h);
+    BOOST_CHECK_EQUAL(b.total(), w*h);
+
+    // counts and thresholded centroids must match brute force, for any number of threads:
+    const std::size_t maxval=*std::max_element(pixels.begin(), pixels.end());
+    for(std::size_t t=1; t<=maxval; t+=4099) {
+        double x=0, y=0;
+        unsigned int n=0;
+        for(std::size_t i=0; i<pixels.size(); ++i) {
+            if(pixels[i] >= t) {
+                x += i%w;
+                y += i/w;
+                ++n;
+            }
+        }
+        BOOST_CHECK_EQUAL(a.centroid(t).first, round(x/n));
+        BOOST_CHECK_EQUAL(a.centroid(t).second, round(y/n));
+        BOOST_CHECK_EQUAL(b.centroid(t).first, a.centroid(t).first);
+        BOOST_CHECK_EQUAL(b.centroid(t).second, a.centroid(t).second);
+        BOOST_CHECK_EQUAL(a[t], std::count(pixels.begin(), pixels.end(), t));
+        BOOST_CHECK_EQUAL(b[t], a[t]);
+    }
+
+    // otsu splits a bimodal image between its modes:
+    png_writer::pixel_vector_type bimodal(1000);
+    for(std::size_t i=0; i<bimodal.size(); ++i) {
+        bimodal[i] = (i%3) ? 10000 + i%100 : 50000 + i%100;
+    }
+    histogram c;
+    c.add(&bimodal[0], 100, 10);
+    BOOST_CHECK_GT(otsu_threshold(c), 10099);
+    BOOST_CHECK_LE(otsu_threshold(c), 50000);
+    BOOST_CHECK_GE(tail_threshold(c, 0.3), 50000);
+    BOOST_CHECK_LE(tail_threshold(c), 10099);
+
+    // and loading with either method thresholds the image:
+    const char* fname="test_png_histogram.png";
+    png_writer::write_file(fname, png_writer::encode(pixels, w, h));
+    png::options opts;
+    opts.thresholding = png::OTSU_THRESHOLD;
+    png p(fname, opts);
+    std::remove(fname);
+    histogram::value_type t=otsu_threshold(a);
+    for(std::size_t i=0; i<p.size(); ++i) {
+        BOOST_REQUIRE_EQUAL(p[i], (pixels[i] < t) ? 0 : std::numeric_limits<png::value_type>::max());
+    }
+    BOOST_CHECK_EQUAL(p.get_centroid().first, a.centroid(t).first);
+}
+
+BOOST_AUTO_TEST_CASE(test_png_layout) {
+    // every layout must read the same pixels, through every accessor:
+    const char* fname="test_png_layout.png";
+    const unsigned long w=77, h=45; // not a whole number of tiles
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png::options opts;
+    opts.weighted = true; // keep the grey levels
+    opts.pyramid_levels = 3;
+    png a(fname, opts);
+    for(int l=png::TILED_LAYOUT; l<=png::MORTON_LAYOUT; ++l) {
+        opts.layout = static_cast<png::layout_type>(l);
+        png b(fname, opts);
+        BOOST_CHECK_EQUAL(b.layout(), opts.layout);
+        BOOST_CHECK_EQUAL(b.size(), w*h);
+        for(std::size_t k=0; k<a.levels(); ++k) {
+            const png& p=a.level(k);
+            const png& q=b.level(k);
+            BOOST_CHECK_EQUAL(q.layout(), opts.layout);
+            for(std::size_t i=0; i<p.height(); ++i) {
+                for(std::size_t j=0; j<p.width(); ++j) {
+                    BOOST_REQUIRE_EQUAL(p[i*p.width() + j], q[i*q.width() + j]);
+                    BOOST_REQUIRE_EQUAL(p(i, j), q(i, j));
+                }
+            }
+        }
+
+        // downscaling and changing back to row-major give the same pixels:
+        png c(a), d(b);
+        c.downscale(3, png::BOX_DOWNSCALE);
+        d.downscale(3, png::BOX_DOWNSCALE);
+        BOOST_CHECK_EQUAL(d.layout(), opts.layout);
+        for(std::size_t i=0; i<c.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(c[i], d[i]);
+        }
+        b.layout(png::ROW_MAJOR_LAYOUT);
+        for(std::size_t i=0; i<a.size(); ++i) {
+            BOOST_REQUIRE_EQUAL(a[i], b[i]);
+        }
+    }
+    std::remove(fname);
+}
+
+//! Read a binary (P5) pgm written by png::write_pgm; returns its maxval.
+unsigned long read_pgm(const std::string& filename, std::vector<unsigned long>& pixels, unsigned long& w, unsigned long& h) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    std::string magic, comment;
+    unsigned long maxval;
+    std::getline(in, magic);
+    std::getline(in, comment);
+    in >> w >> h >> maxval;
+    in.get();
+    pixels.resize(w*h);
+    for(std::size_t i=0; i<pixels.size(); ++i) {
+        pixels[i] = static_cast<unsigned char>(in.get());
+        if(maxval > 255) {
+            pixels[i] = (pixels[i] << 8) | static_cast<unsigned char>(in.get());
+        }
+    }
+    BOOST_CHECK_EQUAL(magic, "P5");
+    BOOST_CHECK(in.good());
+    return maxval;
+}
+
+BOOST_AUTO_TEST_CASE(test_png_write_pgm) {
+    const char* fname="test_png_write_pgm.png";
+    const unsigned long w=67, h=49;
+    for(unsigned int depth=8; depth<=16; depth+=8) {
+        png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h, depth), w, h, depth));
+        png::options opts;
+        opts.weighted = true; // keep the grey levels
+        boost::shared_ptr<png> p(new png(fname, opts));
+        BOOST_REQUIRE(p->write_pgm("test_png_write_pgm.pgm"));
+
+        // pixels are unchanged, except for the cross at the centroid:
+        std::vector<unsigned long> q;
+        unsigned long qw, qh;
+        BOOST_CHECK_EQUAL(read_pgm("test_png_write_pgm.pgm", q, qw, qh), (depth == 16) ? 65535u : 255u);
+        BOOST_REQUIRE_EQUAL(qw, w);
+        BOOST_REQUIRE_EQUAL(qh, h);
+        std::size_t cx=p->get_centroid().first, cy=p->get_centroid().second, changed=0;
+        for(std::size_t i=0; i<h; ++i) {
+            for(std::size_t j=0; j<w; ++j) {
+                if(q[i*w + j] != (*p)(i, j)) {
+                    BOOST_REQUIRE((i == cy) || (j == cx));
+                    ++changed;
+                }
+            }
+        }
+        BOOST_CHECK(changed > 0);
+        BOOST_CHECK(changed <= 38);
+
+        // the background writer writes the same file:
+        {
+            pgm_writer writer(1);
+            writer.write("test_png_write_pgm2.pgm", p);
+            writer.write("no_such_directory/test_png_write_pgm.pgm", p);
+            p.reset(); // the writer keeps the image until it's written
+            writer.flush();
+            BOOST_REQUIRE_EQUAL(writer.failures().size(), 1u);
+            BOOST_CHECK_EQUAL(writer.failures()[0], "no_such_directory/test_png_write_pgm.pgm");
+        }
+        std::vector<unsigned long> r;
+        read_pgm("test_png_write_pgm2.pgm", r, qw, qh);
+        BOOST_CHECK(q == r);
+    }
+    std::remove(fname);
+    std::remove("test_png_write_pgm.pgm");
+    std::remove("test_png_write_pgm2.pgm");
+}
+
+BOOST_AUTO_TEST_CASE(test_png_crop) {
+    const char* fname="test_png_crop.png";
+    const unsigned long w=181, h=140;
+    png_writer::write_file(fname, png_writer::encode(png_writer::generate(w, h), w, h));
+    png::options opts;
+    opts.downscale_fact = 2;
+    png a(fname, opts);
+    opts.crop = true;
+    png b(fname, opts);
+    std::remove(fname);
+
+    // the crop is the bounding box of the set pixels:
+    const std::size_t x0=b.origin().first, y0=b.origin().second;
+    BOOST_CHECK(b.size() < a.size());
+    BOOST_CHECK_EQUAL(b.full_width(), a.width());
+    BOOST_CHECK_EQUAL(b.full_height(), a.height());
+    BOOST_CHECK_EQUAL(a.full_width(), a.width());
+    std::size_t set=0;
+    for(std::size_t y=0; y<a.height(); ++y) {
+        for(std::size_t x=0; x<a.width(); ++x) {
+            bool inside = (x >= x0) && (x < x0+b.width()) && (y >= y0) && (y < y0+b.height());
+            if(inside) {
+                BOOST_REQUIRE_EQUAL(a(y, x), b(y-y0, x-x0));
+            } else {
+                BOOST_REQUIRE_EQUAL(a(y, x), 0);
+            }
+            set += (a(y, x) > 0);
+        }
+    }
+    BOOST_CHECK(set > 0);
+    bool top=false, bottom=false, left=false, right=false; // each edge of the crop has a set pixel
+    for(std::size_t x=0; x<b.width(); ++x) {
+        top = top || b(0, x);
+        bottom = bottom || b(b.height()-1, x);
+    }
+    for(std::size_t y=0; y<b.height(); ++y) {
+        left = left || b(y, 0);
+        right = right || b(y, b.width()-1);
+    }
+    BOOST_CHECK(top && bottom && left && right);
+
+    // distances to the centroid are the same in both frames:
+    BOOST_CHECK_EQUAL(b.get_centroid().first + x0, a.get_centroid().first);
+    BOOST_CHECK_EQUAL(b.get_centroid().second + y0, a.get_centroid().second);
+    BOOST_CHECK_CLOSE(b.distance_to_centroid(50-x0, 60-y0), a.distance_to_centroid(50, 60), 1e-9);
+
+    binary_image c(b);
+    BOOST_CHECK_EQUAL(c.origin().first, x0);
+    BOOST_CHECK_EQUAL(c.full_height(), a.height());
+}
@@ -0,0 +1,70 @@
+/* test_unfilter.cpp
+ * 
+ * This file is part of EvoCADx.
+ * 
+ * Copyright 2014 David B. Knoester.
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef BOOST_TEST_DYN_LINK
+#define BOOST_TEST_DYN_LINK
+#endif
+#define BOOST_TEST_MAIN
+#include "test.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <vector>
+#include "unfilter.h"
+
+/* Vectorized unfiltering must match the scalar reference byte-for-byte, for
+ every filter type, supported instruction set, and bytewidth, on random
+ scanlines of random lengths (to exercise the tails of the vector loops) at
+ random offsets (to exercise unaligned access).
+ */
+BOOST_AUTO_TEST_CASE(test_unfilter_random) {
+    boost::random::mt19937 rng(1234);
+    boost::random::uniform_int_distribution<> byte(0, 255), len(0, 300), offset(0, 31);
+    const unfilter_isa isas[3] = { UNFILTER_SCALAR, UNFILTER_SSE2, UNFILTER_AVX2 };
+    const unfilter_isa best = unfilter_best_isa();
+
+    for(int trial=0; trial<500; ++trial) {
+        std::size_t length=len(rng), o=offset(rng);
+        std::vector<unsigned char> scanline(length+32), precon(length+32);
+        for(std::size_t i=0; i<scanline.size(); ++i) {
+            scanline[i] = byte(rng);
+            precon[i] = byte(rng);
+        }
+        for(std::size_t bytewidth=1; bytewidth<=8; ++bytewidth) {
+            if(length < bytewidth) {
+                continue; // the reference always writes a whole pixel
+            }
+            for(unsigned long filterType=0; filterType<=5; ++filterType) {
+                for(int first=0; first<2; ++first) {
+                    const unsigned char* p = first ? 0 : &precon[o];
+                    std::vector<unsigned char> expected(length+32);
+                    int e = unfilter_scanline_scalar(&expected[o], &scanline[o], p, bytewidth, filterType, length);
+                    BOOST_REQUIRE_EQUAL(e, (filterType <= 4) ? 0 : 36);
+
+                    for(int k=0; (k<3) && (isas[k] <= best); ++k) {
+                        std::vector<unsigned char> actual(length+32);
+                        BOOST_REQUIRE_EQUAL(unfilter_scanline(isas[k], &actual[o], &scanline[o], p, bytewidth, filterType, length), e);
+                        if(e == 0) {
+                            BOOST_REQUIRE(std::equal(expected.begin()+o, expected.begin()+o+length, actual.begin()+o));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}